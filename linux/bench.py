@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+#
+# bench.py
+#
+# Reproducible benchmark of the raytracer over the worlds/ scenes.
+#
+# Each scene is rendered headlessly ("rt -b") at each of a fixed set
+# of resolutions and pixel samplings, with a fixed random seed, so
+# that regressions that show only at high resolution or many samples
+# are caught.  For each (scene, resolution, samples), after some
+# warm-up runs (which are discarded), the scene is run N times and the
+# median and min of each measurement are reported.  Each run is a
+# separate process, so load time, BVH build time and peak RSS are
+# measured every time.
+#
+#   python3 bench.py [options]                  run the benchmark
+#   python3 bench.py --diff OLD.json NEW.json   compare two result files
+#
+# Results are written as JSON (-o) and CSV (same name with .csv).
+# With --diff, any measurement that got worse by more than the
+# threshold (default 5%) is flagged and the exit status is 1.
+
+import argparse
+import csv
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+
+
+SCENES = [ 'basic', 'phong', 'teapot', 'teapot2', 'transparent', 'instances' ]
+
+# measurement name -> (how to get it from the rt JSON output, True if bigger is better)
+
+MEASUREMENTS = {
+    'Mrays_per_s':  ( lambda s: s['rays']['total'] / s['time']['trace'] / 1.0e6 if s['time']['trace'] > 0 else 0, True ),
+    'ms_per_frame': ( lambda s: s['time']['frame'] * 1000.0, False ),
+    'bvh_build_ms': ( lambda s: s['time']['bvhBuild'] * 1000.0, False ),
+    'load_ms':      ( lambda s: s['time']['load'] * 1000.0, False ),
+    'peak_rss_MB':  ( lambda s: s['peakRSSkB'] / 1024.0, False ),
+}
+
+# The ray and intersection counts do not depend on timing, so they
+# are reported once per configuration.  They change only if the
+# algorithm does.
+
+COUNTS = [ 'bvhNodesVisited', 'rayBoxTests', 'triangleTests', 'sphereTests' ]
+
+
+def runOnce( args, scene, resolution, samples ):
+
+    with tempfile.NamedTemporaryFile( suffix='.json', delete=False ) as f:
+        statsFile = f.name
+
+    cmd = [ args.rt, '-b', '-r', resolution, '-p', str(samples),
+            '-R', str(args.seed), '-s', statsFile, os.path.join( args.worlds, scene ) ]
+
+    try:
+        result = subprocess.run( cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True )
+        if result.returncode != 0:
+            sys.exit( 'bench: "%s" failed:\n%s' % (' '.join(cmd), result.stderr) )
+        with open( statsFile ) as f:
+            return json.load( f )
+    finally:
+        os.remove( statsFile )
+
+
+def runScene( args, scene, resolution, samples ):
+
+    for i in range( args.warmup ):
+        runOnce( args, scene, resolution, samples )
+
+    runs = [ runOnce( args, scene, resolution, samples ) for i in range( args.reps ) ]
+
+    result = { 'scene': scene, 'resolution': resolution, 'samples': samples }
+
+    for name, (get, biggerIsBetter) in MEASUREMENTS.items():
+        values = [ get(s) for s in runs ]
+        result[name] = { 'median': statistics.median( values ),
+                         'min':    min( values ),
+                         'max':    max( values ) }
+
+    result['rays'] = runs[0]['rays']['total']
+    for name in COUNTS:
+        result[name] = runs[0][name]
+
+    return result
+
+
+def writeCSV( filename, results ):
+
+    with open( filename, 'w', newline='' ) as f:
+        out = csv.writer( f )
+        out.writerow( [ 'scene', 'resolution', 'samples' ] +
+                      [ '%s_%s' % (name, stat) for name in MEASUREMENTS for stat in ('median', 'min') ] +
+                      [ 'rays' ] + COUNTS )
+        for r in results:
+            out.writerow( [ r['scene'], r['resolution'], r['samples'] ] +
+                          [ '%.4f' % r[name][stat] for name in MEASUREMENTS for stat in ('median', 'min') ] +
+                          [ r['rays'] ] + [ r[name] for name in COUNTS ] )
+
+
+def printTable( results ):
+
+    print( '%-12s %-10s %7s %12s %12s %12s %12s %12s' % ('scene', 'resolution', 'samples', 'Mrays/s', 'ms/frame', 'BVH ms', 'load ms', 'RSS MB') )
+    for r in results:
+        print( '%-12s %-10s %7d %12.3f %12.1f %12.2f %12.1f %12.1f' %
+               (r['scene'], r['resolution'], r['samples'], r['Mrays_per_s']['median'], r['ms_per_frame']['median'],
+                r['bvh_build_ms']['median'], r['load_ms']['median'], r['peak_rss_MB']['median']) )
+    print( '(medians)' )
+
+
+def bench( args ):
+
+    scenes      = args.scenes.split(',') if args.scenes else SCENES
+    resolutions = args.resolution.split(',')
+    samples     = [ int(n) for n in args.samples.split(',') ]
+
+    results = []
+    for scene in scenes:
+        for resolution in resolutions:
+            for n in samples:
+                print( 'bench: %s at %s, %dx%d samples ...' % (scene, resolution, n, n), file=sys.stderr )
+                results.append( runScene( args, scene, resolution, n ) )
+
+    config = { 'resolution': resolutions, 'samples': samples, 'seed': args.seed,
+               'warmup': args.warmup, 'reps': args.reps }
+
+    with open( args.output, 'w' ) as f:
+        json.dump( { 'config': config, 'results': results }, f, indent=2 )
+
+    writeCSV( os.path.splitext( args.output )[0] + '.csv', results )
+
+    printTable( results )
+
+
+# The (scene, resolution, samples) of a result.  A file written before
+# there were several configurations has them only in its 'config'.
+
+def resultKey( r, config ):
+
+    return ( r['scene'], r.get( 'resolution', config['resolution'] ), r.get( 'samples', config['samples'] ) )
+
+
+# Compare the medians of two result files, matching results by
+# (scene, resolution, samples).  Return the number of regressions.
+
+def diff( oldFile, newFile, threshold ):
+
+    with open( oldFile ) as f:
+        old = json.load( f )
+    with open( newFile ) as f:
+        new = json.load( f )
+
+    if old['config'] != new['config']:
+        print( 'warning: the two files were run with different configurations:\n  %s\n  %s' % (old['config'], new['config']) )
+
+    oldResults = { resultKey( r, old['config'] ): r for r in old['results'] }
+
+    numRegressions = 0
+
+    print( '%-30s %-14s %12s %12s %9s' % ('scene, resolution, samples', 'measurement', 'old', 'new', 'change') )
+
+    for r in new['results']:
+
+        key = resultKey( r, new['config'] )
+
+        o = oldResults.get( key )
+        if o is None:
+            continue
+
+        label = '%s, %s, %d' % key
+
+        for name, (get, biggerIsBetter) in MEASUREMENTS.items():
+
+            a = o[name]['median']
+            b = r[name]['median']
+
+            if a == 0:
+                continue
+
+            change = (b - a) / a
+            worse = (change < -threshold) if biggerIsBetter else (change > threshold)
+
+            flag = ''
+            if worse:
+                flag = '  REGRESSION'
+                numRegressions += 1
+
+            print( '%-30s %-14s %12.3f %12.3f %+8.1f%%%s' % (label, name, a, b, 100*change, flag) )
+
+        for name in [ 'rays' ] + COUNTS:
+            if o[name] != r[name]:
+                print( '%-30s %-14s %12d %12d   (count changed)' % (label, name, o[name], r[name]) )
+
+    print( '%d regression%s beyond %.0f%%' % (numRegressions, '' if numRegressions == 1 else 's', 100*threshold) )
+
+    return numRegressions
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser( description='Benchmark the raytracer over the worlds/ scenes.' )
+
+    parser.add_argument( '--rt',         default='./rt',        help='raytracer executable' )
+    parser.add_argument( '--worlds',     default='../worlds',   help='directory of the scene files' )
+    parser.add_argument( '--scenes',     default=None,          help='comma-separated scenes (default: %s)' % ','.join(SCENES) )
+    parser.add_argument( '--resolution', default='400x300,800x600', help='comma-separated image resolutions, each as WIDTHxHEIGHT' )
+    parser.add_argument( '--samples',    default='1,3',         help='comma-separated pixel samplings (each # for # x #)' )
+    parser.add_argument( '--seed',       default=754376105, type=int, help='random seed' )
+    parser.add_argument( '--warmup',     default=1, type=int,   help='warm-up runs per configuration (discarded)' )
+    parser.add_argument( '--reps',       default=5, type=int,   help='measured runs per configuration' )
+    parser.add_argument( '-o', '--output', default='bench.json', help='JSON results file (CSV is written next to it)' )
+    parser.add_argument( '--diff',       nargs=2, metavar=('OLD', 'NEW'), help='compare two results files instead of running' )
+    parser.add_argument( '--threshold',  default=5.0, type=float, help='regression threshold in percent (default 5)' )
+
+    args = parser.parse_args()
+
+    if args.diff:
+        sys.exit( 1 if diff( args.diff[0], args.diff[1], args.threshold / 100.0 ) > 0 else 0 )
+
+    if args.reps < 1:
+        sys.exit( 'bench: --reps must be at least 1' )
+
+    bench( args )
@@ -0,0 +1,251 @@
+#!/usr/bin/env python3
+#
+# golden.py
+#
+# Golden-image regression check of the raytracer.
+#
+# Each scene in worlds/ is rendered headlessly ("rt -b") with a fixed
+# resolution, pixel sampling, jittering, and random seed, and compared
+# with its reference image in worlds/golden/.  The comparison reports
+#
+#   RMSE  root-mean-square error over all channels (in 0..255 units)
+#   PSNR  peak signal-to-noise ratio in dB (inf if identical)
+#   SSIM  mean structural similarity of the luminance over 8x8 windows
+#
+# A scene fails if its PSNR or SSIM is below the tolerance for that
+# scene in worlds/golden/tolerances.json.  For each failing scene, the
+# rendered image and an amplified difference image are written to the
+# output directory.
+#
+#   python3 golden.py            check all scenes (exit status 1 on failure)
+#   python3 golden.py --update   re-render the reference images
+#
+# Update the references only after checking that an image change is
+# intended, and say so in the commit.
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+
+
+SCENES = [ 'basic', 'phong', 'teapot', 'teapot2', 'transparent', 'instances' ]
+
+RESOLUTION = '200x150'
+SAMPLES    = 2                  # pixel sampling (# x #), jittered
+SEED       = 754376105
+
+DIFF_GAIN  = 8                  # amplification of the difference images
+
+SSIM_WINDOW = 8
+SSIM_C1 = (0.01 * 255) ** 2
+SSIM_C2 = (0.03 * 255) ** 2
+
+
+# ---------------- PPM images ----------------
+
+
+def readPPM( filename ):
+
+    with open( filename, 'rb' ) as f:
+        data = f.read()
+
+    # Header is "P6 <width> <height> <maxval>" with one whitespace byte before the pixels
+
+    fields = []
+    pos = 0
+    while len(fields) < 4:
+        while data[pos:pos+1].isspace():
+            pos += 1
+        if data[pos:pos+1] == b'#':
+            while data[pos:pos+1] != b'\n':
+                pos += 1
+            continue
+        start = pos
+        while not data[pos:pos+1].isspace():
+            pos += 1
+        fields.append( data[start:pos] )
+
+    if fields[0] != b'P6' or int(fields[3]) != 255:
+        sys.exit( 'golden: %s is not an 8-bit P6 PPM file' % filename )
+
+    width  = int( fields[1] )
+    height = int( fields[2] )
+    pixels = data[pos+1 : pos+1 + 3*width*height]
+
+    return width, height, pixels
+
+
+def writePPM( filename, width, height, pixels ):
+
+    with open( filename, 'wb' ) as f:
+        f.write( b'P6\n%d %d\n255\n' % (width, height) )
+        f.write( bytes( pixels ) )
+
+
+# ---------------- metrics ----------------
+
+
+def rmse( a, b ):
+
+    sum = 0
+    for x, y in zip( a, b ):
+        sum += (x-y) * (x-y)
+    return math.sqrt( sum / len(a) )
+
+
+def psnr( rmseValue ):
+
+    if rmseValue == 0:
+        return float('inf')
+    return 20 * math.log10( 255 / rmseValue )
+
+
+def luminance( width, height, pixels ):
+
+    return [ 0.299 * pixels[3*i] + 0.587 * pixels[3*i+1] + 0.114 * pixels[3*i+2] for i in range( width*height ) ]
+
+
+# Mean SSIM over non-overlapping windows of the luminance
+
+def ssim( width, height, a, b ):
+
+    la = luminance( width, height, a )
+    lb = luminance( width, height, b )
+
+    n = SSIM_WINDOW * SSIM_WINDOW
+    total = 0
+    numWindows = 0
+
+    for y0 in range( 0, height - SSIM_WINDOW + 1, SSIM_WINDOW ):
+        for x0 in range( 0, width - SSIM_WINDOW + 1, SSIM_WINDOW ):
+
+            sa = sb = saa = sbb = sab = 0
+            for y in range( y0, y0 + SSIM_WINDOW ):
+                row = y * width
+                for x in range( x0, x0 + SSIM_WINDOW ):
+                    p = la[row+x]
+                    q = lb[row+x]
+                    sa += p
+                    sb += q
+                    saa += p*p
+                    sbb += q*q
+                    sab += p*q
+
+            ma = sa / n
+            mb = sb / n
+            va = saa / n - ma*ma
+            vb = sbb / n - mb*mb
+            cov = sab / n - ma*mb
+
+            total += ((2*ma*mb + SSIM_C1) * (2*cov + SSIM_C2)) / ((ma*ma + mb*mb + SSIM_C1) * (va + vb + SSIM_C2))
+            numWindows += 1
+
+    return total / numWindows
+
+
+def diffImage( a, b ):
+
+    return [ min( 255, DIFF_GAIN * abs(x-y) ) for x, y in zip( a, b ) ]
+
+
+# ---------------- rendering and checking ----------------
+
+
+def render( args, scene, imageFile ):
+
+    cmd = [ args.rt, '-b', '-r', RESOLUTION, '-p', str(SAMPLES), '-j', '-R', str(SEED),
+            '-o', imageFile, '-s', os.devnull, os.path.join( args.worlds, scene ) ]
+
+    result = subprocess.run( cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True )
+
+    if result.returncode != 0 or not os.path.exists( imageFile ):
+        sys.exit( 'golden: "%s" failed:\n%s' % (' '.join(cmd), result.stderr) )
+
+
+def check( args, scenes, tolerances ):
+
+    os.makedirs( args.out, exist_ok=True )
+
+    numFailed = 0
+
+    print( '%-12s %8s %8s %8s   %s' % ('scene', 'RMSE', 'PSNR', 'SSIM', 'result') )
+
+    for scene in scenes:
+
+        refFile = os.path.join( args.golden, scene + '.ppm' )
+        outFile = os.path.join( args.out, scene + '.ppm' )
+
+        if not os.path.exists( refFile ):
+            print( '%-12s   no reference image %s (run with --update)' % (scene, refFile) )
+            numFailed += 1
+            continue
+
+        render( args, scene, outFile )
+
+        rw, rh, ref = readPPM( refFile )
+        w, h, img   = readPPM( outFile )
+
+        if (w, h) != (rw, rh):
+            print( '%-12s   image is %dx%d but reference is %dx%d' % (scene, w, h, rw, rh) )
+            numFailed += 1
+            continue
+
+        e = rmse( img, ref )
+        p = psnr( e )
+        s = ssim( w, h, img, ref )
+
+        tol = dict( tolerances['default'] )
+        tol.update( tolerances.get( scene, {} ) )
+
+        passed = (p >= tol['psnr'] and s >= tol['ssim'])
+
+        if passed:
+            os.remove( outFile )
+        else:
+            numFailed += 1
+            writePPM( os.path.join( args.out, scene + '-diff.ppm' ), w, h, diffImage( img, ref ) )
+
+        print( '%-12s %8.3f %8.2f %8.5f   %s' %
+               (scene, e, p, s, 'ok' if passed else 'FAILED (needs PSNR >= %g, SSIM >= %g; see %s)' % (tol['psnr'], tol['ssim'], args.out)) )
+
+    print( '%d of %d scenes failed' % (numFailed, len(scenes)) )
+
+    return numFailed
+
+
+def update( args, scenes ):
+
+    os.makedirs( args.golden, exist_ok=True )
+
+    for scene in scenes:
+        refFile = os.path.join( args.golden, scene + '.ppm' )
+        render( args, scene, refFile )
+        print( 'wrote %s' % refFile )
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser( description='Compare raytraced images of the worlds/ scenes with reference images.' )
+
+    parser.add_argument( '--rt',     default='./rt',              help='raytracer executable' )
+    parser.add_argument( '--worlds', default='../worlds',         help='directory of the scene files' )
+    parser.add_argument( '--golden', default='../worlds/golden',  help='directory of the reference images and tolerances.json' )
+    parser.add_argument( '--out',    default='golden-out',        help='directory for the images of failing scenes' )
+    parser.add_argument( '--scenes', default=None,                help='comma-separated scenes (default: %s)' % ','.join(SCENES) )
+    parser.add_argument( '--update', action='store_true',         help='re-render the reference images instead of checking' )
+
+    args = parser.parse_args()
+
+    scenes = args.scenes.split(',') if args.scenes else SCENES
+
+    if args.update:
+        update( args, scenes )
+        sys.exit( 0 )
+
+    with open( os.path.join( args.golden, 'tolerances.json' ) ) as f:
+        tolerances = json.load( f )
+
+    sys.exit( 1 if check( args, scenes, tolerances ) > 0 else 0 )
@@ -0,0 +1,179 @@
+/* arena.h
+ *
+ * A bump allocator.
+ *
+ * Memory is handed out sequentially from large blocks, and is only
+ * given back all at once (with release()) or back to a mark (with
+ * release( mark )).  Destructors of the allocated objects are NOT
+ * called, so only allocate objects that don't need them.
+ *
+ *   CONSTRUCTORS
+ *
+ *     Arena( n )          Create an arena whose first block has n bytes
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     alloc<T>( n )       Allocate and default-construct an array of n T
+ *     reserve( n )        Make sure that the next n bytes need no new block
+ *     mark()              Remember the current allocation point
+ *     release( m )        Free everything allocated since mark m
+ *     release()           Free everything
+ *     bytesUsed()         Total bytes allocated (not counting padding)
+ *     bytesReserved()     Total bytes in the blocks
+ *
+ * Each new block is twice the size of the one before (starting from
+ * the first block size), so an arena that grows to n bytes makes
+ * O(log n) system allocations, and O(1) if reserve() was given a good
+ * estimate.  A request larger than that gets a block of its own size,
+ * which doesn't change the doubling.  Freeing a block with release()
+ * restores the size that it was made with, so an arena that is
+ * repeatedly released and refilled doesn't grow.
+ */
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <cstdint>
+
+
+class Arena {
+
+  struct Block {
+    Block *prev;		// previously allocated block
+    size_t size;		// bytes of data following this header
+    size_t used;		// bytes of data handed out so far
+    size_t prevNextSize;	// nextBlockSize before this block was made
+  };
+
+  Block *current;		// most recent block, or NULL
+  size_t nextBlockSize;
+  size_t totalUsed;
+  size_t totalSize;		// of all blocks
+
+  static size_t headerSize() {
+    return (sizeof(Block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+  }
+
+  char *blockData( Block *b ) {
+    return (char *) b + headerSize();
+  }
+
+  void newBlock( size_t minSize ) {
+    size_t size = (nextBlockSize > minSize ? nextBlockSize : minSize);
+    Block *b = (Block *) malloc( headerSize() + size );
+    if (b == NULL)
+      throw std::bad_alloc();
+    b->prev = current;
+    b->size = size;
+    b->used = 0;
+    b->prevNextSize = nextBlockSize;
+    current = b;
+    totalSize += size;
+    nextBlockSize = 2 * nextBlockSize;
+  }
+
+  // The first offset at or after 'used' in block b that is aligned
+  // in memory (blocks themselves are only aligned for max_align_t)
+
+  size_t alignedOffset( Block *b, size_t used, size_t align ) {
+    uintptr_t p = (uintptr_t) (blockData( b ) + used);
+    return ((p + align - 1) & ~(uintptr_t) (align - 1)) - (uintptr_t) blockData( b );
+  }
+
+  Arena( const Arena & );	// not copyable
+  Arena & operator = ( const Arena & );
+
+ public:
+
+  class Mark {
+    friend class Arena;
+    Block *block;
+    size_t used;
+    size_t totalUsed;
+  };
+
+  Arena( size_t firstBlockSize = 65536 ) {
+    current = NULL;
+    nextBlockSize = firstBlockSize;
+    totalUsed = 0;
+    totalSize = 0;
+  }
+
+  ~Arena() {
+    release();
+  }
+
+  void *alloc( size_t size, size_t align ) {
+
+    size_t offset = 0;
+
+    if (current != NULL)
+      offset = alignedOffset( current, current->used, align );
+
+    if (current == NULL || offset + size > current->size) {
+      newBlock( size + align );
+      offset = alignedOffset( current, 0, align );
+    }
+
+    current->used = offset + size;
+    totalUsed += size;
+
+    return blockData( current ) + offset;
+  }
+
+  template<class T> T *alloc( int n = 1 ) {
+    T *p = (T *) alloc( n * sizeof(T), alignof(T) );
+    for (int i=0; i<n; i++)
+      new (&p[i]) T();
+    return p;
+  }
+
+  void reserve( size_t n ) {
+    if (current == NULL || current->used + n > current->size)
+      newBlock( n );
+  }
+
+  Mark mark() {
+    Mark m;
+    m.block = current;
+    m.used = (current == NULL ? 0 : current->used);
+    m.totalUsed = totalUsed;
+    return m;
+  }
+
+  void release( Mark m ) {
+    while (current != m.block) {
+      Block *prev = current->prev;
+      nextBlockSize = current->prevNextSize;
+      totalSize -= current->size;
+      free( current );
+      current = prev;
+    }
+    if (current != NULL)
+      current->used = m.used;
+    totalUsed = m.totalUsed;
+  }
+
+  void release() {
+    Mark start;
+    start.block = NULL;
+    start.used = 0;
+    start.totalUsed = 0;
+    release( start );
+  }
+
+  size_t bytesUsed() {
+    return totalUsed;
+  }
+
+  size_t bytesReserved() {
+    return totalSize;
+  }
+};
+
+
+#endif
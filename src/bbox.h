@@ -8,6 +8,7 @@
 
 
 #include "linalg.h"
+#include <cfloat>
 
 
 class BBox {
@@ -24,6 +25,38 @@ class BBox {
     max = c1;
   }
 
+  static BBox empty() {		// contains nothing; include() grows it
+    return BBox( vec3( FLT_MAX, FLT_MAX, FLT_MAX ), vec3( -FLT_MAX, -FLT_MAX, -FLT_MAX ) );
+  }
+
+  bool isEmpty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  void include( const vec3 &p ) {
+    min = vec3( fminf( min.x, p.x ), fminf( min.y, p.y ), fminf( min.z, p.z ) );
+    max = vec3( fmaxf( max.x, p.x ), fmaxf( max.y, p.y ), fmaxf( max.z, p.z ) );
+  }
+
+  void include( const BBox &b ) {
+    if (!b.isEmpty()) {
+      include( b.min );
+      include( b.max );
+    }
+  }
+
+  BBox intersect( const BBox &b ) const {
+    return BBox( vec3( fmaxf( min.x, b.min.x ), fmaxf( min.y, b.min.y ), fmaxf( min.z, b.min.z ) ),
+		 vec3( fminf( max.x, b.max.x ), fminf( max.y, b.max.y ), fminf( max.z, b.max.z ) ) );
+  }
+
+  float surfaceArea() const {	// 0 if empty
+    if (isEmpty())
+      return 0;
+    vec3 d = max - min;
+    return 2 * (d.x*d.y + d.y*d.z + d.z*d.x);
+  }
+
   void renderGL( mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3 lightDir );
 };
 
@@ -17,44 +17,61 @@
 // Upon call, there is guaranteed to be at least one triangle.  
 
 
-#define K                          8 // number of means in k-means
+#define K           BVH_MAX_CHILDREN // number of means in k-means
 #define NUM_RANDOM_CANDIDATES     20 // number of candidates for next random seed of K seeds
 #define NUM_CLUSTERING_ITERATIONS  4 // number of times to shift cluster means
-#define LEAF_COUNT_THRESHOLD       2 // max number of triangles in a leaf
+#define LEAF_COUNT_THRESHOLD BVH_MAX_LEAF_SIZE // max number of triangles in a leaf
 
 
+bool BVH::compress = false;
+float BVH::splitBudget = 0;
 
-BVH_node * BVH::makeLeafNode( seq<int> &triangleIndices )
+
+
+// Make a leaf.  Its triangle indices stay where they are in the
+// index array, which is stored in the node arena.
+
+BVH_node * BVH::makeLeafNode( int *triangleIndices, int numTriangles )
 
 {
-  BVH_node *n = new BVH_node();
+  BVH_node *n = nodeArena.alloc<BVH_node>();
   
   n->isLeaf    = true;
-  n->triangles = new seq<int>( triangleIndices ); // copy constructor
-  n->bbox      = trianglesBBox( triangleIndices );
+  n->count     = numTriangles;
+  n->triangles = triangleIndices;
+  n->bbox      = trianglesBBox( triangleIndices, numTriangles );
     
   return n;
 }
 
 
-BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
+// Build the subtree of triangleIndices[0..numTriangles-1].  The
+// indices are reordered in place so that each child's triangles are
+// contiguous.
+
+BVH_node * BVH::buildSubtree( int *triangleIndices, int numTriangles, int depth )
 
 {
   // Return a leaf node if there are sufficiently few triangles
 
-  if (triangleIndices.size() <= LEAF_COUNT_THRESHOLD)
-    return makeLeafNode( triangleIndices );
-  
+  if (numTriangles <= LEAF_COUNT_THRESHOLD)
+    return makeLeafNode( triangleIndices, numTriangles );
+
+  // Temporaries of this level go in the scratch arena and are
+  // released before recursing
+
+  Arena::Mark scratchMark = scratchArena.mark();
+
   // Find K seed boxes
 
-  int numSeeds = MIN( K, triangleIndices.size() );
+  int numSeeds = MIN( K, numTriangles );
 
-  BBox *seedBoxes = new BBox[numSeeds];
-  int  *seedIndices = new int[numSeeds];
+  BBox seedBoxes[K];
+  int  seedIndices[K];
 
   // Get first seed box
 
-  int randIndex = rand() % triangleIndices.size();
+  int randIndex = rand() % numTriangles;
   seedBoxes[0] = triangleBBox( triangleIndices[randIndex] );
   seedIndices[0] = randIndex;
 
@@ -74,13 +91,13 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
       int randIndex;
       bool alreadyExists;
       do {
-	    randIndex = rand() % triangleIndices.size();
-	    alreadyExists = false;
-	    for (int k=0; k<i; k++)
-	    if (randIndex == seedIndices[k]) {
-	      alreadyExists = true;
-	      break;
-	     }
+	randIndex = rand() % numTriangles;
+	alreadyExists = false;
+	for (int k=0; k<i; k++)
+	  if (randIndex == seedIndices[k]) {
+	    alreadyExists = true;
+	    break;
+	  }
       } while (alreadyExists);
 
       // Build the box for this triangle
@@ -91,26 +108,27 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
 
       float minDist = MAXFLOAT;
       for (int k=0; k<i; k++) {
-	    float thisDist = boxBoxDistance( candidateBox, seedBoxes[k] );
-	    if (thisDist < minDist)
-	      minDist = thisDist;
-          }
+	float thisDist = boxBoxDistance( candidateBox, seedBoxes[k] );
+	if (thisDist < minDist)
+	  minDist = thisDist;
+      }
 
       // Use this candidate if it's farther than the previous candidate.
 
       if (minDist > maxDist) {
-    	maxDist = minDist;
-	    seedBoxes[i] = candidateBox;
-	    seedIndices[i] = randIndex;
-       }
-        }
+	maxDist = minDist;
+	seedBoxes[i] = candidateBox;
+	seedIndices[i] = randIndex;
+      }
     }
+  }
 
   // cout << "Found " << numSeeds << " seed boxes" << endl;
 
-  // Iteratively cluster around each seed
+  // Iteratively cluster around each seed.  clusterOf[i] is the
+  // cluster of triangleIndices[i].
 
-  seq<int> *clusterTriangles;
+  int *clusterOf = scratchArena.alloc<int>( numTriangles );
 
 #if 0
 
@@ -118,12 +136,8 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
   //
   // DELETE THIS CODE in your solution.
 
-  clusterTriangles = new seq<int>[numSeeds];
-
-  for (int i=0; i<triangleIndices.size(); i++) { // all triangles
-    int j = random() % numSeeds;
-    clusterTriangles[j].add( triangleIndices[i] );
-  }
+  for (int i=0; i<numTriangles; i++) // all triangles
+    clusterOf[i] = random() % numSeeds;
 
 #else
 
@@ -133,9 +147,9 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
   // function to compute boxBoxDistance() using the metric of that
   // paper.)
   //
-  // At the end of this clusterTriangles[i] contains the triangle
-  // indices of the triangles in cluster i.  See the demonstration
-  // code above for an example. 
+  // At the end of this clusterOf[i] contains the cluster of
+  // triangleIndices[i].  See the demonstration code above for an
+  // example.
   //
   // You can see your results when running this by pressing 'h' to
   // see/hide the hierarchy, 'o' to hide/see the object, and '{' or
@@ -150,17 +164,12 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
 
   for (int iteration=0; iteration<NUM_CLUSTERING_ITERATIONS; iteration++) {
 
-    if (iteration > 0)
-      delete [] clusterTriangles; // only keep the clusters from the last iteration
-
-    clusterTriangles = new seq<int>[numSeeds];
-
     // For each cluster, find the mean bbox (from equation 2 of
     // Meister and Bittner's paper)
 
-    vec3 *clusterMin = new vec3[numSeeds];
-    vec3 *clusterMax = new vec3[numSeeds];
-    int *clusterCount = new int[numSeeds];
+    vec3 clusterMin[K];
+    vec3 clusterMax[K];
+    int  clusterCount[K];
 
     for (int i=0; i<numSeeds; i++) {
       clusterMin[i] = vec3(0,0,0);
@@ -168,7 +177,7 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
       clusterCount[i] = 0;
     }
 
-    for (int i=0; i<triangleIndices.size(); i++) { // all triangles
+    for (int i=0; i<numTriangles; i++) { // all triangles
 
       BBox bbox = triangleBBox( triangleIndices[i] );
 
@@ -178,11 +187,11 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
       int   minSeed = 0; // set value only to prevent compiler warning only
       
       for (int j=0; j<numSeeds; j++) {
-	    float dist = boxBoxDistance( seedBoxes[j], bbox );
-	    if (dist < minDist) {
-    	  minDist = dist;
-    	  minSeed = j;
-    	}
+	float dist = boxBoxDistance( seedBoxes[j], bbox );
+	if (dist < minDist) {
+	  minDist = dist;
+	  minSeed = j;
+	}
       }
 
       // Update the cluster min/max sums
@@ -191,51 +200,82 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
       clusterMax[minSeed] = clusterMax[minSeed] + bbox.max;
       clusterCount[minSeed] += 1;
 
-      // Add the triangle to its cluster
+      // Put the triangle in its cluster
 
-      clusterTriangles[minSeed].add( triangleIndices[i] );
+      clusterOf[i] = minSeed;
     }
 
     // Update the clusters with the mean bbox of the cluster
 
     for (int i=0; i<numSeeds; i++)
       if (clusterCount[i] > 0) {
-	    seedBoxes[i].min = (1/(float)clusterCount[i]) * clusterMin[i];
-	    seedBoxes[i].max = (1/(float)clusterCount[i]) * clusterMax[i];
+	seedBoxes[i].min = (1/(float)clusterCount[i]) * clusterMin[i];
+	seedBoxes[i].max = (1/(float)clusterCount[i]) * clusterMax[i];
       }
-
-    delete[] clusterMin;
-    delete[] clusterMax;
-    delete[] clusterCount;
   }
 
   // ---------------- END SOLUTION CODE ----------------
 
 #endif
 
+  // Reorder the indices so that each cluster is contiguous, keeping
+  // the original order within each cluster.  Cluster j is then
+  // triangleIndices[ clusterStart[j] .. clusterStart[j+1]-1 ].
+
+  int clusterStart[K+1];
+
+  for (int j=0; j<=numSeeds; j++)
+    clusterStart[j] = 0;
+
+  for (int i=0; i<numTriangles; i++)
+    clusterStart[ clusterOf[i]+1 ]++;
+
+  for (int j=0; j<numSeeds; j++)
+    clusterStart[j+1] += clusterStart[j];
+
+  int *sorted = scratchArena.alloc<int>( numTriangles );
+  int next[K];
+
+  for (int j=0; j<numSeeds; j++)
+    next[j] = clusterStart[j];
+
+  for (int i=0; i<numTriangles; i++)
+    sorted[ next[ clusterOf[i] ]++ ] = triangleIndices[i];
+
+  for (int i=0; i<numTriangles; i++)
+    triangleIndices[i] = sorted[i];
+
+  scratchArena.release( scratchMark );
+
   // Now build the node
 
-  BVH_node *n = new BVH_node();
+  BVH_node *n = nodeArena.alloc<BVH_node>();
   
   n->isLeaf = false;
 
   // (recursively build the subtrees)
 
-  n->children  = new seq<BVH_node*>();
+  n->count = 0;
+  for (int j=0; j<numSeeds; j++)
+    if (clusterStart[j+1] > clusterStart[j])
+      n->count++;
+
+  n->children = nodeArena.alloc<BVH_node*>( n->count );
 
-  for (int i=0; i<numSeeds; i++)
-    if (clusterTriangles[i].size() > 0)
-      n->children->add( buildSubtree( clusterTriangles[i], depth+1 ) );
+  int c = 0;
+  for (int j=0; j<numSeeds; j++)
+    if (clusterStart[j+1] > clusterStart[j])
+      n->children[c++] = buildSubtree( triangleIndices + clusterStart[j], clusterStart[j+1] - clusterStart[j], depth+1 );
 
   // (find the bbox around all the subtrees)
 
-  if (n->children->size() > 0) {
+  if (n->count > 0) {
 
-    n->bbox = (*n->children)[0]->bbox;
+    n->bbox = n->children[0]->bbox;
 
-    for (int i=1; i<n->children->size(); i++) {
+    for (int i=1; i<n->count; i++) {
 
-      BBox bbox = (*n->children)[i]->bbox;
+      BBox bbox = n->children[i]->bbox;
 
       n->bbox.min.x = MIN( n->bbox.min.x, bbox.min.x );
       n->bbox.min.y = MIN( n->bbox.min.y, bbox.min.y );
@@ -249,14 +289,106 @@ BVH_node * BVH::buildSubtree( seq<int> &triangleIndices, int depth )
 
   // Done
 
-  delete[] seedBoxes;
-  delete[] seedIndices;
-    
   return n;
 }
 
 
 
+// Set the parent pointers of the subtree at n, whichever builder made it
+
+void BVH::setParents( BVH_node *n, BVH_node *parent )
+
+{
+  n->parent = parent;
+
+  if (!n->isLeaf)
+    for (int i=0; i<n->count; i++)
+      setParents( n->children[i], n );
+}
+
+
+
+// ---------------- SAH cost and refitting ----------------
+
+
+// SAH cost of a subtree, not divided by the area of its root.  An
+// internal node costs its area times the number of child boxes that
+// are tested, and a leaf its area times the number of triangles.
+
+double BVH::subtreeCost( BVH_node *n )
+
+{
+  if (n->isLeaf)
+    return n->bbox.surfaceArea() * (double) n->count;
+
+  double cost = n->bbox.surfaceArea() * (double) n->count * BVH_BOX_COST;
+
+  for (int i=0; i<n->count; i++)
+    cost += subtreeCost( n->children[i] );
+
+  return cost;
+}
+
+
+// SAH cost of the tree, relative to tracing a ray that hits the root box
+
+double BVH::sahCost()
+
+{
+  float rootArea = root->bbox.surfaceArea();
+
+  return (rootArea > 0 ? subtreeCost( root ) / rootArea : 0);
+}
+
+
+// Recompute the box of an internal node from its children
+
+void BVH::refitNode( BVH_node *n )
+
+{
+  BBox box = BBox::empty();
+
+  for (int i=0; i<n->count; i++)
+    box.include( n->children[i]->bbox );
+
+  n->bbox = box;
+}
+
+
+// Cut the top of the tree into about 'numSubtrees' subtrees, to be
+// worked on in parallel, by repeatedly replacing the largest internal
+// subtree by its children.  The replaced nodes are added to 'above'
+// with parents before children.
+
+void BVH::splitTop( int numSubtrees, seq<BVH_node*> &subtrees, seq<BVH_node*> &above )
+
+{
+  subtrees.add( root );
+
+  while (subtrees.size() < numSubtrees) {
+
+    int   largest = -1;
+    float largestArea = -1;
+
+    for (int i=0; i<subtrees.size(); i++)
+      if (!subtrees[i]->isLeaf && subtrees[i]->bbox.surfaceArea() > largestArea) {
+	largest = i;
+	largestArea = subtrees[i]->bbox.surfaceArea();
+      }
+
+    if (largest < 0)
+      break;
+
+    BVH_node *n = subtrees[largest];
+    subtrees.remove( largest );
+    above.add( n );
+    for (int i=0; i<n->count; i++)
+      subtrees.add( n->children[i] );
+  }
+}
+
+
+
 // Distance between two bounding boxes (stored in nodes) from Meister
 // and Bittner "Parallel BVH Construction ..." paper.
 
@@ -273,9 +405,9 @@ float BVH::boxBoxDistance( BBox &b1, BBox &b2 )
 BBox BVH::triangleBBox( int triIndex )
 
 {
-  vec3 &v0 = (*vertices)[triangles[triIndex].v0];
-  vec3 &v1 = (*vertices)[triangles[triIndex].v1];
-  vec3 &v2 = (*vertices)[triangles[triIndex].v2];
+  vec3 &v0 = (*vertices)[ (*vindices)[3*triIndex]   ];
+  vec3 &v1 = (*vertices)[ (*vindices)[3*triIndex+1] ];
+  vec3 &v2 = (*vertices)[ (*vindices)[3*triIndex+2] ];
 
   vec3 min( MIN(v0.x,MIN(v1.x,v2.x)),
 	    MIN(v0.y,MIN(v1.y,v2.y)),
@@ -292,12 +424,12 @@ BBox BVH::triangleBBox( int triIndex )
 
 // Find the bounding box of a SET of triangles
 
-BBox BVH::trianglesBBox( seq<int> &triangleIndices )
+BBox BVH::trianglesBBox( int *triangleIndices, int numTriangles )
 
 {
   BBox bbox = triangleBBox( triangleIndices[0] );
 
-  for (int i=1; i<triangleIndices.size(); i++) {
+  for (int i=1; i<numTriangles; i++) {
 
     BBox triBox = triangleBBox( triangleIndices[i] );
 
@@ -316,24 +448,28 @@ BBox BVH::trianglesBBox( seq<int> &triangleIndices )
 
 // Intersect a ray with an axis-aligned bounding box (only the box).
 //
-// Box is [vmin,vmax].  Ray parameters are restricted to [tmin,tmax].
+// Box is [vmin,vmax].  Ray parameters are restricted to [ray.tmin,ray.tmax].
 // Return true iff ray intersects box (even if starting from the inside).
+//
+// This uses the ray's precomputed 1/dir and its signs, which choose
+// the near and far slab of each axis without a division or a swap.
 
-bool BVH::rayBoxInt( vec3 &rayStart, vec3 &rayDir, float tmin, float tmax, BBox &bbox )
+bool BVH::rayBoxInt( Ray &ray, BBox &bbox )
 
 {
+  STAT_INC( rayBoxTests );
+
   // ---------------- START SOLUTION CODE ----------------
 
-  for (int i=0; i<3; ++i) {
+  float tmin = ray.tmin;
+  float tmax = ray.tmax;
 
-    float invD = 1.0f / rayDir[i]; // handles division by zero correctly (i.e. IEEE Inf)
+  for (int i=0; i<3; ++i) {
 
-    float t0 = (bbox.min[i] - rayStart[i]) * invD;
-    float t1 = (bbox.max[i] - rayStart[i]) * invD;
+    float invD = ray.invDir[i];
 
-    if (invD < 0.0f) {
-      float temp = t1; t1 = t0; t0 = temp;
-    }
+    float t0 = ((ray.sign[i] ? bbox.max[i] : bbox.min[i]) - ray.origin[i]) * invD; // near slab
+    float t1 = ((ray.sign[i] ? bbox.min[i] : bbox.max[i]) - ray.origin[i]) * invD; // far slab
 
     tmin = (t0 > tmin) ? t0 : tmin; // farthest min distance
     tmax = (t1 < tmax) ? t1 : tmax; // closest max distance
@@ -359,8 +495,8 @@ void BVH::renderSubtreeGL( BVH_node *n, mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3
     return;
 
   if (!n->isLeaf)
-    for (int i=0; i<n->children->size(); i++)
-      renderSubtreeGL( (*n->children)[i], WCS_to_VCS, WCS_to_CCS, lightDir, levelsRemaining-1 );
+    for (int i=0; i<n->count; i++)
+      renderSubtreeGL( n->children[i], WCS_to_VCS, WCS_to_CCS, lightDir, levelsRemaining-1 );
 
   if (levelsRemaining == 0)
     n->bbox.renderGL( WCS_to_VCS, WCS_to_CCS, lightDir );
@@ -375,21 +511,23 @@ void BVH::renderSubtreeGL( BVH_node *n, mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3
 // triangle.
 
 
-bool BVH::rayIntBVH( BVH_node*n, vec3 rayStart, vec3 rayDir, int sourceTriangleIndex, float maxParam, vec3 & intPoint, vec3 & intNormal, vec3 & intTexCoords, float & intParam, Material * &intMaterial, int &intTriangleIndex )
+bool BVH::rayIntBVH( BVH_node*n, Ray &ray, int sourceTriangleIndex, vec3 & intPoint, vec3 & intNormal, vec3 & intTexCoords, float & intParam, int &intTriangleIndex )
 
 {
   bool hit = false;
 
+  STAT_INC( bvhNodesVisited );
+
   if (n->isLeaf) { // A leaf, so check all the triangles
 
-    for (int i=0; i<n->triangles->size(); i++) {
-      int triangleIndex = (*n->triangles)[i];
+    for (int i=0; i<n->count; i++) {
+      int triangleIndex = n->triangles[i];
       if (triangleIndex != sourceTriangleIndex) { // this isn't the triangle from which the ray started
 
 	float param, alpha, beta, gamma;
 	vec3 point, normal, texcoords;
 
-	if (triangleInt( rayStart, rayDir, triangleIndex, maxParam, param, point, normal, texcoords, alpha, beta, gamma )) { // returns param, point, alpha, beta, gamma
+	if (triangleInt( ray, triangleIndex, param, point, normal, texcoords, alpha, beta, gamma )) { // returns param, point, alpha, beta, gamma
 
 	  // found a new closest point
 
@@ -398,9 +536,8 @@ bool BVH::rayIntBVH( BVH_node*n, vec3 rayStart, vec3 rayDir, int sourceTriangleI
 	  intNormal = normal;
 	  intTexCoords = texcoords;
 	  intTriangleIndex = triangleIndex;
-	  intMaterial = materials[ triangles[ (*n->triangles)[i] ].materialID ]; 
 
-	  maxParam = param;
+	  ray.tmax = param;
 	  hit = true;
 	}
       }
@@ -411,14 +548,11 @@ bool BVH::rayIntBVH( BVH_node*n, vec3 rayStart, vec3 rayDir, int sourceTriangleI
 
   } else { // Not a leaf, so recurse into children
 
-    for (int i=0; i<n->children->size(); i++) {
-      BVH_node *thisNode = (*n->children)[i];
-      if (rayBoxInt( rayStart, rayDir, 0, maxParam, thisNode->bbox )) {
-	if (rayIntBVH( thisNode, rayStart, rayDir, sourceTriangleIndex, maxParam, intPoint, intNormal, intTexCoords, intParam, intMaterial, intTriangleIndex )) {
-	  maxParam = intParam;
-	  hit = true;
-	}
-      }
+    for (int i=0; i<n->count; i++) {
+      BVH_node *thisNode = n->children[i];
+      if (rayBoxInt( ray, thisNode->bbox ))
+	if (rayIntBVH( thisNode, ray, sourceTriangleIndex, intPoint, intNormal, intTexCoords, intParam, intTriangleIndex ))
+	  hit = true; // ray.tmax is now intParam
     }
   }
 
@@ -429,32 +563,34 @@ bool BVH::rayIntBVH( BVH_node*n, vec3 rayStart, vec3 rayDir, int sourceTriangleI
 
 // Adapted from triangle.cpp for use by BVH
 
-bool BVH::triangleInt( vec3 &rayStart, vec3 &rayDir, int triangleIndex, float maxParam, float &param, vec3 &point, vec3 &normal, vec3 &texCoord, float &alpha, float &beta, float &gamma )
+bool BVH::triangleInt( Ray &ray, int triangleIndex, float &param, vec3 &point, vec3 &normal, vec3 &texCoord, float &alpha, float &beta, float &gamma )
 
 {
-  BVH_triangle &tri = triangles[triangleIndex];
+  STAT_INC( triangleTests );
+
+  GLuint *vi = &(*vindices)[ 3*triangleIndex ];
 
-  vec3 &v0 = (*vertices)[ tri.v0 ];
-  vec3 &v1 = (*vertices)[ tri.v1 ];
-  vec3 &v2 = (*vertices)[ tri.v2 ];
+  vec3 &v0 = (*vertices)[ vi[0] ];
+  vec3 &v1 = (*vertices)[ vi[1] ];
+  vec3 &v2 = (*vertices)[ vi[2] ];
 
-  vec3 faceNormal = (*facetnorms)[ tri.faceID ];
+  vec3 faceNormal = (*facetnorms)[ triangleIndex ];
 
   // Compute ray/plane intersection
 
-  float dn = rayDir * faceNormal;
+  float dn = ray.dir * faceNormal;
 
   if (fabs(dn) < 0.0001) // 'fabs' allows intersection from behind the plane.
     return false; // ray is parallel to plane.
 
-  float t = (faceNormal*(v0-rayStart)) / dn;
-  if (t < 0)
-    return false; // plane is behind starting point
+  float t = (faceNormal*(v0-ray.origin)) / dn;
+  if (t < ray.tmin)
+    return false; // plane is behind starting point (or too close)
 
-  if (t >= maxParam)
-    return false; // a closer intersection (at 'maxParam') has already been detected in other code
+  if (t >= ray.tmax)
+    return false; // a closer intersection (at 'ray.tmax') has already been detected in other code
   
-  vec3 thisPoint = rayStart + t * rayDir;
+  vec3 thisPoint = ray.at( t );
 
   // Compute barycentric coords
 
@@ -469,6 +605,8 @@ bool BVH::triangleInt( vec3 &rayStart, vec3 &rayDir, int triangleIndex, float ma
 
   // Return intersection info
 
+  STAT_INC( triangleHits );
+
   param  = t;
   point  = thisPoint;
   alpha  = thisAlpha;
@@ -481,21 +619,354 @@ bool BVH::triangleInt( vec3 &rayStart, vec3 &rayDir, int triangleIndex, float ma
 
   else {
 
-    vec3 &n0 = (*normals)[ tri.n0 ]; // interpolate vertex normals
-    vec3 &n1 = (*normals)[ tri.n1 ];
-    vec3 &n2 = (*normals)[ tri.n2 ];
+    GLuint *ni = &(*nindices)[ 3*triangleIndex ];
+
+    vec3 &n0 = (*normals)[ ni[0] ]; // interpolate vertex normals
+    vec3 &n1 = (*normals)[ ni[1] ];
+    vec3 &n2 = (*normals)[ ni[2] ];
 
     normal = (gamma*n0 + alpha*n1 + beta*n2).normalize();
   }
 
   if (obj->hasVertexTexCoords) {
     
-    vec3 &t0 = (*texcoords)[ tri.t0 ]; // interpolate vertex texcoords
-    vec3 &t1 = (*texcoords)[ tri.t1 ];
-    vec3 &t2 = (*texcoords)[ tri.t2 ];
+    GLuint *ti = &(*tindices)[ 3*triangleIndex ];
+
+    vec3 &t0 = (*texcoords)[ ti[0] ]; // interpolate vertex texcoords
+    vec3 &t1 = (*texcoords)[ ti[1] ];
+    vec3 &t2 = (*texcoords)[ ti[2] ];
 
     texCoord = gamma*t0 + alpha*t1 + beta*t2;
   }
 
   return true;
 }
+
+
+// Texture units per world unit on a triangle, from its areas in
+// texture space and in world space, for filtered texture lookups
+
+float BVH::texCoordScale( int triangleIndex )
+
+{
+  GLuint *vi = &(*vindices)[ 3*triangleIndex ];
+  GLuint *ti = &(*tindices)[ 3*triangleIndex ];
+
+  vec3 &v0 = (*vertices)[ vi[0] ];
+  vec3 &t0 = (*texcoords)[ ti[0] ];
+
+  vec3 t1 = (*texcoords)[ ti[1] ] - t0;
+  vec3 t2 = (*texcoords)[ ti[2] ] - t0;
+
+  float worldArea = (((*vertices)[ vi[1] ] - v0) ^ ((*vertices)[ vi[2] ] - v0)).length();
+  float texArea   = fabs( t1.x * t2.y - t1.y * t2.x );
+
+  return (worldArea > 0 ? sqrt( texArea / worldArea ) : 0);
+}
+
+
+
+// ---------------- Compressed BVH ----------------
+
+
+// 2^e as a float, for -126 <= e <= 127
+
+static float pow2( int e )
+
+{
+  unsigned int bits = (unsigned int) (e + 127) << 23;
+  float f;
+  memcpy( &f, &bits, sizeof(f) );
+  return f;
+}
+
+
+// Replace the tree with compressed nodes.  The internal nodes are
+// numbered so that the internal children of each node are
+// consecutive.
+
+void BVH::compressTree()
+
+{
+  int numInternal = 0, numLeafTriangles = 0;
+
+  if (root->isLeaf) { // a root leaf becomes the only child of a compressed root
+    numInternal = 1;
+    numLeafTriangles = root->count;
+  } else
+    countNodes( root, numInternal, numLeafTriangles );
+
+  cnodes     = compressedArena.alloc<CBVH_node>( numInternal );
+  ctriangles = compressedArena.alloc<int>( numLeafTriangles );
+  rootBox    = root->bbox;
+
+  int nextNode = 1;
+  int nextTriangle = 0;
+
+  if (root->isLeaf) {
+    BVH_node *children[1] = { root };
+    BVH_node parent;
+    parent.bbox = root->bbox;
+    parent.isLeaf = false;
+    parent.count = 1;
+    parent.children = children;
+    compressNode( &parent, 0, nextNode, nextTriangle );
+  } else
+    compressNode( root, 0, nextNode, nextTriangle );
+
+  // The original tree is no longer needed
+
+  nodeArena.release();
+  root = NULL;
+}
+
+
+void BVH::countNodes( BVH_node *n, int &numInternal, int &numLeafTriangles )
+
+{
+  if (n->isLeaf)
+    numLeafTriangles += n->count;
+  else {
+    numInternal++;
+    for (int i=0; i<n->count; i++)
+      countNodes( n->children[i], numInternal, numLeafTriangles );
+  }
+}
+
+
+// Fill cnodes[nodeIndex] from internal node n, then its subtrees
+
+void BVH::compressNode( BVH_node *n, int nodeIndex, int &nextNode, int &nextTriangle )
+
+{
+  CBVH_node &c = cnodes[nodeIndex];
+
+  c.origin = n->bbox.min;
+  c.numChildren = n->count;
+
+  // Choose the smallest step on each axis for which 255 steps cover
+  // the box and every child's quantized bounds contain its true
+  // bounds.  (The decoded bounds are computed in floating point
+  // exactly as in rayBoxIntCBVH(), so the test is exact.)
+
+  for (int axis=0; axis<3; axis++) {
+
+    float extent = n->bbox.max[axis] - n->bbox.min[axis];
+
+    int e;
+    frexpf( extent / 255.0f, &e ); // extent/255 < 2^e
+    if (e < -126)
+      e = -126;
+
+    bool ok;
+    do {
+      float step = pow2( e );
+      ok = true;
+
+      for (int i=0; i<n->count && ok; i++) {
+
+	BBox &b = n->children[i]->bbox;
+
+	int lo = (int) floorf( (b.min[axis] - c.origin[axis]) / step );
+	int hi = (int) ceilf(  (b.max[axis] - c.origin[axis]) / step );
+
+	lo = MAX( 0, MIN( 255, lo ) );
+	hi = MAX( 0, MIN( 255, hi ) );
+
+	while (lo > 0 && c.origin[axis] + lo * step > b.min[axis])
+	  lo--;
+	while (hi < 255 && c.origin[axis] + hi * step < b.max[axis])
+	  hi++;
+
+	if (c.origin[axis] + lo * step > b.min[axis] || c.origin[axis] + hi * step < b.max[axis])
+	  ok = false;
+	else {
+	  c.qmin[axis][i] = lo;
+	  c.qmax[axis][i] = hi;
+	}
+      }
+
+      if (!ok)
+	e++;
+
+    } while (!ok && e <= 127);
+
+    if (!ok) {
+      cerr << "BVH::compressNode: cannot quantize a box of extent " << extent << endl;
+      exit(1);
+    }
+
+    c.exponent[axis] = e;
+
+    // Empty children get an empty box (qmin > qmax)
+
+    for (int i=n->count; i<CBVH_WIDTH; i++) {
+      c.qmin[axis][i] = 255;
+      c.qmax[axis][i] = 0;
+    }
+  }
+
+  // Number the children.  The internal children are assigned their
+  // (consecutive) node indices before any of them is filled, so that
+  // siblings stay together.
+
+  c.firstChildNode = nextNode;
+  c.firstTriangle  = nextTriangle;
+
+  for (int i=0; i<n->count; i++) {
+    BVH_node *child = n->children[i];
+    if (child->isLeaf) {
+      if (child->count >= CBVH_INTERNAL) {
+	cerr << "BVH::compressNode: a leaf has too many triangles (" << child->count << ")" << endl;
+	exit(1);
+      }
+      c.childInfo[i] = child->count;
+      for (int j=0; j<child->count; j++)
+	ctriangles[nextTriangle++] = child->triangles[j];
+    } else {
+      c.childInfo[i] = CBVH_INTERNAL;
+      nextNode++;
+    }
+  }
+
+  for (int i=n->count; i<CBVH_WIDTH; i++)
+    c.childInfo[i] = 0;
+
+  int childNode = c.firstChildNode;
+  for (int i=0; i<n->count; i++)
+    if (!n->children[i]->isLeaf)
+      compressNode( n->children[i], childNode++, nextNode, nextTriangle );
+}
+
+
+// The decoded box of child c of node n
+
+BBox BVH::childBox( CBVH_node &n, int c )
+
+{
+  BBox b;
+
+  for (int axis=0; axis<3; axis++) {
+    float step = pow2( n.exponent[axis] );
+    b.min[axis] = n.origin[axis] + n.qmin[axis][c] * step;
+    b.max[axis] = n.origin[axis] + n.qmax[axis][c] * step;
+  }
+
+  return b;
+}
+
+
+// Intersect a ray with the decoded boxes of all children of node n
+// at once.  Return a bit mask of the children that are hit, and set
+// tNear[i] to the entry parameter of child i.
+
+int BVH::rayBoxIntCBVH( Ray &ray, CBVH_node &n, float *tNear )
+
+{
+  STAT_ADD( rayBoxTests, n.numChildren );
+
+  floatx8 tmin( ray.tmin );
+  floatx8 tmax( ray.tmax );
+
+  for (int axis=0; axis<3; axis++) {
+
+    floatx8 step( pow2( n.exponent[axis] ) );
+    floatx8 origin( n.origin[axis] );
+
+    unsigned char *qNear = (ray.sign[axis] ? n.qmax[axis] : n.qmin[axis]);
+    unsigned char *qFar  = (ray.sign[axis] ? n.qmin[axis] : n.qmax[axis]);
+
+    // q * step is exact, so this rounds exactly as in compressNode()
+
+    floatx8 nearBound = origin + floatx8::loadBytes( qNear ) * step;
+    floatx8 farBound  = origin + floatx8::loadBytes( qFar )  * step;
+
+    floatx8 o( ray.origin[axis] );
+    floatx8 invD( ray.invDir[axis] );
+
+    tmin = vmax( (nearBound - o) * invD, tmin ); // a NaN slab leaves tmin as is
+    tmax = vmin( (farBound  - o) * invD, tmax );
+  }
+
+  tmin.store( tNear );
+
+  return (tmin < tmax).movemask() & ((1 << n.numChildren) - 1);
+}
+
+
+// As rayIntBVH(), but over the compressed nodes
+
+bool BVH::rayIntCBVH( int nodeIndex, Ray &ray, int sourceTriangleIndex, vec3 & intPoint, vec3 & intNormal, vec3 & intTexCoords, float & intParam, int &intTriangleIndex )
+
+{
+  STAT_INC( bvhNodesVisited );
+
+  CBVH_node &n = cnodes[nodeIndex];
+
+  float tNear[CBVH_WIDTH];
+  int hitMask = rayBoxIntCBVH( ray, n, tNear );
+
+  bool hit = false;
+
+  int childNode = n.firstChildNode;
+  int *tri = &ctriangles[ n.firstTriangle ];
+
+  for (int i=0; i<n.numChildren; i++) {
+
+    bool enter = (hitMask & (1 << i)) && tNear[i] < ray.tmax; // tmax might have shrunk since the box test
+
+    if (n.childInfo[i] == CBVH_INTERNAL) {
+
+      if (enter && rayIntCBVH( childNode, ray, sourceTriangleIndex, intPoint, intNormal, intTexCoords, intParam, intTriangleIndex ))
+	hit = true; // ray.tmax is now intParam
+      childNode++;
+
+    } else {
+
+      if (enter)
+	for (int j=0; j<n.childInfo[i]; j++) {
+	  int triangleIndex = tri[j];
+	  if (triangleIndex != sourceTriangleIndex) {
+
+	    float param, alpha, beta, gamma;
+	    vec3 point, normal, texcoords;
+
+	    if (triangleInt( ray, triangleIndex, param, point, normal, texcoords, alpha, beta, gamma )) {
+	      intParam  = param;
+	      intPoint  = point;
+	      intNormal = normal;
+	      intTexCoords = texcoords;
+	      intTriangleIndex = triangleIndex;
+	      ray.tmax = param;
+	      hit = true;
+	    }
+	  }
+	}
+      tri += n.childInfo[i];
+    }
+  }
+
+  return hit;
+}
+
+
+// Draw a certain number of levels of the compressed BVH, below node
+// 'nodeIndex'.  The boxes are the decoded (slightly larger) ones.
+
+void BVH::renderCompressedSubtreeGL( int nodeIndex, mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3 lightDir, int levelsRemaining )
+
+{
+  if (levelsRemaining < 0)
+    return;
+
+  CBVH_node &n = cnodes[nodeIndex];
+
+  int childNode = n.firstChildNode;
+
+  for (int i=0; i<n.numChildren; i++) {
+    if (levelsRemaining == 0)
+      childBox( n, i ).renderGL( WCS_to_VCS, WCS_to_CCS, lightDir );
+    if (n.childInfo[i] == CBVH_INTERNAL)
+      renderCompressedSubtreeGL( childNode++, WCS_to_VCS, WCS_to_CCS, lightDir, levelsRemaining-1 );
+  }
+}
@@ -12,32 +12,14 @@
 #include "bbox.h"
 #include "main.h"
 #include "wavefront.h"
+#include "rtStats.h"
+#include "arena.h"
+#include "ray.h"
 
 
-class BVH_triangle {
-
-public:
-  unsigned int v0, v1, v2;      // indices into vertices list
-  unsigned int t0, t1, t2;      // indices into texcoords list
-  unsigned int n0, n1, n2;      // indices into normal list
-  unsigned int materialID;      // index into material list
-  unsigned int faceID;          // index into facetnorms[]
-
- BVH_triangle() {}
-
- BVH_triangle( unsigned int _v0, unsigned int _v1, unsigned int _v2, 
-	       unsigned int _t0, unsigned int _t1, unsigned int _t2, 
-	       unsigned int _n0, unsigned int _n1, unsigned int _n2, 
-	       unsigned int _materialID, unsigned int _faceID )
-  {
-    v0 = _v0; v1 = _v1; v2 = _v2;
-    t0 = _t0; t1 = _t1; t2 = _t2;
-    n0 = _n0; n1 = _n1; n2 = _n2;
-    materialID = _materialID;
-    faceID = _faceID;
-  }
-};
-
+#define BVH_MAX_CHILDREN  8	// children per node
+#define BVH_MAX_LEAF_SIZE 2	// triangles per leaf (unless they cannot be separated)
+#define BVH_BOX_COST      0.5	// SAH cost of a ray/box test, relative to a ray/triangle test
 
 
 class BVH_node {
@@ -45,97 +27,280 @@ class BVH_node {
 public:
 
   BBox bbox;		           // node's bounding box
+  BVH_node *parent;                // NULL at the root
   bool isLeaf;                     // true iff this is a leaf in the BVH
+  int  count;                      // number of children (non-leaf) or triangles (leaf)
   union {
-    seq<BVH_node*> *children;	   // present only for non-leaves
-    seq<int>       *triangles;     // present only for leaves and contains INDICES of leaf triangles
+    BVH_node **children;	   // present only for non-leaves
+    int       *triangles;          // present only for leaves and contains INDICES of leaf triangles
   };
 };
 
 
 
+// A compressed node of up to CBVH_WIDTH children, in 80 bytes.
+//
+// Each child's box is quantized to 8 bits per bound, relative to the
+// node's box: on axis i, the child's bounds are
+//
+//    origin[i] + qmin[i][c] * 2^exponent[i]   and   origin[i] + qmax[i][c] * 2^exponent[i]
+//
+// which contain the child's true box (the bounds are rounded
+// outward).  The internal children of a node are consecutive nodes
+// starting at 'firstChildNode', and the triangles of its leaf
+// children are consecutive triangle indices starting at
+// 'firstTriangle', both in the order of the children.
+
+#define CBVH_WIDTH    8
+#define CBVH_INTERNAL 0xff	// childInfo[] of an internal child (otherwise it's the leaf's triangle count)
+
+class CBVH_node {
+
+public:
+
+  vec3          origin;                    // min corner of the node's box
+  signed char   exponent[3];               // quantization step on each axis is 2^exponent[i]
+  unsigned char numChildren;
+  unsigned char qmin[3][CBVH_WIDTH];       // quantized child bounds, by axis and child
+  unsigned char qmax[3][CBVH_WIDTH];
+  int           firstChildNode;            // index of the first internal child in BVH::cnodes
+  int           firstTriangle;             // index of the first leaf triangle in BVH::ctriangles
+  unsigned char childInfo[CBVH_WIDTH];     // CBVH_INTERNAL or the number of triangles of a leaf child
+};
+
+static_assert( sizeof(CBVH_node) == 80, "CBVH_node should be 80 bytes" );
+
+#if BVH_MAX_CHILDREN > CBVH_WIDTH
+  #error "A compressed BVH node cannot hold BVH_MAX_CHILDREN children"
+#endif
+
+
+
+// A reference to a triangle in the spatial-split builder, with the
+// box of the part of the triangle that is in the current node
+
+struct SBVH_ref {
+  BBox box;
+  int  triangle;
+};
+
+
+
 class BVH {
 
-  bool rayBoxInt( vec3 &rayStart, vec3 &rayDir, float tmin, float tmax, BBox &bbox );
+  int  rayBoxIntCBVH( Ray &ray, CBVH_node &n, float *tNear );
 
-  void freeTree( BVH_node *n ) {
-    if (!n->isLeaf)
-      for (int i=0; i<n->children->size(); i++)
-	freeTree( (*n->children)[i] );
-    delete n;
-  }
+  // The nodes, their child arrays, and the leaves' triangle indices
+  // are all stored in 'nodeArena', so the tree is freed in one go.
+  // Temporaries of the build are stored in 'scratchArena'.
 
-  BVH_node *buildSubtree( seq<int> &triangleIndices, int depth );
-  BVH_node *makeLeafNode( seq<int> &triangleIndices );
+  Arena nodeArena;
+  Arena scratchArena;
+
+  BVH_node *buildSubtree( int *triangleIndices, int numTriangles, int depth );
+  BVH_node *makeLeafNode( int *triangleIndices, int numTriangles );
+  void      setParents( BVH_node *n, BVH_node *parent );
+  void      splitTop( int numSubtrees, seq<BVH_node*> &subtrees, seq<BVH_node*> &above );
+
+  static double subtreeCost( BVH_node *n );
+  static void   refitNode( BVH_node *n );
 
   BBox triangleBBox( int triIndex );
-  BBox trianglesBBox( seq<int> &triangleIndices );
+  BBox trianglesBBox( int *triangleIndices, int numTriangles );
 
   float boxBoxDistance( BBox &b1, BBox &b2 );
 
+  // The compressed tree (if BVH::compress), stored in 'compressedArena'
+
+  Arena      compressedArena;
+  CBVH_node *cnodes;		// cnodes[0] is the root
+  int       *ctriangles;	// triangle indices of the leaves
+  BBox       rootBox;
+
+  void compressTree();
+  void countNodes( BVH_node *n, int &numInternal, int &numLeafTriangles );
+  void compressNode( BVH_node *n, int nodeIndex, int &nextNode, int &nextTriangle );
+
+  // The spatial-split builder (in sbvh.cpp)
+
+  int   sbvhBudget;		// extra triangle references that spatial splits may still make
+  float sbvhRootArea;		// surface area of the root box
+
+  void      buildSpatialTree();
+  BVH_node *buildSpatialSubtree( SBVH_ref *refs, int numRefs );
+  BVH_node *makeSpatialLeaf( SBVH_ref *refs, int numRefs );
+  BBox      clipTriangle( int triIndex, int axis, float lo, float hi );
+  void      widenSubtree( BVH_node *n );
+
+  // The optimization by reinsertion (in bvhOptimize.cpp)
+
+  void   optimize();
+  void   prepareForOptimization( BVH_node *n );
+  void   measureTraversal( int numRays, double &boxTests, double &triangleTests, double &nanoseconds );
+
+  // Refitting (in bvhRefit.cpp).  The subtrees and the costs are set
+  // up by the first refit() after a build.
+
+  seq<BVH_node*> refitSubtrees;	// subtrees that are refit in parallel
+  seq<BVH_node*> refitAbove;	// nodes above them, parents before children
+  seq<double>    refitBuiltCost; // SAH cost of each subtree (relative to its root box) when it was built
+  double         builtCost;	// SAH cost of the whole tree when it was built
+  size_t         builtBytes;	// nodeArena bytes after the last build
+
+  void   setUpRefit();
+  double refitSubtree( BVH_node *n );
+  void   rebuildSubtree( int i );
+  void   collectTriangles( BVH_node *n, seq<int> &triangles );
+
+  friend class KernelBench;
+  friend class Reinserter;
+
 public:
 
   wfModel   *obj;
   seq<vec3> *vertices;
   seq<vec3> *texcoords;
   seq<vec3> *normals;
-  seq<vec3> *facetnorms;
-  seq<Material*> materials;
-  seq<BVH_triangle> triangles;
+  seq<vec3> *facetnorms;       // facetnorms[t] is the normal of triangle t
+
+  // The triangles are the faces of 'obj', which stores them as
+  // 3 indices per triangle in each of these arrays
+
+  seq<GLuint> *vindices;        // into vertices
+  seq<GLuint> *tindices;        // into texcoords
+  seq<GLuint> *nindices;        // into normals
+
+  seq<Material*> materials;     // materials[g] is the material of group g of 'obj'
+
+  int numTriangles() {
+    return vindices->size() / 3;
+  }
 
   BVH_node *root;
 
+  double buildTime;		// seconds taken by buildTree()
+  double refitTime;		// seconds taken by the last refit(), including any rebuild
+  int    numRebuiltSubtrees;	// subtrees rebuilt by the last refit() (-1 if it rebuilt the whole tree)
+
+  static bool compress;		// after building, convert to compressed 8-wide nodes and free the original tree
+  static float splitBudget;	// if > 0, build with spatial splits, allowing this many extra references per triangle
+  static float optimizeTime;	// if > 0, spend up to this many seconds improving the tree by reinsertion after building it
+  static float rebuildThreshold; // refit() rebuilds where the SAH cost has grown by more than this fraction
+
   BVH() {
     root = NULL;
+    cnodes = NULL;
+    ctriangles = NULL;
+    buildTime = 0;
+    refitTime = 0;
+    numRebuiltSubtrees = 0;
+    builtBytes = 0;
   }
 
   ~BVH() {
-    if (root != NULL)
-      freeTree( root );
-    // Note that vertices, texcoords, and materials are stored
+    // The tree is freed with nodeArena.  Note that vertices, texcoords, and materials are stored
     // elsewhere and should not be deleted here.
   }
 
   void buildTree() {
-    // cout << "Building with " << vertices->size() << " vertices, " << texcoords->size() << " texcoords, " << materials.size() << " materials, " << triangles.size() << " triangles." << endl;
-    if (triangles.size() == 0)
+    double startTime = RTStats::now();
+    // cout << "Building with " << vertices->size() << " vertices, " << texcoords->size() << " texcoords, " << materials.size() << " materials, " << numTriangles() << " triangles." << endl;
+    nodeArena.release();
+    compressedArena.release();
+    cnodes = NULL;
+    refitSubtrees.clear();
+    refitAbove.clear();
+    refitBuiltCost.clear();
+    if (numTriangles() == 0)
       root = NULL;
     else {
-      // Create a sequence of all triangle indices
-      seq<int> triangleIndices( triangles.size() );
-      for (int i=0; i<triangles.size(); i++)
-	triangleIndices.add( i );
-      // Build the tree
-      root = buildSubtree( triangleIndices, 0 );
+      // Reserve about one node per triangle, and room for two index
+      // arrays in the scratch arena
+      int n = numTriangles();
+      nodeArena.reserve( n * (sizeof(int) + sizeof(BVH_node) + sizeof(BVH_node*)) );
+      scratchArena.reserve( 2 * n * sizeof(int) + 256 );
+      if (splitBudget > 0)
+	buildSpatialTree();
+      else {
+	// Create an array of all triangle indices
+	int *triangleIndices = nodeArena.alloc<int>( n );
+	for (int i=0; i<n; i++)
+	  triangleIndices[i] = i;
+	// Build the tree
+	root = buildSubtree( triangleIndices, n, 0 );
+      }
+      scratchArena.release();
+      setParents( root, NULL );
+      if (optimizeTime > 0)
+	optimize();
+      builtBytes = nodeArena.bytesUsed();
+      if (compress)
+	compressTree();
     }
+    buildTime = RTStats::now() - startTime;
   };
+
+  // Update the boxes after the vertices have moved (keeping the
+  // triangles), and rebuild where that makes the tree much worse
+
+  void refit();
   
-  bool rayInt( vec3 rayStart, vec3 rayDir, int sourceTriangleIndex, float maxParam, vec3 &intPoint, vec3 &intNormal, vec3 &intTexCoords, float &intParam, Material * &mat, int &intTriangleIndex ) {
-    if (root == NULL)
+  // Find the closest triangle hit with t in [ray.tmin,ray.tmax], other
+  // than 'sourceTriangleIndex'.  On a hit, ray.tmax is shrunk to its t.
+
+  bool rayInt( Ray &ray, int sourceTriangleIndex, vec3 &intPoint, vec3 &intNormal, vec3 &intTexCoords, float &intParam, Material * &mat, int &intTriangleIndex ) {
+    if (cnodes != NULL) {
+      if (!rayIntCBVH( 0, ray, sourceTriangleIndex, intPoint, intNormal, intTexCoords, intParam, intTriangleIndex ))
+	return false;
+    } else if (root == NULL || !rayIntBVH( root, ray, sourceTriangleIndex, intPoint, intNormal, intTexCoords, intParam, intTriangleIndex ))
       return false;
-    return rayIntBVH( root, rayStart, rayDir, sourceTriangleIndex, maxParam, intPoint, intNormal, intTexCoords, intParam, mat, intTriangleIndex );
+    mat = materials[ obj->groupOfFace( intTriangleIndex ) ]; // only for the closest triangle
+    return true;
   }
 
   void renderGL( mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3 lightDir ) {
-    if (root != NULL)
+    if (cnodes != NULL) {
+      if (scene->bvhDisplayDepth == 0)
+	rootBox.renderGL( WCS_to_VCS, WCS_to_CCS, lightDir );
+      else
+	renderCompressedSubtreeGL( 0, WCS_to_VCS, WCS_to_CCS, lightDir, scene->bvhDisplayDepth-1 );
+    } else if (root != NULL)
       renderSubtreeGL( root, WCS_to_VCS, WCS_to_CCS, lightDir, scene->bvhDisplayDepth );
   }
 
   // Determine the texture colour at a point
 
-  vec3 textureColour( vec3 &p, int triangleIndex, float &alpha, vec3 &texCoords ) {
+  vec3 textureColour( vec3 &p, int triangleIndex, float &alpha, vec3 &texCoords, float footprint ) {
     if (!obj->hasVertexTexCoords) { // no texture coordinates
       alpha = 1;
       return vec3(1,1,1);
-    } else
-      return materials[ triangles[triangleIndex].materialID ]->texture->texel( texCoords.x, texCoords.y, alpha );
+    } else {
+      float texFootprint = (footprint > 0 ? footprint * texCoordScale( triangleIndex ) : 0);
+      return materials[ obj->groupOfFace( triangleIndex ) ]->texture->texel( texCoords.x, texCoords.y, texFootprint, alpha );
+    }
   }
 
-  bool rayIntBVH( BVH_node *n, vec3 rayStart, vec3 rayDir, int sourceTriangleIndex, float maxParam, vec3 & intPoint, vec3 & intNormal, vec3 &intTexCoords, float & intParam, Material * &mat, int &intTriangleIndex );
+  float texCoordScale( int triangleIndex ); // texture units per world unit on the triangle
+
+  bool rayBoxInt( Ray &ray, BBox &bbox );
+
+  bool rayIntBVH( BVH_node *n, Ray &ray, int sourceTriangleIndex, vec3 & intPoint, vec3 & intNormal, vec3 &intTexCoords, float & intParam, int &intTriangleIndex );
 
   void renderSubtreeGL( BVH_node *root, mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3 lightDir, int levelsRemaining );
 
-  bool triangleInt( vec3 &rayStart, vec3 &rayDir, int triangleIndex, float maxParam, float &param, vec3 &point, vec3 &normal, vec3 &texcoords, float &alpha, float &beta, float &gamma );
+  bool rayIntCBVH( int nodeIndex, Ray &ray, int sourceTriangleIndex, vec3 & intPoint, vec3 & intNormal, vec3 &intTexCoords, float & intParam, int &intTriangleIndex );
+
+  void renderCompressedSubtreeGL( int nodeIndex, mat4 &WCS_to_VCS, mat4 &WCS_to_CCS, vec3 lightDir, int levelsRemaining );
+
+  BBox childBox( CBVH_node &n, int c );
+
+  double sahCost();		// SAH cost of the (uncompressed) tree, relative to a ray that hits the root box
+
+  size_t memoryBytes() {	// bytes of the tree (original or compressed) and its triangle indices
+    return (cnodes != NULL ? compressedArena.bytesUsed() : nodeArena.bytesUsed());
+  }
+
+  bool triangleInt( Ray &ray, int triangleIndex, float &param, vec3 &point, vec3 &normal, vec3 &texcoords, float &alpha, float &beta, float &gamma );
 
 };
 
@@ -0,0 +1,502 @@
+// bvhOptimize.cpp
+//
+// Improve a built BVH by reinsertion, after Bittner, Hapala, and
+// Havran, "Fast Insertion-Based Optimization of Bounding Volume
+// Hierarchies", Computer Graphics Forum 2013, and Meister and
+// Bittner, "Parallel Reinsertion for Bounding Volume Hierarchy
+// Optimization", Eurographics 2018.
+//
+// This is done after building if BVH::optimizeTime > 0.
+//
+// A node is removed from the tree and put back where it reduces the
+// SAH cost of the tree the most, which might be where it was.  The
+// best place is found with a branch-and-bound search from the top,
+// as the cost that an insertion adds to the ancestors of a place
+// only grows going down.  A node can go
+//
+//   - into an internal node with fewer than BVH_MAX_CHILDREN
+//     children, as a new child, or
+//
+//   - next to any node x, in a new internal node that replaces x and
+//     has x and the reinserted node as children.
+//
+// An internal node that is left with one child is removed, and is
+// used for the next new internal node.
+//
+// To run in parallel, the top of the tree is cut into subtrees that
+// are optimized independently on the threads of ThreadPool::shared().
+// Nodes only move within their subtree.  Each subtree gets passes
+// over its nodes, largest first, until a pass gains little or the
+// time is up.
+//
+// The SAH cost and the work of tracing some test rays are printed
+// before and after.
+
+
+#include "bvh.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <queue>
+#include <random>
+
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define OPT_TASKS_PER_THREAD  4   // subtrees to optimize per thread
+#define OPT_MIN_PASS_GAIN  1e-3   // stop the passes over a subtree when one gains less than this fraction of its cost
+#define OPT_MIN_MOVE_GAIN  1e-6   // only move a node if it gains more than this fraction of the subtree's cost
+#define OPT_TEST_RAYS     10000   // rays traced to measure the traversal before and after
+
+
+float BVH::optimizeTime = 0;
+
+
+
+// ---- tree edits ----
+//
+// The child arrays of internal nodes all have room for
+// BVH_MAX_CHILDREN children (see prepareForOptimization()).
+
+
+static void addChild( BVH_node *n, BVH_node *child )
+
+{
+  n->children[ n->count++ ] = child;
+  child->parent = n;
+}
+
+
+static void removeChild( BVH_node *n, BVH_node *child )
+
+{
+  for (int i=0; i<n->count; i++)
+    if (n->children[i] == child) {
+      n->children[i] = n->children[ --n->count ];
+      return;
+    }
+}
+
+
+static void replaceChild( BVH_node *n, BVH_node *oldChild, BVH_node *newChild )
+
+{
+  for (int i=0; i<n->count; i++)
+    if (n->children[i] == oldChild) {
+      n->children[i] = newChild;
+      newChild->parent = n;
+      return;
+    }
+}
+
+
+static void countSubtree( BVH_node *n, int &numInternal, int &numLeaves )
+
+{
+  if (n->isLeaf)
+    numLeaves++;
+  else {
+    numInternal++;
+    for (int i=0; i<n->count; i++)
+      countSubtree( n->children[i], numInternal, numLeaves );
+  }
+}
+
+
+
+// ---- reinsertion within one subtree ----
+
+
+class Reinserter {
+
+  struct Candidate {		// a place to search, with the cost added to its ancestors
+    BVH_node *node;
+    double    inducedCost;
+    Candidate( BVH_node *n, double c ) { node = n; inducedCost = c; }
+    bool operator < ( const Candidate &c ) const { return inducedCost > c.inducedCost; } // lowest cost first
+  };
+
+  double pathCost( BVH_node *n );
+  void   refitPath( BVH_node *n );
+  void   collectNodes( BVH_node *n, seq<BVH_node*> &nodes );
+  bool   reinsert( BVH_node *n );
+
+ public:
+
+  BVH_node      *top;		// root of the subtree
+  seq<BVH_node*> spares;	// unused internal nodes, for new internal nodes
+  double         deadline;	// in RTStats::now() time
+  int            numMoves;
+  double         minMoveGain;	// a move must gain more than this
+
+  Reinserter( BVH_node *t, double d ) {
+    top = t;
+    deadline = d;
+    numMoves = 0;
+    minMoveGain = 0;
+  }
+
+  void run();
+};
+
+
+// Box-test cost of n and its ancestors up to the top
+
+double Reinserter::pathCost( BVH_node *n )
+
+{
+  double cost = 0;
+
+  while (true) {
+    cost += n->bbox.surfaceArea() * (double) n->count * BVH_BOX_COST;
+    if (n == top)
+      return cost;
+    n = n->parent;
+  }
+}
+
+
+void Reinserter::refitPath( BVH_node *n )
+
+{
+  while (true) {
+    BVH::refitNode( n );
+    if (n == top)
+      return;
+    n = n->parent;
+  }
+}
+
+
+void Reinserter::collectNodes( BVH_node *n, seq<BVH_node*> &nodes )
+
+{
+  if (n != top)
+    nodes.add( n );
+
+  if (!n->isLeaf)
+    for (int i=0; i<n->count; i++)
+      collectNodes( n->children[i], nodes );
+}
+
+
+// Remove n and put it back in the best place.  Return true if it
+// moved.
+
+bool Reinserter::reinsert( BVH_node *n )
+
+{
+  BVH_node *p = n->parent;
+
+  if (p == top && p->count <= 2) // the top keeps at least two children
+    return false;
+
+  // Remove n, and p too if it is left with one child
+
+  double costBefore = pathCost( p );
+
+  removeChild( p, n );
+
+  BVH_node *removed = NULL;
+  BVH_node *g = p->parent;
+  double costAfter;
+
+  if (p->count == 1 && p != top) {
+    replaceChild( g, p, p->children[0] );
+    removed = p;
+    refitPath( g );
+    costAfter = pathCost( g );
+  } else {
+    refitPath( p );
+    costAfter = pathCost( p );
+  }
+
+  // Find the cheapest place to insert n, if it is cheaper than the
+  // removal gained.  The cost of a place is the growth of the boxes
+  // of its ancestors (the "induced" cost) plus its own cost.  As
+  // either kind of insertion costs at least the area of n, a search
+  // can stop once the induced cost reaches the best cost less that.
+
+  double minCost = n->bbox.surfaceArea() * BVH_BOX_COST;
+  double bestCost = (costBefore - costAfter) - minMoveGain;
+  BVH_node *best = NULL;
+  bool bestIsChild = false;
+
+  bool canMakeNode = (removed != NULL || spares.size() > 0);
+
+  priority_queue<Candidate> queue;
+  queue.push( Candidate( top, 0 ) );
+
+  while (!queue.empty()) {
+
+    Candidate c = queue.top();
+    queue.pop();
+
+    if (c.inducedCost + minCost >= bestCost)
+      break;
+
+    BVH_node *x = c.node;
+    BBox both = x->bbox;
+    both.include( n->bbox );
+    double bothArea = both.surfaceArea();
+    double xArea = x->bbox.surfaceArea();
+
+    if (x != top && canMakeNode) { // as the sibling of x
+      double cost = c.inducedCost + 2 * bothArea * BVH_BOX_COST;
+      if (cost < bestCost) {
+	bestCost = cost;
+	best = x;
+	bestIsChild = false;
+      }
+    }
+
+    if (!x->isLeaf) {
+
+      if (x->count < BVH_MAX_CHILDREN) { // as a child of x
+	double cost = c.inducedCost + (bothArea * (x->count + 1) - xArea * x->count) * BVH_BOX_COST;
+	if (cost < bestCost) {
+	  bestCost = cost;
+	  best = x;
+	  bestIsChild = true;
+	}
+      }
+
+      double childInducedCost = c.inducedCost + (bothArea - xArea) * x->count * BVH_BOX_COST;
+
+      if (childInducedCost + minCost < bestCost)
+	for (int i=0; i<x->count; i++)
+	  queue.push( Candidate( x->children[i], childInducedCost ) );
+    }
+  }
+
+  // No better place, so put n back
+
+  if (best == NULL) {
+    if (removed != NULL) {
+      replaceChild( g, p->children[0], p );
+      p->children[0]->parent = p;
+    }
+    addChild( p, n );
+    refitPath( p );
+    return false;
+  }
+
+  // Insert n
+
+  if (bestIsChild) {
+    addChild( best, n );
+    refitPath( best );
+  } else {
+    BVH_node *m;
+    if (removed != NULL) {
+      m = removed;
+      removed = NULL;
+    } else {
+      m = spares[ spares.size()-1 ];
+      spares.remove();
+    }
+    replaceChild( best->parent, best, m );
+    m->isLeaf = false;
+    m->count = 0;
+    addChild( m, best );
+    addChild( m, n );
+    refitPath( m );
+  }
+
+  if (removed != NULL) {
+    removed->parent = NULL;	// marks it as out of the tree
+    removed->count = 0;
+    spares.add( removed );
+  }
+
+  return true;
+}
+
+
+void Reinserter::run()
+
+{
+  double cost = BVH::subtreeCost( top );
+
+  while (RTStats::now() < deadline) {
+
+    minMoveGain = OPT_MIN_MOVE_GAIN * cost;
+
+    seq<BVH_node*> nodes;
+    collectNodes( top, nodes );
+
+    std::sort( nodes.begin(), nodes.end(), []( BVH_node *a, BVH_node *b ) { return a->bbox.surfaceArea() > b->bbox.surfaceArea(); } );
+
+    for (BVH_node *n : nodes) {
+      if (RTStats::now() >= deadline)
+	break;
+      if (n->parent != NULL && reinsert( n ))
+	numMoves++;
+    }
+
+    double newCost = BVH::subtreeCost( top );
+    if (newCost > cost * (1 - OPT_MIN_PASS_GAIN))
+      break;
+    cost = newCost;
+  }
+}
+
+
+
+// ---- the whole tree ----
+
+
+// Remove internal nodes with one child and give every child array
+// room for BVH_MAX_CHILDREN children.  (The old arrays stay in the
+// node arena until the tree is freed.)
+
+void BVH::prepareForOptimization( BVH_node *n )
+
+{
+  if (n->isLeaf)
+    return;
+
+  for (int i=0; i<n->count; i++) {
+    BVH_node *c = n->children[i];
+    while (!c->isLeaf && c->count == 1)
+      c = c->children[0];
+    n->children[i] = c;
+    c->parent = n;
+    prepareForOptimization( c );
+  }
+
+  if (n->count < BVH_MAX_CHILDREN) {
+    BVH_node **children = nodeArena.alloc<BVH_node*>( BVH_MAX_CHILDREN );
+    for (int i=0; i<n->count; i++)
+      children[i] = n->children[i];
+    n->children = children;
+  }
+}
+
+
+// Trace test rays through the tree, from random points around it to
+// random points in it, and return the average box tests, triangle
+// tests, and time per ray.  The test rays are not counted in the
+// statistics of the render.
+
+void BVH::measureTraversal( int numRays, double &boxTests, double &triangleTests, double &nanoseconds )
+
+{
+  RTStats savedStats = threadStats;
+  threadStats.clear();
+
+  minstd_rand rng( 1 );		// local, so as not to change the sequence of rand()
+  uniform_real_distribution<float> uniform( 0, 1 );
+
+  vec3  centre = 0.5 * (root->bbox.min + root->bbox.max);
+  vec3  size   = root->bbox.max - root->bbox.min;
+  float radius = size.length();
+
+  double startTime = RTStats::now();
+
+  for (int i=0; i<numRays; i++) {
+
+    vec3 dir;
+    do
+      dir = vec3( 2*uniform(rng)-1, 2*uniform(rng)-1, 2*uniform(rng)-1 );
+    while (dir.squaredLength() > 1 || dir.squaredLength() < 1e-4);
+
+    vec3 origin = centre + radius * dir.normalize();
+    vec3 target = root->bbox.min + vec3( uniform(rng) * size.x, uniform(rng) * size.y, uniform(rng) * size.z );
+
+    Ray ray( origin, (target - origin).normalize(), PRIMARY_RAY );
+
+    vec3 point, normal, texCoords;
+    float param;
+    int triangleIndex;
+
+    rayIntBVH( root, ray, -1, point, normal, texCoords, param, triangleIndex );
+  }
+
+  nanoseconds   = (RTStats::now() - startTime) * 1e9 / numRays;
+  boxTests      = threadStats.rayBoxTests / (double) numRays;
+  triangleTests = threadStats.triangleTests / (double) numRays;
+
+  threadStats = savedStats;
+}
+
+
+void BVH::optimize()
+
+{
+  if (root->isLeaf)
+    return;
+
+  double startTime = RTStats::now();
+
+  double costBefore = sahCost();
+  double boxTestsBefore, triangleTestsBefore, nsBefore;
+  measureTraversal( OPT_TEST_RAYS, boxTestsBefore, triangleTestsBefore, nsBefore );
+
+  // Serially, get the tree ready for editing
+
+  prepareForOptimization( root );
+
+  ThreadPool &pool = ThreadPool::shared();
+
+  seq<BVH_node*> subtrees, above;
+  splitTop( OPT_TASKS_PER_THREAD * pool.size(), subtrees, above );
+
+  // Give each subtree some spare internal nodes, as they cannot be
+  // allocated in parallel.  A subtree with n leaves could use up to
+  // n-1 internal nodes, but reinsertion adds far fewer than that.
+
+  double deadline = startTime + optimizeTime;
+
+  seq<Reinserter*> reinserters;
+
+  for (BVH_node *s : subtrees)
+    if (!s->isLeaf) {
+      Reinserter *r = new Reinserter( s, deadline );
+      int numInternal = 0, numLeaves = 0;
+      countSubtree( s, numInternal, numLeaves );
+      int numSpares = MIN( numLeaves - 1 - numInternal, numInternal / 2 + 8 );
+      for (int i=0; i<numSpares; i++) {
+	BVH_node *n = nodeArena.alloc<BVH_node>();
+	n->children = nodeArena.alloc<BVH_node*>( BVH_MAX_CHILDREN );
+	r->spares.add( n );
+      }
+      reinserters.add( r );
+    }
+
+  // Optimize the subtrees in parallel
+
+  seq< future<void> > done;
+  for (Reinserter *r : reinserters)
+    done.add( pool.submit( [r] { r->run(); } ) );
+  for (future<void> &d : done)
+    d.get();
+
+  // The boxes above the subtrees can shrink
+
+  for (int i=above.size()-1; i>=0; i--)
+    refitNode( above[i] );
+
+  int numMoves = 0;
+  int numSubtrees = reinserters.size();
+  for (Reinserter *r : reinserters) {
+    numMoves += r->numMoves;
+    delete r;
+  }
+
+  double optimizeSeconds = RTStats::now() - startTime;
+
+  double costAfter = sahCost();
+  double boxTestsAfter, triangleTestsAfter, nsAfter;
+  measureTraversal( OPT_TEST_RAYS, boxTestsAfter, triangleTestsAfter, nsAfter );
+
+  cerr << "BVH optimization: " << numMoves << " reinsertions in " << optimizeSeconds << " s on "
+       << pool.size() << " threads (" << numSubtrees << " subtrees)" << endl
+       << "  SAH cost        " << costBefore << " -> " << costAfter
+       << " (" << 100 * (costAfter - costBefore) / costBefore << "%)" << endl
+#if RT_STATS
+       << "  box tests/ray   " << boxTestsBefore << " -> " << boxTestsAfter << endl
+       << "  tri tests/ray   " << triangleTestsBefore << " -> " << triangleTestsAfter << endl
+#endif
+       << "  ns/ray          " << nsBefore << " -> " << nsAfter << endl;
+}
@@ -0,0 +1,190 @@
+// bvhRefit.cpp
+//
+// Refitting the BVH after its vertices have moved, as in a
+// vertex-animated model, instead of rebuilding it.
+//
+// refit() recomputes every box bottom-up from the triangles in O(n)
+// time.  The top of the tree is cut into subtrees (with
+// BVH::splitTop()) that are refit in parallel on the threads of
+// ThreadPool::shared(), and then the few nodes above them are refit.
+//
+// The tree keeps the structure that was built for the old vertex
+// positions, so its boxes get worse as the triangles move apart.  To
+// catch this, the SAH cost of each subtree (relative to the area of
+// its root box, so that moving or scaling the whole subtree doesn't
+// change it) is compared with its cost when it was built:
+//
+//   - A subtree whose cost has grown by more than
+//     BVH::rebuildThreshold is rebuilt with the k-means builder.
+//
+//   - The whole tree is rebuilt (with buildTree()) if its cost has
+//     grown by more than that, or if the rebuilt subtrees have
+//     doubled the memory of the tree, as their old nodes are not freed
+//     until the next full build.
+//
+// A compressed tree (BVH::compress) cannot be refit, as its original
+// nodes are gone, so it is always rebuilt.
+
+
+#include "bvh.h"
+#include "threadPool.h"
+
+#include <algorithm>
+
+
+#define REFIT_TASKS_PER_THREAD 4   // subtrees to refit per thread
+
+
+float BVH::rebuildThreshold = 0.3;
+
+
+
+void BVH::refit()
+
+{
+  double startTime = RTStats::now();
+
+  numRebuiltSubtrees = 0;
+
+  if (cnodes != NULL) {
+    buildTree();
+    numRebuiltSubtrees = -1;
+    refitTime = RTStats::now() - startTime;
+    return;
+  }
+
+  if (root == NULL)
+    return;
+
+  if (refitSubtrees.size() == 0)
+    setUpRefit();
+
+  // Refit the subtrees in parallel
+
+  ThreadPool &pool = ThreadPool::shared();
+
+  seq< future<double> > costs;
+  for (BVH_node *s : refitSubtrees)
+    costs.add( pool.submit( [this,s] { return refitSubtree( s ); } ) );
+
+  // Rebuild the subtrees that got much worse
+
+  for (int i=0; i<refitSubtrees.size(); i++) {
+    double cost = costs[i].get();
+    float  area = refitSubtrees[i]->bbox.surfaceArea();
+    if (area > 0 && cost / area > refitBuiltCost[i] * (1 + rebuildThreshold)) {
+      rebuildSubtree( i );
+      numRebuiltSubtrees++;
+    }
+  }
+
+  // Refit the nodes above the subtrees
+
+  for (int i=refitAbove.size()-1; i>=0; i--)
+    refitNode( refitAbove[i] );
+
+  // Rebuild everything if the top got much worse or there's too much
+  // garbage from rebuilt subtrees
+
+  if (sahCost() > builtCost * (1 + rebuildThreshold) || nodeArena.bytesUsed() > 2 * builtBytes) {
+    buildTree();
+    numRebuiltSubtrees = -1;
+  }
+
+  refitTime = RTStats::now() - startTime;
+}
+
+
+// Choose the subtrees to refit in parallel and record the current
+// SAH costs, which are those of the tree as it was built
+
+void BVH::setUpRefit()
+
+{
+  splitTop( REFIT_TASKS_PER_THREAD * ThreadPool::shared().size(), refitSubtrees, refitAbove );
+
+  for (BVH_node *s : refitSubtrees) {
+    float area = s->bbox.surfaceArea();
+    refitBuiltCost.add( area > 0 ? subtreeCost( s ) / area : 0 );
+  }
+
+  builtCost = sahCost();
+}
+
+
+// Refit the subtree at n and return its SAH cost (not divided by its
+// area)
+
+double BVH::refitSubtree( BVH_node *n )
+
+{
+  if (n->isLeaf) {
+    n->bbox = trianglesBBox( n->triangles, n->count );
+    return n->bbox.surfaceArea() * (double) n->count;
+  }
+
+  double cost = 0;
+
+  for (int i=0; i<n->count; i++)
+    cost += refitSubtree( n->children[i] );
+
+  refitNode( n );
+
+  return cost + n->bbox.surfaceArea() * (double) n->count * BVH_BOX_COST;
+}
+
+
+// Rebuild refitSubtrees[i] from its triangles.  Its old nodes stay in
+// the node arena until the next full build.
+
+void BVH::rebuildSubtree( int i )
+
+{
+  BVH_node *s = refitSubtrees[i];
+  BVH_node *parent = s->parent;
+
+  // Collect its triangles, each once (a triangle can be in several
+  // leaves of a tree built with spatial splits)
+
+  seq<int> triangles;
+  collectTriangles( s, triangles );
+
+  std::sort( triangles.begin(), triangles.end() );
+  int n = std::unique( triangles.begin(), triangles.end() ) - triangles.begin();
+
+  int *triangleIndices = nodeArena.alloc<int>( n );
+  for (int j=0; j<n; j++)
+    triangleIndices[j] = triangles[j];
+
+  scratchArena.reserve( 2 * n * sizeof(int) + 256 );
+  BVH_node *t = buildSubtree( triangleIndices, n, 0 );
+  scratchArena.release();
+
+  // Put it in place of the old subtree
+
+  if (parent == NULL)
+    root = t;
+  else
+    for (int j=0; j<parent->count; j++)
+      if (parent->children[j] == s)
+	parent->children[j] = t;
+
+  setParents( t, parent );
+
+  refitSubtrees[i] = t;
+
+  float area = t->bbox.surfaceArea();
+  refitBuiltCost[i] = (area > 0 ? subtreeCost( t ) / area : 0);
+}
+
+
+void BVH::collectTriangles( BVH_node *n, seq<int> &triangles )
+
+{
+  if (n->isLeaf)
+    for (int i=0; i<n->count; i++)
+      triangles.add( n->triangles[i] );
+  else
+    for (int i=0; i<n->count; i++)
+      collectTriangles( n->children[i], triangles );
+}
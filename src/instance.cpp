@@ -0,0 +1,169 @@
+/* instance.cpp
+ */
+
+
+#include "headers.h"
+
+#include "instance.h"
+#include "main.h"
+
+
+Material Instance::modelMaterials;	// named "-" by the Instance constructor, as in the scene file
+
+
+// Set the object-to-world transform
+
+void Instance::setTransform( mat4 T )
+
+{
+  objToWorld = T;
+  worldToObj = T.inverse();
+
+  for (int i=0; i<3; i++)
+    for (int j=0; j<3; j++)
+      normalToWorld[i][j] = worldToObj[j][i];
+
+  // Lengths scale by the cube root of the determinant (on average,
+  // for a non-uniform scaling)
+
+  vec3 r0( worldToObj[0][0], worldToObj[0][1], worldToObj[0][2] );
+  vec3 r1( worldToObj[1][0], worldToObj[1][1], worldToObj[1][2] );
+  vec3 r2( worldToObj[2][0], worldToObj[2][1], worldToObj[2][2] );
+
+  objPerWorld = cbrt( fabs( r0 * (r1 ^ r2) ) );
+
+  // Box around the transformed corners of the model's box
+
+  vec3 &min = model->obj->min;
+  vec3 &max = model->obj->max;
+
+  worldBox = BBox::empty();
+
+  for (int i=0; i<8; i++) {
+    vec3 corner( (i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z );
+    worldBox.include( (objToWorld * vec4( corner, 1 )).toVec3() );
+  }
+}
+
+
+// Intersect the model with the ray in the model's space.  That ray
+// gets a unit direction, so that the model's triangle tests behave
+// as for a model that is not instanced, and its parameter t is
+// 'scale' times that of the world-space ray.
+
+bool Instance::rayInt( Ray &ray, vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material *&intMat, int &intPartIndex )
+
+{
+  if (!model->bvh.rayBoxInt( ray, worldBox ))
+    return false;
+
+  vec3  dir   = (worldToObj * vec4( ray.dir, 0 )).toVec3();
+  float scale = dir.length();
+
+  Ray objRay( (worldToObj * vec4( ray.origin, 1 )).toVec3(), (1/scale) * dir, ray.kind,
+	      (ray.originObj == this ? model : NULL), ray.originPart );
+
+  objRay.tmin = ray.tmin * scale;
+  objRay.tmax = ray.tmax * scale;
+
+  vec3  point, normal;
+  float t;
+
+  if (!model->rayInt( objRay, point, normal, intTexCoords, t, intMat, intPartIndex ))
+    return false;
+
+  intParam = t / scale;
+  intPoint = ray.at( intParam );
+  intNorm  = (normalToWorld * normal).normalize();
+
+  if (mat != &modelMaterials)
+    intMat = mat;
+
+  ray.tmax = intParam;
+
+  return true;
+}
+
+
+vec3 Instance::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint )
+
+{
+  if (mat == &modelMaterials)
+    return model->textureColour( p, objPartIndex, alpha, texCoords, footprint * objPerWorld );
+
+  if (mat->texture == NULL) {
+    alpha = 1;
+    return vec3(1,1,1);
+  }
+
+  float texFootprint = 0;
+  if (footprint > 0 && model->obj->hasVertexTexCoords)
+    texFootprint = footprint * objPerWorld * model->bvh.texCoordScale( objPartIndex );
+
+  return mat->texture->texel( texCoords.x, texCoords.y, texFootprint, alpha );
+}
+
+
+// Render with openGL (with the model's materials)
+
+void Instance::renderGL( GPUProgram *gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS )
+
+{
+  mat4 MV = WCS_to_VCS * objToWorld;
+
+  model->renderGL( gpuProg, MV, VCS_to_CCS );
+}
+
+
+// Input the transform (as four rows) and the material name, which is
+// "-" to use the model's materials.  The model is read by the scene.
+
+void Instance::input( istream &stream )
+
+{
+  mat4 T;
+
+  for (int i=0; i<4; i++) {
+    skipComments( stream );
+    stream >> T[i];
+  }
+
+  setTransform( T );
+
+  char matName[1000];
+
+  skipComments( stream );
+  stream >> matName;
+
+  if (strcmp( matName, "-" ) == 0) {
+    mat = &modelMaterials;
+    return;
+  }
+
+  int i;
+  for (i=0; i<scene->materials.size(); i++)
+    if (strcmp( scene->materials[i]->name, matName ) == 0)
+      break;
+
+  if (i == scene->materials.size()) {
+    cerr << "line " << lineNum << ": Material " << matName << " not found" << endl;
+    abort();
+  }
+
+  mat = scene->materials[i];
+}
+
+
+// Output the model's filename and the transform.  The material name
+// that input() reads next ("-" for the model's materials) is written
+// after this by operator << for Objects.
+
+void Instance::output( ostream &stream ) const
+
+{
+  stream << "instance" << endl
+	 << "  " << filename << endl;
+
+  for (int i=0; i<4; i++)
+    stream << "  " << objToWorld[i] << endl;
+}
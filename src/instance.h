@@ -0,0 +1,62 @@
+/* instance.h
+ *
+ * A copy of a Wavefront model, placed in the world with its own
+ * transform and, optionally, its own material.
+ *
+ * All instances of a model share its WavefrontObj, and so its
+ * triangles and BVH.  A ray is transformed into the model's space
+ * at the instance, intersected with the model, and the hit is
+ * transformed back.
+ */
+
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+
+#include "object.h"
+#include "wavefrontobj.h"
+#include "bbox.h"
+#include <cstring>
+
+
+class Instance : public Object {
+
+  WavefrontObj *model;		// shared with other instances
+  const char   *filename;	// of the model, as given in the scene file
+  mat4 objToWorld;
+  mat4 worldToObj;
+  mat3 normalToWorld;		// inverse transpose of objToWorld (without translation)
+  float objPerWorld;		// average scaling of lengths by worldToObj
+  BBox worldBox;		// around the transformed model
+
+  static Material modelMaterials; // 'mat' of an instance that uses the model's own materials
+
+ public:
+
+  Instance( WavefrontObj *m, const char *f ) {
+    model = m;
+    filename = strdup( f );
+    mat = &modelMaterials;
+    modelMaterials.name = "-";
+    setTransform( identity4() );
+  }
+
+  void setTransform( mat4 T );
+
+  BBox bbox() {
+    return worldBox;
+  }
+
+  bool rayInt( Ray &ray,
+	       vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material *&mat, int &intPartIndex );
+
+  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint );
+
+  void renderGL( GPUProgram *gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS );
+
+  void input( istream &stream );
+  void output( ostream &stream ) const;
+};
+
+#endif
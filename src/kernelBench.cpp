@@ -0,0 +1,680 @@
+// kernelBench.cpp
+//
+// Micro-benchmarks of the raytracing kernels, without scene loading
+// or OpenGL:
+//
+//   BVH::rayBoxInt, BVH::triangleInt, Triangle::rayInt,
+//   Sphere::rayInt, Texture::texel, Scene::calcIout, BVH::refit
+//
+// Each kernel is run over a fixed set of randomly generated inputs
+// (seeded, so every run sees the same inputs) in a "hit" mix, where
+// most calls take the full path, and a "miss" mix, where most calls
+// exit early.  For Texture::texel the mixes are "coherent" (nearby
+// texels in sequence) and "random".
+//
+// The input set is small enough to stay in cache, and is swept
+// repeatedly.  The best of several timed passes is reported as ns/op
+// and ops/cycle.  Cycles are read from the time-stamp counter on x86,
+// which counts at the nominal (not the boosted) clock rate.
+//
+// BVH::refit is different: a model (-m) is deformed for a number of
+// frames (-f) and its BVH refit after each, as an animation would do.
+// The mixes are "smooth" (a slow wave, which refitting should handle)
+// and "jitter" (every vertex moved randomly by up to 0.3 of the
+// model's radius in every frame, which forces rebuilds).  Its ns/op is
+// per triangle per frame.  The hits of random rays in each frame are
+// checked against a BVH built from scratch, and kbench exits with
+// status 1 if any differ.
+//
+// Usage: kbench [-n ops] [-R seed] [-m model.obj] [-f frames] [kernel ...]
+//
+// Build with -DRT_STATS=0 to remove the counters from the kernels.
+
+
+#include "headers.h"
+
+#include <sstream>
+#include <iomanip>
+#include "main.h"
+#include "bvh.h"
+#include "triangle.h"
+#include "sphere.h"
+#include "texture.h"
+#include "wavefrontobj.h"
+#include "rtStats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  #define HAVE_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+  #include <intrin.h>
+  #define HAVE_TSC 1
+#else
+  #define HAVE_TSC 0
+#endif
+
+
+// Globals that the kernels refer to (defined in main.cpp for 'rt')
+
+int windowWidth  = 800;
+int windowHeight = 600;
+
+Scene      *scene;
+PixelZoom  *pixelZoom;
+StrokeFont *strokeFont;
+
+
+#define NUM_INPUTS  4096	// inputs per kernel (kept small to stay in cache)
+#define NUM_PASSES  5		// timed passes per kernel; the best is reported
+#define HIT_RATE    0.9		// fraction of hits in the "hit" mix (and misses in the "miss" mix)
+#define NUM_CHECK_RAYS 1000	// rays per frame checked against a full build in BVH::refit
+
+enum { HIT_MIX, MISS_MIX };
+
+const char *mixNames[]    = { "hit", "miss" };
+const char *texMixNames[] = { "coherent", "random" };
+const char *refitMixNames[] = { "smooth", "jitter" };
+
+long numOps = 2000000;		// calls per timed pass (-n)
+unsigned int randomSeed = 754376105; // (-R)
+const char *modelFile = "../worlds/data/teapot2.obj"; // model to deform for BVH::refit (-m)
+int numFrames = 200;		// frames of the deformation for BVH::refit (-f)
+
+bool failed = false;		// a check failed
+
+volatile float sink;		// results are accumulated here so that the compiler cannot remove the calls
+
+
+static unsigned long long cycleCount()
+
+{
+#if HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+
+static float randIn( float a, float b )
+
+{
+  return a + (b-a) * randIn01();
+}
+
+
+static vec3 randVec3( float a, float b )
+
+{
+  return vec3( randIn(a,b), randIn(a,b), randIn(a,b) );
+}
+
+
+static vec3 randDirection()
+
+{
+  vec3 v;
+  do
+    v = randVec3( -1, 1 );
+  while (v.squaredLength() > 1 || v.squaredLength() < 0.0001);
+  return v.normalize();
+}
+
+
+// Does input i of the given mix get a hit?
+
+static bool wantHit( int mix, int i )
+
+{
+  float f = (i % 100) / 100.0;
+  return (mix == HIT_MIX ? f < HIT_RATE : f >= HIT_RATE);
+}
+
+
+// Time 'kernel(i)' for i cycling through the inputs, and report the
+// result.  'kernel' returns true on a hit.
+
+template <class Kernel>
+void measure( const char *kernelName, const char *mixName, Kernel kernel )
+
+{
+  double bestTime = 1e30;
+  unsigned long long bestCycles = 0;
+  long numHits = 0;
+
+  kernel( 0 ); // warm up
+
+  for (int pass=0; pass<NUM_PASSES; pass++) {
+
+    numHits = 0;
+
+    double startTime = RTStats::now();
+    unsigned long long startCycles = cycleCount();
+
+    int i = 0;
+    for (long op=0; op<numOps; op++) {
+      if (kernel( i ))
+	numHits++;
+      i = (i+1) & (NUM_INPUTS-1);
+    }
+
+    unsigned long long cycles = cycleCount() - startCycles;
+    double time = RTStats::now() - startTime;
+
+    if (time < bestTime) {
+      bestTime = time;
+      bestCycles = cycles;
+    }
+  }
+
+  cout << setw(22) << left << kernelName
+       << setw(10) << mixName << right
+       << setw(8) << fixed << setprecision(1) << 100.0 * numHits / (double) numOps << "%"
+       << setw(12) << setprecision(2) << bestTime / numOps * 1.0e9;
+
+  if (HAVE_TSC && bestCycles > 0)
+    cout << setw(12) << setprecision(3) << numOps / (double) bestCycles;
+  else
+    cout << setw(12) << "-";
+
+  cout << endl;
+}
+
+
+// Every kernel has access to the private parts of the classes it
+// benchmarks through this class.
+
+class KernelBench {
+
+ public:
+
+  // ---- BVH::rayBoxInt ----
+
+  static void rayBoxInt( int mix ) {
+
+    BVH bvh;
+    BBox boxes[NUM_INPUTS];
+    Ray  rays[NUM_INPUTS];
+
+    for (int i=0; i<NUM_INPUTS; i++) {
+
+      vec3 a = randVec3( -1, 1 );
+      vec3 b = randVec3( -1, 1 );
+      boxes[i].min = vec3( MIN(a.x,b.x), MIN(a.y,b.y), MIN(a.z,b.z) );
+      boxes[i].max = vec3( MAX(a.x,b.x), MAX(a.y,b.y), MAX(a.z,b.z) );
+
+      // Aim at a point inside the box for a hit, and outside all boxes for a miss
+
+      vec3 start = 5 * randDirection();
+
+      vec3 target;
+      if (wantHit( mix, i ))
+	target = boxes[i].min + vec3( randIn01() * (boxes[i].max.x - boxes[i].min.x),
+				      randIn01() * (boxes[i].max.y - boxes[i].min.y),
+				      randIn01() * (boxes[i].max.z - boxes[i].min.z) );
+      else
+	target = start + 5 * (start ^ randDirection()).normalize(); // tangent to the sphere of radius 5
+
+      rays[i] = Ray( start, (target - start).normalize(), PRIMARY_RAY );
+    }
+
+    measure( "BVH::rayBoxInt", mixNames[mix], [&]( int i ) {
+	return bvh.rayBoxInt( rays[i], boxes[i] );
+      } );
+  }
+
+  // ---- BVH::triangleInt ----
+
+  static void bvhTriangleInt( int mix ) {
+
+    Ray rays[NUM_INPUTS];
+
+    wfModel model;
+    model.hasVertexNormals = false;
+    model.hasVertexTexCoords = true;
+
+    BVH bvh;
+    bvh.obj        = &model;
+    bvh.vertices   = &model.vertices;
+    bvh.texcoords  = &model.texcoords;
+    bvh.normals    = &model.normals;
+    bvh.facetnorms = &model.facetnorms;
+    bvh.vindices   = &model.vindices;
+    bvh.tindices   = &model.tindices;
+    bvh.nindices   = &model.nindices;
+
+    model.texcoords.add( vec3(0,0,0) );
+    model.texcoords.add( vec3(1,0,0) );
+    model.texcoords.add( vec3(0,1,0) );
+
+    for (int i=0; i<NUM_INPUTS; i++) {
+
+      vec3 v0 = randVec3( -1, 1 );
+      vec3 v1 = v0 + randVec3( -0.5, 0.5 );
+      vec3 v2 = v0 + randVec3( -0.5, 0.5 );
+
+      model.vertices.add( v0 );
+      model.vertices.add( v1 );
+      model.vertices.add( v2 );
+      model.facetnorms.add( ((v1-v0) ^ (v2-v0)).normalize() );
+
+      GLuint v[3] = { (GLuint) 3*i, (GLuint) 3*i+1, (GLuint) 3*i+2 };
+      GLuint t[3] = { 0, 1, 2 };
+      GLuint n[3] = { 0, 0, 0 };
+      model.addFace( v, t, n );
+
+      makeTriangleRay( mix, i, v0, v1, v2, rays[i] );
+    }
+
+    measure( "BVH::triangleInt", mixNames[mix], [&]( int i ) {
+	float param, alpha, beta, gamma;
+	vec3 point, normal, texCoords;
+	bool hit = bvh.triangleInt( rays[i], i, param, point, normal, texCoords, alpha, beta, gamma );
+	if (hit)
+	  sink += param + texCoords.x;
+	return hit;
+      } );
+  }
+
+  // ---- Triangle::rayInt ----
+
+  static void triangleRayInt( int mix ) {
+
+    Material mat;
+    Triangle *triangles = new Triangle[NUM_INPUTS];
+    Ray rays[NUM_INPUTS];
+
+    for (int i=0; i<NUM_INPUTS; i++) {
+
+      vec3 v0 = randVec3( -1, 1 );
+      vec3 v1 = v0 + randVec3( -0.5, 0.5 );
+      vec3 v2 = v0 + randVec3( -0.5, 0.5 );
+
+      stringstream s;
+      s << v0 << endl << v1 << endl << v2 << endl;
+      triangles[i].input( s );
+      triangles[i].mat = &mat;
+
+      makeTriangleRay( mix, i, v0, v1, v2, rays[i] );
+    }
+
+    measure( "Triangle::rayInt", mixNames[mix], [&]( int i ) {
+	vec3 point, normal, texCoords;
+	float param;
+	Material *m;
+	int partIndex;
+	bool hit = triangles[i].rayInt( rays[i], point, normal, texCoords, param, m, partIndex );
+	if (hit)
+	  sink += param + normal.x;
+	return hit;
+      } );
+
+    delete [] triangles;
+  }
+
+  // ---- Sphere::rayInt ----
+
+  static void sphereRayInt( int mix ) {
+
+    #define NUM_SPHERES 256
+
+    Sphere *spheres[NUM_SPHERES];
+    Ray rays[NUM_INPUTS];
+    vec3 centres[NUM_SPHERES];
+    float radii[NUM_SPHERES];
+
+    for (int i=0; i<NUM_SPHERES; i++) {
+      centres[i] = randVec3( -1, 1 );
+      radii[i] = randIn( 0.05, 0.5 );
+      spheres[i] = new Sphere( centres[i], radii[i] );
+    }
+
+    for (int i=0; i<NUM_INPUTS; i++) {
+
+      int s = i % NUM_SPHERES;
+
+      vec3 start = centres[s] + 5 * randDirection();
+
+      vec3 target;
+      if (wantHit( mix, i ))
+	target = centres[s] + 0.9 * radii[s] * randDirection();
+      else {
+	vec3 toCentre = (centres[s] - start).normalize();
+	target = centres[s] + 1.5 * radii[s] * (toCentre ^ randDirection()).normalize(); // pass beside the sphere
+      }
+
+      rays[i] = Ray( start, (target - start).normalize(), PRIMARY_RAY );
+    }
+
+    measure( "Sphere::rayInt", mixNames[mix], [&]( int i ) {
+	vec3 point, normal, texCoords;
+	float param;
+	Material *m;
+	int partIndex;
+	bool hit = spheres[i % NUM_SPHERES]->rayInt( rays[i], point, normal, texCoords, param, m, partIndex );
+	if (hit)
+	  sink += param + normal.x;
+	return hit;
+      } );
+
+    // The spheres are not deleted, as ~GPUProgram() needs an OpenGL context
+  }
+
+  // ---- Texture::texel ----
+
+  static void texel( int mix ) {
+
+    #define TEX_SIZE 1024
+
+    Texture tex;
+    tex.width = TEX_SIZE;
+    tex.height = TEX_SIZE;
+    tex.hasAlpha = false;
+    tex.texmap = new GLubyte[ 3 * TEX_SIZE * TEX_SIZE ];
+
+    for (int i=0; i<3*TEX_SIZE*TEX_SIZE; i++)
+      tex.texmap[i] = rand() & 255;
+
+    bool useMipMaps = Texture::useMipMaps;
+    Texture::useMipMaps = true;
+    tex.buildLevels();
+    Texture::useMipMaps = useMipMaps;
+
+    vec2 coords[NUM_INPUTS];
+
+    if (mix == HIT_MIX) { // coherent: a short scanline walk, as adjacent pixels would do
+      vec2 start( randIn01(), randIn01() );
+      for (int i=0; i<NUM_INPUTS; i++)
+	coords[i] = start + vec2( (i % 64) / (float) TEX_SIZE, (i / 64) / (float) TEX_SIZE );
+    } else
+      for (int i=0; i<NUM_INPUTS; i++)
+	coords[i] = vec2( randIn01(), randIn01() );
+
+    measure( "Texture::texel", texMixNames[mix], [&]( int i ) {
+	float alpha;
+	vec3 c = tex.texel( coords[i].x, coords[i].y, alpha );
+	sink += c.x;
+	return true;
+      } );
+
+    // Filtered over about three texels, as on a distant surface
+
+    measure( "Texture::texel mip", texMixNames[mix], [&]( int i ) {
+	float alpha;
+	vec3 c = tex.texel( coords[i].x, coords[i].y, 3.0f / TEX_SIZE, alpha );
+	sink += c.x;
+	return true;
+      } );
+  }
+
+  // ---- Scene::calcIout ----
+
+  static void calcIout( int mix ) {
+
+    vec3 N[NUM_INPUTS], L[NUM_INPUTS], E[NUM_INPUTS], R[NUM_INPUTS];
+
+    for (int i=0; i<NUM_INPUTS; i++) {
+
+      N[i] = randDirection();
+
+      // For a hit, the light is in front and the viewer near the
+      // reflection direction, so the specular term is computed.  For
+      // a miss, the light is behind the surface.
+
+      L[i] = randDirection();
+      if ((N[i] * L[i] > 0) != wantHit( mix, i ))
+	L[i] = -1 * L[i];
+
+      R[i] = (2 * (L[i] * N[i])) * N[i] - L[i];
+      E[i] = (R[i] + 0.3 * randDirection()).normalize();
+    }
+
+    vec3 Kd(0.7,0.7,0.7), Ks(0.3,0.3,0.3), In(1,1,1);
+    float ns = 200;
+
+    measure( "Scene::calcIout", mixNames[mix], [&]( int i ) {
+	vec3 c = scene->calcIout<true>( N[i], L[i], E[i], R[i], Kd, Ks, ns, In );
+	sink += c.x;
+	return N[i] * L[i] > 0;
+      } );
+
+    // Only the kd term, as for a material without MAT_SPECULAR
+
+    measure( "Scene::calcIout kd", mixNames[mix], [&]( int i ) {
+	vec3 c = scene->calcIout<false>( N[i], L[i], E[i], R[i], Kd, Ks, ns, In );
+	sink += c.x;
+	return N[i] * L[i] > 0;
+      } );
+  }
+
+  // ---- BVH::refit ----
+
+  static void refit( int mix ) {
+
+    WavefrontObj model( modelFile );
+    wfModel *obj = model.obj;
+
+    // The vertices are deformed in world coordinates, but given to
+    // setVertices() in the model's own coordinates
+
+    mat4 worldToObj = obj->objToWorldTransform.inverse();
+
+    seq<vec3> rest, moved;
+    for (int i=0; i<obj->vertices.size(); i++) {
+      rest.add( obj->vertices[i] );
+      moved.add( obj->vertices[i] );
+    }
+
+    vec3 centre = obj->centre;
+    float radius = obj->radius;
+
+    // A tree built from scratch in each frame, on the same triangles
+
+    BVH full;
+    full.obj        = obj;
+    full.vertices   = &obj->vertices;
+    full.texcoords  = &obj->texcoords;
+    full.normals    = &obj->normals;
+    full.facetnorms = &obj->facetnorms;
+    full.vindices   = &obj->vindices;
+    full.tindices   = &obj->tindices;
+    full.nindices   = &obj->nindices;
+    for (int i=0; i<model.bvh.materials.size(); i++)
+      full.materials.add( model.bvh.materials[i] );
+
+    double refitTime = 0, maxRefitTime = 0, buildTime = 0;
+    int numRebuilt = 0, numFullRebuilds = 0;
+    long numRays = 0, numHits = 0, numDiffer = 0;
+    size_t firstBytes = 0, maxBytes = 0;
+
+    for (int f=0; f<numFrames; f++) {
+
+      for (int i=0; i<rest.size(); i++)
+	if (mix == HIT_MIX) {
+	  float phase = 2 * M_PI * f / 50.0 + 4 * (rest[i].y - centre.y) / radius;
+	  moved[i] = rest[i] + (0.05f * radius * sin( phase )) * vec3(1,0,0);
+	} else
+	  moved[i] = rest[i] + (0.3f * radius * randIn01()) * randDirection();
+
+      for (int i=0; i<moved.size(); i++)
+	moved[i] = (worldToObj * vec4( moved[i], 1.0 )).toVec3();
+
+      model.setVertices( moved );
+
+      refitTime += model.bvh.refitTime;
+      maxRefitTime = MAX( maxRefitTime, model.bvh.refitTime );
+      if (model.bvh.numRebuiltSubtrees < 0)
+	numFullRebuilds++;
+      else
+	numRebuilt += model.bvh.numRebuiltSubtrees;
+
+      size_t bytes = model.bvh.nodeArena.bytesReserved();
+      if (f == 0)
+	firstBytes = bytes;
+      maxBytes = MAX( maxBytes, bytes );
+
+      full.buildTree();
+      buildTime += full.buildTime;
+
+      // Rays from outside toward points inside the model's bounding sphere
+
+      for (int r=0; r<NUM_CHECK_RAYS; r++) {
+
+	vec3 start  = centre + 2 * radius * randDirection();
+	vec3 target = centre + radius * randIn01() * randDirection();
+
+	Ray ray1( start, (target - start).normalize(), PRIMARY_RAY );
+	Ray ray2 = ray1;
+
+	vec3 point1, normal1, texCoords1, point2, normal2, texCoords2;
+	float param1, param2;
+	Material *mat1, *mat2;
+	int tri1, tri2;
+
+	bool hit1 = model.bvh.rayInt( ray1, -1, point1, normal1, texCoords1, param1, mat1, tri1 );
+	bool hit2 = full.rayInt( ray2, -1, point2, normal2, texCoords2, param2, mat2, tri2 );
+
+	numRays++;
+	if (hit1)
+	  numHits++;
+	if (hit1 != hit2 || (hit1 && fabs( param1 - param2 ) > 1e-4 * radius))
+	  numDiffer++;
+      }
+    }
+
+    cout << setw(22) << left << "BVH::refit"
+	 << setw(10) << refitMixNames[mix] << right
+	 << setw(8) << fixed << setprecision(1) << 100.0 * numHits / (double) numRays << "%"
+	 << setw(12) << setprecision(2) << refitTime / numFrames / obj->numFaces() * 1.0e9
+	 << setw(12) << "-" << endl;
+
+    cout << "  " << numFrames << " frames of " << obj->numFaces() << " triangles:"
+	 << " refit " << setprecision(3) << 1000 * refitTime / numFrames << " ms (max " << 1000 * maxRefitTime << " ms),"
+	 << " full build " << 1000 * buildTime / numFrames << " ms" << endl
+	 << "  rebuilt " << numRebuilt << " subtrees and " << numFullRebuilds << " whole trees;"
+	 << " node arena " << firstBytes / 1024 << " KB after the first frame, at most " << maxBytes / 1024 << " KB" << endl
+	 << "  " << numDiffer << " of " << numRays << " hits differ from the full build" << endl;
+
+    if (numDiffer > 0)
+      failed = true;
+  }
+
+  // Make a ray toward triangle v0,v1,v2 which hits it or misses it,
+  // depending on the mix
+
+  static void makeTriangleRay( int mix, int i, vec3 v0, vec3 v1, vec3 v2, Ray &ray ) {
+
+    vec3 target;
+
+    if (wantHit( mix, i )) { // random point inside
+      float a = randIn01();
+      float b = randIn01();
+      if (a+b > 1) {
+	a = 1-a;
+	b = 1-b;
+      }
+      target = v0 + a * (v1-v0) + b * (v2-v0);
+    } else // point in the plane beyond edge v1-v2
+      target = v0 + randIn( 1.1, 2 ) * (v1-v0) + randIn( 1.1, 2 ) * (v2-v0);
+
+    vec3 start = target + 3 * randDirection();
+    ray = Ray( start, (target - start).normalize(), PRIMARY_RAY );
+  }
+};
+
+
+
+struct {
+  const char *name;
+  void (*run)( int mix );
+} kernels[] = {
+  { "rayBoxInt",   KernelBench::rayBoxInt },
+  { "triangleInt", KernelBench::bvhTriangleInt },
+  { "triangle",    KernelBench::triangleRayInt },
+  { "sphere",      KernelBench::sphereRayInt },
+  { "texel",       KernelBench::texel },
+  { "calcIout",    KernelBench::calcIout },
+  { "refit",       KernelBench::refit }
+};
+
+#define NUM_KERNELS (int) (sizeof(kernels)/sizeof(kernels[0]))
+
+
+
+int main( int argc, char **argv )
+
+{
+  bool selected[NUM_KERNELS];
+  bool anySelected = false;
+
+  for (int k=0; k<NUM_KERNELS; k++)
+    selected[k] = false;
+
+  while (argc > 1) {
+    argv++;
+    argc--;
+    if (argv[0][0] == '-' && argc > 1) {
+
+      switch (argv[0][1]) {
+      case 'n':
+	argc--; argv++;
+	numOps = atol( *argv );
+	break;
+      case 'R':
+	argc--; argv++;
+	randomSeed = strtoul( *argv, NULL, 10 );
+	break;
+      case 'm':
+	argc--; argv++;
+	modelFile = *argv;
+	break;
+      case 'f':
+	argc--; argv++;
+	numFrames = atoi( *argv );
+	break;
+      default:
+	cerr << "Usage: kbench [-n ops] [-R seed] [-m model.obj] [-f frames] [kernel ...]" << endl;
+	exit(1);
+      }
+
+    } else {
+
+      int k;
+      for (k=0; k<NUM_KERNELS; k++)
+	if (strcmp( argv[0], kernels[k].name ) == 0)
+	  break;
+
+      if (k == NUM_KERNELS) {
+	cerr << "Unknown kernel " << argv[0] << ".  Kernels are:";
+	for (k=0; k<NUM_KERNELS; k++)
+	  cerr << " " << kernels[k].name;
+	cerr << endl;
+	exit(1);
+      }
+
+      selected[k] = true;
+      anySelected = true;
+    }
+  }
+
+  scene = new Scene();
+
+#if RT_STATS
+  cerr << "(the kernels include the RT_STATS counters; build with -DRT_STATS=0 to remove them)" << endl;
+#endif
+
+  cout << setw(22) << left << "kernel"
+       << setw(10) << "mix" << right
+       << setw(9) << "hits"
+       << setw(12) << "ns/op"
+       << setw(12) << "ops/cycle" << endl;
+
+  for (int k=0; k<NUM_KERNELS; k++)
+    if (!anySelected || selected[k])
+      for (int mix=HIT_MIX; mix<=MISS_MIX; mix++) {
+	srand( randomSeed ); // same inputs every run
+	kernels[k].run( mix );
+      }
+
+  return (failed ? 1 : 0);
+}
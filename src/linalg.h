@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <cstring>
 
 #ifdef _WIN32
   #pragma warning(disable : 4244 4305 4996)
@@ -360,4 +361,468 @@ mat4 perspective( float fovy, float aspect, float n, float f );
 std::ostream& operator << ( std::ostream& stream, mat4 const& m );
 std::istream& operator >> ( std::istream& stream, mat4 & m );
 
+
+// ---------------- SIMD types ----------------
+//
+// floatx4, floatx8   4 or 8 floats operated on together
+// vec3a              a vec3 in one 16-byte aligned SIMD register (w is padding)
+// vec3x4, vec3x8     4 or 8 vec3s stored as structure-of-arrays (x's, y's, z's)
+//
+// These use SSE (always available on x86-64) and AVX (if compiled
+// with -mavx) and FMA (if compiled with -mfma).  Otherwise they fall
+// back to plain loops over floats, which compilers usually vectorize.
+//
+// A vec3a can be used wherever a 'const vec3 &' is expected, at no
+// cost, since its first three floats are laid out as a vec3.
+//
+// Comparisons return masks (with all bits set in the true lanes) for
+// use with select() and any()/all().
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define LINALG_SSE 1
+  #include <immintrin.h>
+#else
+  #define LINALG_SSE 0
+#endif
+
+#if LINALG_SSE && defined(__AVX__)
+  #define LINALG_AVX 1
+#else
+  #define LINALG_AVX 0
+#endif
+
+#if LINALG_SSE && defined(__FMA__)
+  #define LINALG_FMA 1
+#else
+  #define LINALG_FMA 0
+#endif
+
+
+// ---------------- floatx4 ----------------
+
+
+class alignas(16) floatx4 {
+public:
+
+#if LINALG_SSE
+  __m128 m;
+
+  floatx4() {}
+  floatx4( __m128 mm ) { m = mm; }
+  floatx4( float f ) { m = _mm_set1_ps( f ); }
+  floatx4( float a, float b, float c, float d ) { m = _mm_setr_ps( a, b, c, d ); }
+
+  static floatx4 load( const float *p ) { return _mm_loadu_ps( p ); }
+
+  static floatx4 loadBytes( const unsigned char *p ) { // 4 unsigned bytes, converted to floats
+    int b;
+    memcpy( &b, p, 4 );
+    __m128i zero = _mm_setzero_si128();
+    __m128i i32 = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( b ), zero ), zero );
+    return _mm_cvtepi32_ps( i32 );
+  }
+  void store( float *p ) const { _mm_storeu_ps( p, m ); }
+
+  float operator[]( int i ) const { float v[4]; store( v ); return v[i]; }
+
+  floatx4 operator + ( floatx4 b ) const { return _mm_add_ps( m, b.m ); }
+  floatx4 operator - ( floatx4 b ) const { return _mm_sub_ps( m, b.m ); }
+  floatx4 operator * ( floatx4 b ) const { return _mm_mul_ps( m, b.m ); }
+  floatx4 operator / ( floatx4 b ) const { return _mm_div_ps( m, b.m ); }
+
+  floatx4 operator <  ( floatx4 b ) const { return _mm_cmplt_ps( m, b.m ); }
+  floatx4 operator <= ( floatx4 b ) const { return _mm_cmple_ps( m, b.m ); }
+  floatx4 operator >  ( floatx4 b ) const { return _mm_cmpgt_ps( m, b.m ); }
+  floatx4 operator >= ( floatx4 b ) const { return _mm_cmpge_ps( m, b.m ); }
+
+  floatx4 operator & ( floatx4 b ) const { return _mm_and_ps( m, b.m ); }
+  floatx4 operator | ( floatx4 b ) const { return _mm_or_ps( m, b.m ); }
+
+  int movemask() const { return _mm_movemask_ps( m ); } // bit i is set iff lane i is true
+#else
+  float f[4];
+
+  floatx4() {}
+  floatx4( float v ) { f[0] = f[1] = f[2] = f[3] = v; }
+  floatx4( float a, float b, float c, float d ) { f[0] = a; f[1] = b; f[2] = c; f[3] = d; }
+
+  static floatx4 load( const float *p ) { return floatx4( p[0], p[1], p[2], p[3] ); }
+  static floatx4 loadBytes( const unsigned char *p ) { return floatx4( p[0], p[1], p[2], p[3] ); }
+  void store( float *p ) const { for (int i=0; i<4; i++) p[i] = f[i]; }
+
+  float operator[]( int i ) const { return f[i]; }
+
+  #define LINALG_LANES4(expr) { floatx4 r; for (int i=0; i<4; i++) r.f[i] = (expr); return r; }
+  #define LINALG_MASK(c) ((c) ? maskTrue() : 0.0f)
+
+  static float maskTrue() { unsigned int u = 0xffffffff; float v; memcpy( &v, &u, 4 ); return v; }
+  static bool isTrue( float v ) { unsigned int u; memcpy( &u, &v, 4 ); return u != 0; }
+
+  floatx4 operator + ( floatx4 b ) const LINALG_LANES4( f[i] + b.f[i] )
+  floatx4 operator - ( floatx4 b ) const LINALG_LANES4( f[i] - b.f[i] )
+  floatx4 operator * ( floatx4 b ) const LINALG_LANES4( f[i] * b.f[i] )
+  floatx4 operator / ( floatx4 b ) const LINALG_LANES4( f[i] / b.f[i] )
+
+  floatx4 operator <  ( floatx4 b ) const LINALG_LANES4( LINALG_MASK( f[i] <  b.f[i] ) )
+  floatx4 operator <= ( floatx4 b ) const LINALG_LANES4( LINALG_MASK( f[i] <= b.f[i] ) )
+  floatx4 operator >  ( floatx4 b ) const LINALG_LANES4( LINALG_MASK( f[i] >  b.f[i] ) )
+  floatx4 operator >= ( floatx4 b ) const LINALG_LANES4( LINALG_MASK( f[i] >= b.f[i] ) )
+
+  floatx4 operator & ( floatx4 b ) const LINALG_LANES4( LINALG_MASK( isTrue(f[i]) && isTrue(b.f[i]) ) )
+  floatx4 operator | ( floatx4 b ) const LINALG_LANES4( LINALG_MASK( isTrue(f[i]) || isTrue(b.f[i]) ) )
+
+  int movemask() const { int r = 0; for (int i=0; i<4; i++) if (isTrue(f[i])) r |= 1<<i; return r; }
+#endif
+};
+
+
+#if LINALG_SSE
+
+inline floatx4 vmin( floatx4 a, floatx4 b ) { return _mm_min_ps( a.m, b.m ); }
+inline floatx4 vmax( floatx4 a, floatx4 b ) { return _mm_max_ps( a.m, b.m ); }
+inline floatx4 sqrt( floatx4 a )            { return _mm_sqrt_ps( a.m ); }
+
+// 1/sqrt(a) with one Newton-Raphson step (about 22 bits of precision)
+
+inline floatx4 rsqrt( floatx4 a )
+
+{
+  __m128 r = _mm_rsqrt_ps( a.m );
+  __m128 rra = _mm_mul_ps( _mm_mul_ps( r, r ), a.m );
+  return _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( 0.5f ), r ), _mm_sub_ps( _mm_set1_ps( 3.0f ), rra ) );
+}
+
+// a*b + c, fused if FMA is available
+
+inline floatx4 fma( floatx4 a, floatx4 b, floatx4 c )
+
+{
+#if LINALG_FMA
+  return _mm_fmadd_ps( a.m, b.m, c.m );
+#else
+  return _mm_add_ps( _mm_mul_ps( a.m, b.m ), c.m );
+#endif
+}
+
+// mask ? a : b, lane by lane
+
+inline floatx4 select( floatx4 mask, floatx4 a, floatx4 b )
+
+{
+  return _mm_or_ps( _mm_and_ps( mask.m, a.m ), _mm_andnot_ps( mask.m, b.m ) );
+}
+
+inline float hmin( floatx4 a )
+
+{
+  __m128 m = _mm_min_ps( a.m, _mm_shuffle_ps( a.m, a.m, _MM_SHUFFLE(2,3,0,1) ) );
+  m = _mm_min_ps( m, _mm_shuffle_ps( m, m, _MM_SHUFFLE(1,0,3,2) ) );
+  return _mm_cvtss_f32( m );
+}
+
+inline float hmax( floatx4 a )
+
+{
+  __m128 m = _mm_max_ps( a.m, _mm_shuffle_ps( a.m, a.m, _MM_SHUFFLE(2,3,0,1) ) );
+  m = _mm_max_ps( m, _mm_shuffle_ps( m, m, _MM_SHUFFLE(1,0,3,2) ) );
+  return _mm_cvtss_f32( m );
+}
+
+inline float hsum( floatx4 a )
+
+{
+  __m128 m = _mm_add_ps( a.m, _mm_shuffle_ps( a.m, a.m, _MM_SHUFFLE(2,3,0,1) ) );
+  m = _mm_add_ps( m, _mm_shuffle_ps( m, m, _MM_SHUFFLE(1,0,3,2) ) );
+  return _mm_cvtss_f32( m );
+}
+
+#else
+
+inline floatx4 vmin( floatx4 a, floatx4 b ) LINALG_LANES4( a.f[i] < b.f[i] ? a.f[i] : b.f[i] )
+inline floatx4 vmax( floatx4 a, floatx4 b ) LINALG_LANES4( a.f[i] > b.f[i] ? a.f[i] : b.f[i] )
+inline floatx4 sqrt( floatx4 a )            LINALG_LANES4( sqrtf( a.f[i] ) )
+inline floatx4 rsqrt( floatx4 a )           LINALG_LANES4( 1 / sqrtf( a.f[i] ) )
+inline floatx4 fma( floatx4 a, floatx4 b, floatx4 c ) LINALG_LANES4( a.f[i] * b.f[i] + c.f[i] )
+inline floatx4 select( floatx4 mask, floatx4 a, floatx4 b ) LINALG_LANES4( floatx4::isTrue( mask.f[i] ) ? a.f[i] : b.f[i] )
+
+inline float hmin( floatx4 a ) { return fminf( fminf( a.f[0], a.f[1] ), fminf( a.f[2], a.f[3] ) ); }
+inline float hmax( floatx4 a ) { return fmaxf( fmaxf( a.f[0], a.f[1] ), fmaxf( a.f[2], a.f[3] ) ); }
+inline float hsum( floatx4 a ) { return (a.f[0] + a.f[1]) + (a.f[2] + a.f[3]); }
+
+#endif
+
+inline bool any( floatx4 mask ) { return mask.movemask() != 0; }
+inline bool all( floatx4 mask ) { return mask.movemask() == 0xf; }
+
+
+// ---------------- floatx8 ----------------
+//
+// With AVX, one register.  Otherwise, two floatx4 halves.
+
+
+class alignas(32) floatx8 {
+public:
+
+#if LINALG_AVX
+  __m256 m;
+
+  floatx8() {}
+  floatx8( __m256 mm ) { m = mm; }
+  floatx8( float f ) { m = _mm256_set1_ps( f ); }
+
+  static floatx8 load( const float *p ) { return _mm256_loadu_ps( p ); }
+
+  static floatx8 loadBytes( const unsigned char *p ) { // 8 unsigned bytes, converted to floats
+#ifdef __AVX2__
+    return _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i *) p ) ) );
+#else
+    return _mm256_insertf128_ps( _mm256_castps128_ps256( floatx4::loadBytes( p ).m ), floatx4::loadBytes( p+4 ).m, 1 );
+#endif
+  }
+  void store( float *p ) const { _mm256_storeu_ps( p, m ); }
+
+  floatx8 operator + ( floatx8 b ) const { return _mm256_add_ps( m, b.m ); }
+  floatx8 operator - ( floatx8 b ) const { return _mm256_sub_ps( m, b.m ); }
+  floatx8 operator * ( floatx8 b ) const { return _mm256_mul_ps( m, b.m ); }
+  floatx8 operator / ( floatx8 b ) const { return _mm256_div_ps( m, b.m ); }
+
+  floatx8 operator <  ( floatx8 b ) const { return _mm256_cmp_ps( m, b.m, _CMP_LT_OQ ); }
+  floatx8 operator <= ( floatx8 b ) const { return _mm256_cmp_ps( m, b.m, _CMP_LE_OQ ); }
+  floatx8 operator >  ( floatx8 b ) const { return _mm256_cmp_ps( m, b.m, _CMP_GT_OQ ); }
+  floatx8 operator >= ( floatx8 b ) const { return _mm256_cmp_ps( m, b.m, _CMP_GE_OQ ); }
+
+  floatx8 operator & ( floatx8 b ) const { return _mm256_and_ps( m, b.m ); }
+  floatx8 operator | ( floatx8 b ) const { return _mm256_or_ps( m, b.m ); }
+
+  int movemask() const { return _mm256_movemask_ps( m ); }
+
+  floatx4 lo() const { return _mm256_castps256_ps128( m ); }
+  floatx4 hi() const { return _mm256_extractf128_ps( m, 1 ); }
+#else
+  floatx4 h[2];
+
+  floatx8() {}
+  floatx8( floatx4 a, floatx4 b ) { h[0] = a; h[1] = b; }
+  floatx8( float f ) { h[0] = floatx4( f ); h[1] = floatx4( f ); }
+
+  static floatx8 load( const float *p ) { return floatx8( floatx4::load( p ), floatx4::load( p+4 ) ); }
+  static floatx8 loadBytes( const unsigned char *p ) { return floatx8( floatx4::loadBytes( p ), floatx4::loadBytes( p+4 ) ); }
+  void store( float *p ) const { h[0].store( p ); h[1].store( p+4 ); }
+
+  floatx8 operator + ( floatx8 b ) const { return floatx8( h[0] + b.h[0], h[1] + b.h[1] ); }
+  floatx8 operator - ( floatx8 b ) const { return floatx8( h[0] - b.h[0], h[1] - b.h[1] ); }
+  floatx8 operator * ( floatx8 b ) const { return floatx8( h[0] * b.h[0], h[1] * b.h[1] ); }
+  floatx8 operator / ( floatx8 b ) const { return floatx8( h[0] / b.h[0], h[1] / b.h[1] ); }
+
+  floatx8 operator <  ( floatx8 b ) const { return floatx8( h[0] <  b.h[0], h[1] <  b.h[1] ); }
+  floatx8 operator <= ( floatx8 b ) const { return floatx8( h[0] <= b.h[0], h[1] <= b.h[1] ); }
+  floatx8 operator >  ( floatx8 b ) const { return floatx8( h[0] >  b.h[0], h[1] >  b.h[1] ); }
+  floatx8 operator >= ( floatx8 b ) const { return floatx8( h[0] >= b.h[0], h[1] >= b.h[1] ); }
+
+  floatx8 operator & ( floatx8 b ) const { return floatx8( h[0] & b.h[0], h[1] & b.h[1] ); }
+  floatx8 operator | ( floatx8 b ) const { return floatx8( h[0] | b.h[0], h[1] | b.h[1] ); }
+
+  int movemask() const { return h[0].movemask() | (h[1].movemask() << 4); }
+
+  floatx4 lo() const { return h[0]; }
+  floatx4 hi() const { return h[1]; }
+#endif
+
+  float operator[]( int i ) const { float v[8]; store( v ); return v[i]; }
+};
+
+
+#if LINALG_AVX
+
+inline floatx8 vmin( floatx8 a, floatx8 b ) { return _mm256_min_ps( a.m, b.m ); }
+inline floatx8 vmax( floatx8 a, floatx8 b ) { return _mm256_max_ps( a.m, b.m ); }
+inline floatx8 sqrt( floatx8 a )            { return _mm256_sqrt_ps( a.m ); }
+
+inline floatx8 rsqrt( floatx8 a )
+
+{
+  __m256 r = _mm256_rsqrt_ps( a.m );
+  __m256 rra = _mm256_mul_ps( _mm256_mul_ps( r, r ), a.m );
+  return _mm256_mul_ps( _mm256_mul_ps( _mm256_set1_ps( 0.5f ), r ), _mm256_sub_ps( _mm256_set1_ps( 3.0f ), rra ) );
+}
+
+inline floatx8 fma( floatx8 a, floatx8 b, floatx8 c )
+
+{
+#if LINALG_FMA
+  return _mm256_fmadd_ps( a.m, b.m, c.m );
+#else
+  return _mm256_add_ps( _mm256_mul_ps( a.m, b.m ), c.m );
+#endif
+}
+
+inline floatx8 select( floatx8 mask, floatx8 a, floatx8 b ) { return _mm256_blendv_ps( b.m, a.m, mask.m ); }
+
+#else
+
+inline floatx8 vmin( floatx8 a, floatx8 b ) { return floatx8( vmin( a.h[0], b.h[0] ), vmin( a.h[1], b.h[1] ) ); }
+inline floatx8 vmax( floatx8 a, floatx8 b ) { return floatx8( vmax( a.h[0], b.h[0] ), vmax( a.h[1], b.h[1] ) ); }
+inline floatx8 sqrt( floatx8 a )            { return floatx8( sqrt( a.h[0] ), sqrt( a.h[1] ) ); }
+inline floatx8 rsqrt( floatx8 a )           { return floatx8( rsqrt( a.h[0] ), rsqrt( a.h[1] ) ); }
+inline floatx8 fma( floatx8 a, floatx8 b, floatx8 c ) { return floatx8( fma( a.h[0], b.h[0], c.h[0] ), fma( a.h[1], b.h[1], c.h[1] ) ); }
+inline floatx8 select( floatx8 mask, floatx8 a, floatx8 b ) { return floatx8( select( mask.h[0], a.h[0], b.h[0] ), select( mask.h[1], a.h[1], b.h[1] ) ); }
+
+#endif
+
+inline float hmin( floatx8 a ) { return hmin( vmin( a.lo(), a.hi() ) ); }
+inline float hmax( floatx8 a ) { return hmax( vmax( a.lo(), a.hi() ) ); }
+inline float hsum( floatx8 a ) { return hsum( a.lo() + a.hi() ); }
+
+inline bool any( floatx8 mask ) { return mask.movemask() != 0; }
+inline bool all( floatx8 mask ) { return mask.movemask() == 0xff; }
+
+
+// ---------------- vec3a ----------------
+
+
+class alignas(16) vec3a {
+public:
+
+  union {
+    floatx4 v;
+    struct { float x, y, z, w; };	// w is padding and is kept at 0
+  };
+
+  vec3a() {}
+
+  vec3a( floatx4 vv ) { v = vv; }
+
+  vec3a( float xx, float yy, float zz )
+    { v = floatx4( xx, yy, zz, 0 ); }
+
+  vec3a( const vec3 &p )
+    { v = floatx4( p.x, p.y, p.z, 0 ); }
+
+  operator const vec3 & () const { return *(const vec3 *) &x; } // no copy
+  vec3 toVec3() const { return vec3( x, y, z ); }
+
+  vec3a operator + ( vec3a p ) const { return v + p.v; }
+  vec3a operator - ( vec3a p ) const { return v - p.v; }
+  vec3a operator % ( vec3a p ) const { return v * p.v; } /* component-wise product */
+
+  float operator * ( vec3a p ) const /* dot product */
+    { return hsum( v * p.v ); }
+
+  vec3a operator ^ ( vec3a p ) const { /* cross product */
+#if LINALG_SSE
+    __m128 a_yzx = _mm_shuffle_ps( v.m, v.m, _MM_SHUFFLE(3,0,2,1) );
+    __m128 b_yzx = _mm_shuffle_ps( p.v.m, p.v.m, _MM_SHUFFLE(3,0,2,1) );
+    __m128 c = _mm_sub_ps( _mm_mul_ps( v.m, b_yzx ), _mm_mul_ps( a_yzx, p.v.m ) );
+    return floatx4( _mm_shuffle_ps( c, c, _MM_SHUFFLE(3,0,2,1) ) );
+#else
+    return vec3a( y*p.z-p.y*z, -(x*p.z-p.x*z), x*p.y-p.x*y );
+#endif
+  }
+
+  float squaredLength() const { return *this * *this; }
+  float length() const { return sqrtf( squaredLength() ); }
+
+  vec3a normalize() const { /* exact */
+    return v * floatx4( 1 / length() );
+  }
+
+  vec3a normalizeFast() const { /* with rsqrt(): about 22 bits of precision */
+    return v * rsqrt( floatx4( squaredLength() ) );
+  }
+
+  float hmin() const { return fminf( fminf( x, y ), z ); } /* over x,y,z */
+  float hmax() const { return fmaxf( fmaxf( x, y ), z ); }
+
+  float & operator[]( unsigned int index ) {
+    return (&x)[index];
+  }
+};
+
+
+inline vec3a operator * ( float k, vec3a p ) { return floatx4( k ) * p.v; }
+
+inline vec3a vmin( vec3a a, vec3a b ) { return vmin( a.v, b.v ); }
+inline vec3a vmax( vec3a a, vec3a b ) { return vmax( a.v, b.v ); }
+
+inline vec3a fma( vec3a a, vec3a b, vec3a c ) { return fma( a.v, b.v, c.v ); } /* a%b + c */
+inline vec3a fma( float k, vec3a b, vec3a c ) { return fma( floatx4( k ), b.v, c.v ); } /* k*b + c */
+
+
+// ---------------- vec3x4 and vec3x8 ----------------
+//
+// N vec3s as structure-of-arrays, where F is floatx4 or floatx8.
+// Lane i holds vec3( x[i], y[i], z[i] ).  The "scalar" results (such
+// as dot products) are F's, with one result per lane.
+
+
+template <class F, int N>
+class vec3xN {
+public:
+
+  F x, y, z;
+
+  vec3xN() {}
+
+  vec3xN( F xx, F yy, F zz ) { x = xx; y = yy; z = zz; }
+
+  vec3xN( const vec3 &p ) { x = F( p.x ); y = F( p.y ); z = F( p.z ); } /* same vec3 in all lanes */
+
+  static vec3xN load( const vec3 *p ) { /* from N consecutive vec3s */
+    float xs[N], ys[N], zs[N];
+    for (int i=0; i<N; i++) {
+      xs[i] = p[i].x;
+      ys[i] = p[i].y;
+      zs[i] = p[i].z;
+    }
+    return vec3xN( F::load( xs ), F::load( ys ), F::load( zs ) );
+  }
+
+  vec3 lane( int i ) const { return vec3( x[i], y[i], z[i] ); }
+
+  vec3xN operator + ( const vec3xN &p ) const { return vec3xN( x+p.x, y+p.y, z+p.z ); }
+  vec3xN operator - ( const vec3xN &p ) const { return vec3xN( x-p.x, y-p.y, z-p.z ); }
+  vec3xN operator % ( const vec3xN &p ) const { return vec3xN( x*p.x, y*p.y, z*p.z ); } /* component-wise product */
+
+  F operator * ( const vec3xN &p ) const /* dot product */
+    { return fma( x, p.x, fma( y, p.y, z*p.z ) ); }
+
+  vec3xN operator ^ ( const vec3xN &p ) const /* cross product */
+    { return vec3xN( y*p.z - z*p.y, z*p.x - x*p.z, x*p.y - y*p.x ); }
+
+  F squaredLength() const { return *this * *this; }
+  F length() const { return sqrt( squaredLength() ); }
+
+  vec3xN normalize() const {
+    F s = F(1) / length();
+    return vec3xN( x*s, y*s, z*s );
+  }
+
+  vec3xN normalizeFast() const {
+    F s = rsqrt( squaredLength() );
+    return vec3xN( x*s, y*s, z*s );
+  }
+};
+
+
+typedef vec3xN<floatx4,4> vec3x4;
+typedef vec3xN<floatx8,8> vec3x8;
+
+
+template <class F, int N>
+inline vec3xN<F,N> operator * ( F k, const vec3xN<F,N> &p ) { return vec3xN<F,N>( k*p.x, k*p.y, k*p.z ); }
+
+template <class F, int N>
+inline vec3xN<F,N> vmin( const vec3xN<F,N> &a, const vec3xN<F,N> &b ) { return vec3xN<F,N>( vmin(a.x,b.x), vmin(a.y,b.y), vmin(a.z,b.z) ); }
+
+template <class F, int N>
+inline vec3xN<F,N> vmax( const vec3xN<F,N> &a, const vec3xN<F,N> &b ) { return vec3xN<F,N>( vmax(a.x,b.x), vmax(a.y,b.y), vmax(a.z,b.z) ); }
+
+template <class F, int N>
+inline vec3xN<F,N> select( F mask, const vec3xN<F,N> &a, const vec3xN<F,N> &b ) { return vec3xN<F,N>( select(mask,a.x,b.x), select(mask,a.y,b.y), select(mask,a.z,b.z) ); }
+
+template <class F, int N>
+inline vec3xN<F,N> fma( F k, const vec3xN<F,N> &b, const vec3xN<F,N> &c ) { return vec3xN<F,N>( fma(k,b.x,c.x), fma(k,b.y,c.y), fma(k,b.z,c.z) ); } /* k*b + c */
+
+
 #endif
@@ -9,6 +9,9 @@
  * raytracing the current scene, and draws that as soon as it's done.
  * You can move the viewpoint again, or press a button, and it'll
  * start raytracing again from the new position.
+ *
+ * With -b, no window is opened: one frame is raytraced, the image is
+ * written with -o, and the ray statistics are written as JSON.
  */
 
 
@@ -24,6 +27,7 @@
 #include "gpuProgram.h"
 #include "strokefont.h"
 #include "pixelZoom.h"
+#include "bvh.h"
 
 
 // window dimensions
@@ -42,9 +46,13 @@ StrokeFont *strokeFont;
 
 char *filename[2] = { NULL, NULL }; // from command line
 
+bool  headless = false;         // raytrace one frame without a window (-b)
+char *imageFilename = NULL;     // where to write the headless image (-o)
+char *statsFilename = NULL;     // where to write the headless statistics (-s)
+
 
-void skipComments( istream &in );
 void parseOptions( int argc, char **argv );
+GLFWwindow *initWindow();
 
 
 // Error callback
@@ -73,25 +81,17 @@ void framebufferReshapeCallback( GLFWwindow* window, int width, int height )
 }
 
 
-// Main program
-
+// Initialize the window and its OpenGL context
 
-int main( int argc, char **argv )
+GLFWwindow *initWindow()
 
 {
-  if (argc < 2) {
-    cerr << "Usage: " << argv[0] << " sceneFile ..." << endl;
-    exit(1);
-  }
-
-  // Initialize the window
-
   glfwSetErrorCallback( errorCallback );
   
   GLFWwindow* window;
 
   if (!glfwInit())
-    return 1;
+    return NULL;
   
 #ifdef MACOS
   glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
@@ -108,7 +108,7 @@ int main( int argc, char **argv )
   
   if (!window) {
     glfwTerminate();
-    return 1;
+    return NULL;
   }
 
 #if 0
@@ -122,22 +122,46 @@ int main( int argc, char **argv )
   glfwSetWindowSizeCallback( window, windowReshapeCallback );
   glfwSetFramebufferSizeCallback( window, framebufferReshapeCallback );
 
-  // Fonts
+  return window;
+}
 
-  strokeFont = new StrokeFont();
+
+// Main program
+
+
+int main( int argc, char **argv )
+
+{
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " sceneFile ..." << endl;
+    exit(1);
+  }
 
   // Set up the scene
 
   scene = new Scene(); // must exist before parseOptions() is called
   parseOptions( argc, argv );
 
-  rtWindow = new RTwindow( 20, 50, 1200, 800, filename[0], scene, window ); // production
+  GLFWwindow* window = NULL;
 
-  // rtWindow = new RTwindow( 20, 50, 240, 160, filename[0], scene, window ); // debugging
+  if (!headless) {
 
-  scene->setWindow( rtWindow );
+    window = initWindow();
+    if (window == NULL)
+      return 1;
 
-  pixelZoom = new PixelZoom();
+    // Fonts
+
+    strokeFont = new StrokeFont();
+
+    rtWindow = new RTwindow( 20, 50, 1200, 800, filename[0], scene, window ); // production
+
+    // rtWindow = new RTwindow( 20, 50, 240, 160, filename[0], scene, window ); // debugging
+
+    scene->setWindow( rtWindow );
+
+    pixelZoom = new PixelZoom();
+  }
   
   // Read the scene file
 
@@ -159,6 +183,8 @@ int main( int argc, char **argv )
             *p = '\0';
     }
 
+    srand( scene->randomSeed ); // BVH construction is randomized
+
     scene->read( basename, in );
   }
 
@@ -169,6 +195,24 @@ int main( int argc, char **argv )
     scene->write( out );
   }
 
+  // Without a window, raytrace one frame and output the image and statistics
+
+  if (headless) {
+
+    scene->renderAll();
+
+    if (imageFilename != NULL)
+      scene->writeRTImage( imageFilename );
+
+    if (statsFilename != NULL) {
+      ofstream out( statsFilename );
+      scene->stats.writeJSON( out );
+    } else
+      scene->stats.writeJSON( cout );
+
+    return 0;
+  }
+
   // Main loop
 
   int prevButtonDown = -1;
@@ -243,14 +287,82 @@ void parseOptions( int argc, char **argv )
       scene->glossyIterations = atoi( *argv );
       break;
 
+    case 'c':			// compress the BVHs?
+      BVH::compress = !BVH::compress;
+      break;
+
+    case 'S':			// spatial splits in the BVHs, with a duplication budget
+      argc--; argv++;
+      BVH::splitBudget = atof( *argv );
+      break;
+
+    case 'O':			// optimize the BVHs by reinsertion, for up to this many seconds each
+      argc--; argv++;
+      BVH::optimizeTime = atof( *argv );
+      break;
+
     case 'm':			// use mipMaps?
       Texture::useMipMaps = !Texture::useMipMaps;
       break;
 
+    case 'T':			// texture memory budget (in MB)
+      argc--; argv++;
+      Texture::memoryBudget = (size_t) (atof( *argv ) * 1024 * 1024);
+      break;
+
+    case 'p':			// pixel sampling (# x #)
+      argc--; argv++;
+      scene->numPixelSamples = atoi( *argv );
+      break;
+
+    case 'j':			// jitter the pixel samples?
+      scene->jitter = !scene->jitter;
+      break;
+
+    case 'r':			// resolution as WIDTHxHEIGHT
+      argc--; argv++;
+      if (sscanf( *argv, "%dx%d", &windowWidth, &windowHeight ) != 2) {
+	cerr << "Resolution should be given as WIDTHxHEIGHT, not " << *argv << endl;
+	exit(1);
+      }
+      break;
+
+    case 'R':			// random seed
+      argc--; argv++;
+      scene->randomSeed = strtoul( *argv, NULL, 10 );
+      break;
+
+    case 'b':			// batch: raytrace one frame without a window
+      headless = true;
+      break;
+
+    case 'o':			// output image (with -b)
+      argc--; argv++;
+      imageFilename = *argv;
+      break;
+
+    case 's':			// output statistics as JSON (with -b)
+      argc--; argv++;
+      statsFilename = *argv;
+      break;
+
     default:
       cerr << "Unrecognized option -" << argv[0][1] << ".  Options are:" << endl;
       cerr << "  -d #   set max depth\n" << endl;
       cerr << "  -t     toggle texture transparency\n" << endl;
+      cerr << "  -g #   send at most # rays for a glossy reflection\n" << endl;
+      cerr << "  -p #   set pixel sampling to # x #\n" << endl;
+      cerr << "  -j     toggle pixel sample jittering\n" << endl;
+      cerr << "  -m     toggle mipmapped texture filtering in the ray tracer\n" << endl;
+      cerr << "  -T MB  limit the ray tracer's texture pages to MB megabytes\n" << endl;
+      cerr << "  -c     toggle compressed 8-wide BVH nodes\n" << endl;
+      cerr << "  -S f   build BVHs with spatial splits, allowing f extra references per triangle (e.g. 0.3)\n" << endl;
+      cerr << "  -O s   after building each BVH, optimize it for up to s seconds\n" << endl;
+      cerr << "  -r WxH set the window resolution\n" << endl;
+      cerr << "  -R #   set the random seed\n" << endl;
+      cerr << "  -b     raytrace one frame without a window\n" << endl;
+      cerr << "  -o f   with -b, write the image to PPM file f\n" << endl;
+      cerr << "  -s f   with -b, write the statistics as JSON to f (default stdout)\n" << endl;
       break;
     }
   }
@@ -261,67 +373,3 @@ void parseOptions( int argc, char **argv )
   }
 }
 
-
-// Skip past a comment
-
-int lineNum = 1;
-
-void skipComments( istream &in )
-
-{
-  char c;
-
-  // get next non-space
-
-  do {
-    in.get(c);
-    if (c == '\n')
-      lineNum++;
-  } while (in && isspace(c));
-  in.putback(c);
-
-  // Skip past any comments
-
-  while (c == '#') {
-    do
-      in.get(c);
-    while (in && c != '\n');
-    lineNum++;
-    do {
-      in.get(c);
-      if (c == '\n')
-	lineNum++;
-    } while (in && isspace(c));
-    in.putback(c);
-  }
-}
-
-
-
-float getTime()
-
-{
-  static time_t initialSeconds = 0;  // subtract this from times to avoid loss of float precision
-  
-#ifdef _WIN32
-
-  struct timeb thisTime;
-  ftime( &thisTime );
-
-  if (initialSeconds == 0)
-    initialSeconds = thisTime.time;
-
-  return (thisTime.time-initialSeconds) + thisTime.millitm / 1000.0;
-
-#else
-
-  struct timeval thisTime;
-  gettimeofday( &thisTime, NULL );
-
-  if (initialSeconds == 0)
-    initialSeconds = thisTime.tv_sec;
-
-  return (thisTime.tv_sec-initialSeconds) + thisTime.tv_usec / 1000000.0;
-
-#endif
-}
@@ -22,7 +22,7 @@ void Material::setMaterialForOpenGL( GPUProgram *gpuProg )
     // Always use texture unit 0 for the object texture
       
     glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_2D, texture->textureID );
+    glBindTexture( GL_TEXTURE_2D, texture->texID() );
     gpuProg->setInt( "objTexture", 0 );
 
     if (texture->hasAlpha) {
@@ -36,6 +36,53 @@ void Material::setMaterialForOpenGL( GPUProgram *gpuProg )
 }
 
 
+// Find the features of the material.  The texture must have been read
+// (as by Texture::finishLoads()) to know whether it has alpha.
+
+void Material::findFeatures()
+
+{
+  features = 0;
+
+  if (texture != NULL) {
+    features |= MAT_TEXTURED;
+    if (texture->hasAlpha)
+      features |= MAT_ALPHA_TEXTURE;
+  }
+
+  if (ks.x > 0 || ks.y > 0 || ks.z > 0)
+    features |= MAT_SPECULAR;
+
+  if (alpha < 1)
+    features |= MAT_TRANSPARENT;
+
+  if (Ie.x != 0 || Ie.y != 0 || Ie.z != 0)
+    features |= MAT_EMISSIVE;
+
+  if (bumpMap != NULL)
+    features |= MAT_BUMP_MAPPED;
+
+  if (g < 1)
+    features |= MAT_GLOSSY;
+}
+
+
+
+// Get a texture file in directory 'basename' from the shared textures
+
+static Texture *loadTexture( const char *basename, const char *filename )
+
+{
+  char *path = new char[ strlen(filename) + strlen(basename) + 2 ];
+  sprintf( path, "%s/%s", basename, filename );
+  cout << path << endl;
+
+  Texture *t = Texture::load( path );
+
+  delete [] path;
+  return t;
+}
+
 
 ostream& operator << ( ostream& stream, Material const& mat )
 
@@ -49,7 +96,9 @@ ostream& operator << ( ostream& stream, Material const& mat )
 	 << "  " << mat.g << endl
 	 << "  " << mat.Ie << endl
 	 << "  " << mat.alpha << endl
-	 << "  " << mat.texName << endl;
+	 << "  " << mat.texName << endl
+	 << "  " << mat.bumpMapName << endl
+	 << "  " << mat.ior << endl;
   
   return stream;
 }
@@ -70,6 +119,14 @@ istream& operator >> ( istream& stream, Material & mat )
   skipComments( stream );  stream >> texName;
   skipComments( stream );  stream >> bumpName;
 
+  // An index of refraction may follow.  Without one (as in older
+  // scene files) the default is kept.
+
+  skipComments( stream );
+  int c = stream.peek();
+  if (isdigit(c) || c == '.')
+    stream >> mat.ior;
+
   mat.name = strdup( matName );
 
   // Check that ks + kd <= 1
@@ -80,6 +137,11 @@ istream& operator >> ( istream& stream, Material & mat )
     exit(1);
   }
 
+  if (mat.ior <= 0) {
+    cerr << "ERROR: Material " << matName << " has index of refraction " << mat.ior << ", which should be positive." << endl;
+    exit(1);
+  }
+
   // Store the TEXTURE with the material
 
   if (texName[0] == '-' && texName[1] == '\0') {
@@ -89,25 +151,8 @@ istream& operator >> ( istream& stream, Material & mat )
 
   } else {
 
-    // Search for this texture
-
-    int i;
-    for (i=0; i<scene->textures.size(); i++)
-      if (strcmp( texName, scene->textures[i]->name ) == 0)
-	break;
-
-    // Create the texture if it's not already loaded
-    
-    if (i == scene->textures.size()) {
-      char *path = new char[ strlen(texName) + strlen(mat.basename) + 2 ];
-      sprintf( path, "%s/%s", mat.basename, texName );
-      cout << path << endl;
-      scene->textures.add( new Texture( path ) );
-      delete [] path;
-    }
-
-    mat.texture = scene->textures[ i ];
-    mat.texName = texName;
+    mat.texture = loadTexture( mat.basename, texName );
+    mat.texName = strdup( texName );
   }
 
   // Store the BUMP MAP with the material
@@ -119,26 +164,11 @@ istream& operator >> ( istream& stream, Material & mat )
 
   } else {
 
-    // Search for this texture (bump maps and textures are
-    // stored in the same way ... it's only their use that
-    // differs).
-
-    int i;
-    for (i=0; i<scene->textures.size(); i++)
-      if (strcmp( texName, scene->textures[i]->name ) == 0)
-	break;
-
-    // Create the texture if it's not already loaded
-    
-    if (i == scene->textures.size()) {
-      char *path = new char[ strlen(texName) + strlen(mat.basename) + 2 ];
-      sprintf( path, "%s/%s", mat.basename, texName );
-      scene->textures.add( new Texture( bumpName ) );
-      delete [] path;
-    }
-
-    mat.bumpMap = scene->textures[ i ];
-    mat.bumpMapName = bumpName;
+    // Bump maps and textures are stored in the same way ... it's
+    // only their use that differs.
+
+    mat.bumpMap = loadTexture( mat.basename, bumpName );
+    mat.bumpMapName = strdup( bumpName );
   }
 
   return stream;
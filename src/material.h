@@ -11,8 +11,26 @@
 #include "gpuProgram.h"
 
 
+// Features of a material, in Material::features.  The ray tracer
+// shades each combination of the MAT_SHADING_FEATURES with its own
+// kernel, which does no work for the features that are absent.
+
+#define MAT_TEXTURED         0x01   // has a texture map
+#define MAT_ALPHA_TEXTURE    0x02   // ... with an alpha channel, so the opacity varies
+#define MAT_SPECULAR         0x04   // ks > 0
+#define MAT_TRANSPARENT      0x08   // alpha < 1
+#define MAT_EMISSIVE         0x10   // Ie != 0
+#define MAT_BUMP_MAPPED      0x20   // has a bump map
+#define MAT_GLOSSY           0x40   // g < 1 (checked per hit, not by kernel)
+
+#define MAT_SHADING_FEATURES 0x1f
+
+
 class Material {
 
+  Material( const Material & );	// not copyable, as it holds texture references
+  Material & operator = ( const Material & );
+
  public:
 
   const char *name;                 // material name
@@ -27,8 +45,11 @@ class Material {
   float   g;                    // glossiness in range 1 (a mirror) to 0 (a very rough surface)
   vec3  Ie;                   // emitted light
   float   alpha;                // opacity in [0,1] with 1 = opaque
-  Texture *texture;             // texture map (= NULL if none)
-  Texture *bumpMap;             // bump map (= NULL if none)
+  float   ior;                  // index of refraction of the inside (relative to the outside)
+  Texture *texture;             // texture map (= NULL if none), with a reference held by this material
+  Texture *bumpMap;             // bump map (= NULL if none), with a reference held by this material
+
+  unsigned int features;        // MAT_TEXTURED, etc., as of the last findFeatures()
 
   Material() {
     setDefault(); 
@@ -39,8 +60,17 @@ class Material {
     this->basename = strdup(basename);
   }
 
+  ~Material() {
+    if (texture != NULL)
+      texture->release();
+    if (bumpMap != NULL)
+      bumpMap->release();
+  }
+
   void setMaterialForOpenGL( GPUProgram *gpuProg );
 
+  void findFeatures();          // after a change, and after the textures are read
+
   void setDefault() {
     name = "";
     texName = "";
@@ -52,9 +82,11 @@ class Material {
     g = 0.999;
     Ie = vec3(0,0,0);
     alpha = 1.0;
+    ior = 1.5;                  // glass in air
     texture = NULL;
     bumpMap = NULL;
     basename = ".";
+    findFeatures();
   }
 
   friend ostream& operator << ( ostream& stream, Material const& m );
@@ -8,6 +8,7 @@
 #include "linalg.h"
 #include "material.h"
 #include "gpuProgram.h"
+#include "ray.h"
 
 
 class Object {
@@ -18,10 +19,16 @@ class Object {
 
   Object() {}
 
-  virtual bool rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxParam,
+  // Find the closest intersection with t in [ray.tmin,ray.tmax].  If
+  // this object is ray.originObj, ignore its part ray.originPart.
+
+  virtual bool rayInt( Ray &ray,
 		       vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material * &mat, int &intPartIndex ) = 0;
 
-  virtual vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords ) {
+  // Find the texture colour at point p, averaged over a region about
+  // 'footprint' wide (in world units) if the texture is filtered.
+
+  virtual vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint ) {
     alpha = 1;
     return vec3(1,1,1);
   }
@@ -0,0 +1,86 @@
+/* ray.h
+ *
+ * A ray, as passed to the intersection routines.
+ *
+ *   PUBLIC VARIABLES
+ *
+ *     origin, dir         The ray is origin + t dir
+ *     invDir              1/dir per component (+/- inf for a zero component)
+ *     sign[i]             1 iff invDir[i] < 0, to pick the near and far slab of a box
+ *     tmin, tmax          Only intersections with t in [tmin,tmax] are reported
+ *     kind                What the ray is for (primary, shadow, ...)
+ *     originObj           The object from which the ray starts, or NULL
+ *     originPart          The part of originObj (e.g. the triangle) from which the ray starts, or -1
+ *     coneWidth           Width of the ray's cone at its origin (for texture filtering)
+ *     coneSpread          Growth of the cone's width per unit of t
+ *
+ * invDir and sign are computed once, in the constructor, so that the
+ * many ray/box tests of a BVH traversal need no divisions.  If 'dir'
+ * is changed, call setDir().
+ *
+ * The cone approximates the region of the scene that the ray
+ * represents, such as the part of a pixel that a primary ray samples.
+ * It is zero (a thin ray) unless set.
+ *
+ * Intersection routines receive a Ray by reference.  A routine that
+ * finds several intersections along the way (like a BVH traversal)
+ * may shrink tmax to the closest intersection found so far.
+ */
+
+
+#ifndef RAY_H
+#define RAY_H
+
+#include "linalg.h"
+#include <cfloat>
+
+
+class Object;
+
+
+enum RayKind { PRIMARY_RAY, REFLECTION_RAY, REFRACTION_RAY, SHADOW_RAY };
+
+
+class Ray {
+
+ public:
+
+  vec3    origin;
+  vec3    dir;
+  vec3    invDir;
+  int     sign[3];
+  float   tmin, tmax;
+  RayKind kind;
+  Object *originObj;
+  int     originPart;
+  float   coneWidth, coneSpread;
+
+  Ray() {}
+
+  Ray( vec3 o, vec3 d, RayKind k, Object *obj = NULL, int part = -1 ) {
+    origin = o;
+    setDir( d );
+    tmin = 0;
+    tmax = FLT_MAX;
+    kind = k;
+    originObj = obj;
+    originPart = part;
+    coneWidth = 0;
+    coneSpread = 0;
+  }
+
+  void setDir( vec3 d ) {
+    dir = d;
+    invDir = vec3( 1.0f / d.x, 1.0f / d.y, 1.0f / d.z ); // division by zero gives IEEE inf, as intended
+    sign[0] = (invDir.x < 0);
+    sign[1] = (invDir.y < 0);
+    sign[2] = (invDir.z < 0);
+  }
+
+  vec3 at( float t ) {
+    return origin + t * dir;
+  }
+};
+
+
+#endif
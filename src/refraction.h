@@ -0,0 +1,78 @@
+/* refraction.h
+ *
+ * Refraction of a ray at a surface between two media.
+ *
+ *   refract( I, N, ior, T, reflectance )
+ *
+ *     I            unit direction in which the ray arrives
+ *     N            unit outward normal of the surface
+ *     ior          index of refraction of the inside of the surface
+ *                  (behind N) relative to the outside
+ *     T            returns the unit direction of the refracted ray
+ *     reflectance  returns the fraction of the light that the surface
+ *                  reflects; the rest is refracted
+ *
+ *   Returns false if there's total internal reflection, in which case
+ *   T is not set and reflectance is 1.
+ *
+ * A ray with I * N < 0 is entering the inside; otherwise it's leaving.
+ * N is not changed in either case.
+ *
+ * T comes from the vector form of Snell's law,
+ *
+ *     T = eta I + (eta cosI - cosT) N'
+ *
+ * where eta = n1/n2, N' is the normal on the side of I's origin,
+ * cosI = -I.N', and cosT = sqrt( 1 - eta^2 (1 - cosI^2) ), so it needs
+ * one sqrt and no trig.  The reflectance is Schlick's approximation of
+ * the Fresnel equations, using the cosine of the angle in the less
+ * dense medium.
+ */
+
+
+#ifndef REFRACTION_H
+#define REFRACTION_H
+
+#include "linalg.h"
+
+
+inline bool refract( vec3 const &I, vec3 const &N, float ior, vec3 &T, float &reflectance )
+
+{
+  float cosI = -(I * N);
+  float eta, sign;
+
+  if (cosI >= 0) {		// entering
+    eta  = 1 / ior;
+    sign = 1;
+  } else {			// leaving, so N' = -N
+    eta  = ior;
+    sign = -1;
+    cosI = -cosI;
+  }
+
+  float k = 1 - eta*eta * (1 - cosI*cosI);
+
+  if (k < 0) {			// total internal reflection
+    reflectance = 1;
+    return false;
+  }
+
+  float cosT = sqrt( k );
+  float s = sign * (eta * cosI - cosT);
+
+  T = vec3( eta*I.x + s*N.x, eta*I.y + s*N.y, eta*I.z + s*N.z );
+
+  float r0 = (eta - 1) / (eta + 1);
+  r0 = r0 * r0;
+
+  float m  = 1 - (eta <= 1 ? cosI : cosT);
+  float m2 = m * m;
+
+  reflectance = r0 + (1 - r0) * m2 * m2 * m;
+
+  return true;
+}
+
+
+#endif
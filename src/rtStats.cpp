@@ -0,0 +1,172 @@
+// rtStats.cpp
+
+
+#include <chrono>
+#include <iomanip>
+#include "rtStats.h"
+
+#ifndef _WIN32
+  #include <sys/resource.h>
+#endif
+
+
+thread_local RTStats threadStats;
+
+
+void RTStats::clear()
+
+{
+  primaryRays     = 0;
+  reflectionRays  = 0;
+  refractionRays  = 0;
+  shadowRays      = 0;
+
+  bvhNodesVisited = 0;
+  rayBoxTests     = 0;
+  triangleTests   = 0;
+  triangleHits    = 0;
+  sphereTests     = 0;
+
+  texPageHits      = 0;
+  texPagesMade     = 0;
+  texPageEvictions = 0;
+
+  traceTime       = 0;
+  frameTime       = 0;
+  numPixels       = 0;
+}
+
+
+void RTStats::add( RTStats &s )
+
+{
+  primaryRays     += s.primaryRays;
+  reflectionRays  += s.reflectionRays;
+  refractionRays  += s.refractionRays;
+  shadowRays      += s.shadowRays;
+
+  bvhNodesVisited += s.bvhNodesVisited;
+  rayBoxTests     += s.rayBoxTests;
+  triangleTests   += s.triangleTests;
+  triangleHits    += s.triangleHits;
+  sphereTests     += s.sphereTests;
+
+  texPageHits      += s.texPageHits;
+  texPagesMade     += s.texPagesMade;
+  texPageEvictions += s.texPageEvictions;
+
+  traceTime       += s.traceTime;
+  numPixels       += s.numPixels;
+}
+
+
+// Print in a human-readable form
+
+void RTStats::print( ostream &out )
+
+{
+  double rays = (double) totalRays();
+
+#if !RT_STATS
+  out << "(counters were compiled out with RT_STATS=0)" << endl;
+#endif
+
+  out << "rays:      " << primaryRays << " primary, "
+      << reflectionRays << " reflection, "
+      << refractionRays << " refraction, "
+      << shadowRays << " shadow" << endl
+      << "BVH:       " << bvhNodesVisited << " nodes visited, "
+      << rayBoxTests << " box tests" << endl
+      << "triangles: " << triangleTests << " tests, "
+      << triangleHits << " hits" << endl
+      << "spheres:   " << sphereTests << " tests" << endl;
+
+  if (texPagesMade > 0)
+    out << "textures:  " << texPageHits << " page hits, "
+	<< texPagesMade << " pages made, "
+	<< texPageEvictions << " evictions, "
+	<< texBytes / (1024.0 * 1024.0) << " MB resident" << endl;
+
+  if (rays > 0)
+    out << "per ray:   "
+	<< setprecision(3) << bvhNodesVisited / rays << " nodes, "
+	<< rayBoxTests / rays << " box tests, "
+	<< triangleTests / rays << " triangle tests" << setprecision(6) << endl;
+
+  out << "time:      "
+      << loadTime << " s load ("
+      << bvhBuildTime << " s BVH build), "
+      << traceTime << " s trace, "
+      << frameTime << " s frame";
+
+  if (traceTime > 0)
+    out << ", " << rays / traceTime / 1.0e6 << " Mrays/s";
+
+  out << endl;
+
+  if (peakRSS > 0 || bvhBytes > 0)
+    out << "memory:    " << peakRSS / 1024.0 << " MB peak RSS, "
+	<< bvhBytes / (1024.0 * 1024.0) << " MB BVH" << endl;
+}
+
+
+// Write as a JSON object
+
+void RTStats::writeJSON( ostream &out )
+
+{
+  out << "{" << endl
+      << "  \"pixels\": " << numPixels << "," << endl
+      << "  \"rays\": {" << endl
+      << "    \"primary\": " << primaryRays << "," << endl
+      << "    \"reflection\": " << reflectionRays << "," << endl
+      << "    \"refraction\": " << refractionRays << "," << endl
+      << "    \"shadow\": " << shadowRays << "," << endl
+      << "    \"total\": " << totalRays() << endl
+      << "  }," << endl
+      << "  \"bvhNodesVisited\": " << bvhNodesVisited << "," << endl
+      << "  \"rayBoxTests\": " << rayBoxTests << "," << endl
+      << "  \"triangleTests\": " << triangleTests << "," << endl
+      << "  \"triangleHits\": " << triangleHits << "," << endl
+      << "  \"sphereTests\": " << sphereTests << "," << endl
+      << "  \"texPageHits\": " << texPageHits << "," << endl
+      << "  \"texPagesMade\": " << texPagesMade << "," << endl
+      << "  \"texPageEvictions\": " << texPageEvictions << "," << endl
+      << "  \"texBytes\": " << texBytes << "," << endl
+      << "  \"peakRSSkB\": " << peakRSS << "," << endl
+      << "  \"bvhBytes\": " << bvhBytes << "," << endl
+      << "  \"time\": {" << endl
+      << "    \"load\": " << loadTime << "," << endl
+      << "    \"bvhBuild\": " << bvhBuildTime << "," << endl
+      << "    \"trace\": " << traceTime << "," << endl
+      << "    \"frame\": " << frameTime << endl
+      << "  }" << endl
+      << "}" << endl;
+}
+
+
+double RTStats::now()
+
+{
+  return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+long RTStats::peakRSSkB()
+
+{
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage usage;
+
+  if (getrusage( RUSAGE_SELF, &usage ) != 0)
+    return 0;
+
+  #ifdef MACOS
+    return usage.ru_maxrss / 1024; // bytes on MacOS
+  #else
+    return usage.ru_maxrss;        // kB on Linux
+  #endif
+#endif
+}
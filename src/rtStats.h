@@ -0,0 +1,102 @@
+// rtStats.h
+//
+// Counters for the raytracing hot paths.
+//
+// Each thread increments its own 'threadStats' with STAT_INC(), so
+// the counters cost one unsynchronized increment each.  At the end
+// of a frame the per-thread counts are added into a frame total with
+// RTStats::add() and the per-thread counts are cleared.
+//
+// Compile with -DRT_STATS=0 to remove the counters entirely.
+
+
+#ifndef RTSTATS_H
+#define RTSTATS_H
+
+
+#include <iostream>
+#include <cstddef>
+
+using namespace std;
+
+
+#ifndef RT_STATS
+  #define RT_STATS 1
+#endif
+
+
+class RTStats {
+
+ public:
+
+  // rays by kind
+
+  unsigned long long primaryRays;
+  unsigned long long reflectionRays;
+  unsigned long long refractionRays;
+  unsigned long long shadowRays;
+
+  // intersection work
+
+  unsigned long long bvhNodesVisited;   // BVH nodes entered in rayIntBVH()
+  unsigned long long rayBoxTests;       // ray/box tests in BVH::rayBoxInt() and BVH::rayBoxIntCBVH()
+  unsigned long long triangleTests;     // calls to BVH::triangleInt() and Triangle::rayInt()
+  unsigned long long triangleHits;      // ... that returned an intersection
+  unsigned long long sphereTests;       // calls to Sphere::rayInt()
+
+  // texture pages
+
+  unsigned long long texPageHits;       // page lookups that found the page resident
+  unsigned long long texPagesMade;      // texture pages made when first sampled, or again after eviction
+  unsigned long long texPageEvictions;  // pages evicted to stay within Texture::memoryBudget
+
+  // time per phase (in seconds)
+
+  double loadTime;              // reading the scene (includes BVH build)
+  double bvhBuildTime;          // building all BVHs
+  size_t bvhBytes;              // memory of all BVHs
+  size_t texBytes;              // memory of resident texture pages at the end of the last frame
+  double traceTime;             // tracing pixels in the last frame
+  double frameTime;             // wall-clock time of the last frame
+
+  int    numPixels;             // pixels traced in the last frame
+
+  long   peakRSS;               // peak resident set size of the process (in kB) at the end of the last frame
+
+  RTStats() {
+    clear();
+    loadTime = 0;
+    bvhBuildTime = 0;
+    bvhBytes = 0;
+    texBytes = 0;
+    peakRSS = 0;
+  }
+
+  void clear();                 // clear the per-frame counts (but not the load and build times)
+  void add( RTStats &s );       // add the per-frame counts and trace time of 's' to these
+
+  unsigned long long totalRays() {
+    return primaryRays + reflectionRays + refractionRays + shadowRays;
+  }
+
+  void print( ostream &out );
+  void writeJSON( ostream &out );
+
+  static double now();          // high-resolution time in seconds
+  static long peakRSSkB();      // peak resident set size of this process in kB (0 if unknown)
+};
+
+
+extern thread_local RTStats threadStats; // counters of this thread
+
+
+#if RT_STATS
+  #define STAT_INC(counter) (threadStats.counter++)
+  #define STAT_ADD(counter,n) (threadStats.counter += (n))
+#else
+  #define STAT_INC(counter)
+  #define STAT_ADD(counter,n)
+#endif
+
+
+#endif
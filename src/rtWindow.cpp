@@ -73,7 +73,7 @@ void RTwindow::keyCallback( GLFWwindow* window, int key, int scancode, int actio
     case '+':
     case '=':
       scene->numRaySamples *= sqrt(2);
-      cout << "num samples " << scene->maxDepth << endl; 
+      cout << "glossy samples " << scene->numGlossySamples() << endl; 
       viewpointChanged = true;
       redisplay = true;
       break;
@@ -83,7 +83,7 @@ void RTwindow::keyCallback( GLFWwindow* window, int key, int scancode, int actio
       scene->numRaySamples /= sqrt(2);
       if (scene->numRaySamples < 1) 
 	scene->numRaySamples = 1;
-      cout << "num samples " << scene->maxDepth << endl; 
+      cout << "glossy samples " << scene->numGlossySamples() << endl; 
       viewpointChanged = true;
       redisplay = true;
       break;
@@ -125,6 +125,20 @@ void RTwindow::keyCallback( GLFWwindow* window, int key, int scancode, int actio
       cout << "jittering " << (scene->jitter ? "on" : "off") << endl;
       break;
 
+    case 'S':
+      cout << endl << "---- statistics of the last completed frame ----" << endl;
+      scene->stats.print( cout );
+      break;
+
+    case 'H': {
+      const char *modeNames[] = { "off", "BVH cost of primary rays", "BVH cost of whole ray tree" };
+      scene->heatMap = (scene->heatMap + 1) % NUM_HEAT_MAP_MODES;
+      viewpointChanged = true;
+      redisplay = true;
+      cout << "heat map " << modeNames[scene->heatMap] << endl;
+      break;
+    }
+
     case 'R':
       scene->russianRoulette = !scene->russianRoulette;
       redisplay = true;
@@ -137,9 +151,14 @@ void RTwindow::keyCallback( GLFWwindow* window, int key, int scancode, int actio
 	<< "P     increase pixel sampling" << endl
 	<< "p     decrease pixel sampling" << endl
 	<< "j     toggle pixel sample jittering" << endl
+	<< "+/-   increase/decrease glossy reflection samples" << endl
+	<< "G     double glossy roughness" << endl
+	<< "g     halve glossy roughness" << endl
 	<< "a     show/hide axes" << endl
 	<< "e     output eye position" << endl
 	<< "z     toggle pixel zooming (then click or click-and-drag mouse on pixels)" << endl
+	<< "s     print ray and intersection statistics of the last frame" << endl
+	<< "h     cycle BVH heat map: off, primary rays, whole ray tree" << endl
 	<< "DEL   delete debugging rays" << endl
 	<< "ESC   exit" << endl
 	<< endl
@@ -0,0 +1,458 @@
+// sbvh.cpp
+//
+// A spatial-split BVH builder, after Stich, Friedrich, and Dietrich,
+// "Spatial Splits in Bounding Volume Hierarchies", HPG 2009.
+//
+// This is used instead of the k-means builder if BVH::splitBudget > 0.
+//
+// Each node is split in two by the binned surface area heuristic
+// (SAH), either by partitioning its triangle references (an "object
+// split") or by cutting space with a plane and clipping the
+// references that straddle it (a "spatial split").  A spatial split
+// is tried only where the best object split leaves overlapping
+// children, as happens with large or long, thin triangles.
+//
+// After spatial splits, a triangle can be referenced by several
+// leaves, each of which has a box around only its part of the
+// triangle.  The traversal needs no change: the second time a ray
+// tests the same triangle, the hit is not closer than ray.tmax, so it
+// is not reported again.
+//
+// The number of extra references is limited to 'splitBudget' times
+// the number of triangles.
+//
+// The binary tree is finally widened so that nodes have up to
+// BVH_MAX_CHILDREN children, like those of the k-means builder.
+
+
+#include "bvh.h"
+
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+#define SBVH_BINS            16     // bins per axis for both kinds of split
+#define SBVH_MIN_OVERLAP   1e-5     // try a spatial split if the object split children overlap by more than this fraction of the root's area
+#define SBVH_NODE_COST     0.5      // SAH cost of visiting a node, relative to a triangle test
+
+
+// Build the whole tree
+
+void BVH::buildSpatialTree()
+
+{
+  int n = numTriangles();
+
+  SBVH_ref *refs = scratchArena.alloc<SBVH_ref>( n );
+
+  BBox rootBox = BBox::empty();
+
+  for (int i=0; i<n; i++) {
+    refs[i].box = triangleBBox( i );
+    refs[i].triangle = i;
+    rootBox.include( refs[i].box );
+  }
+
+  sbvhBudget = (int) (splitBudget * n);
+  sbvhRootArea = rootBox.surfaceArea();
+
+  root = buildSpatialSubtree( refs, n );
+
+  widenSubtree( root );
+}
+
+
+// A leaf whose box is around the references' boxes, which may be
+// smaller than the triangles' boxes
+
+BVH_node * BVH::makeSpatialLeaf( SBVH_ref *refs, int numRefs )
+
+{
+  BVH_node *n = nodeArena.alloc<BVH_node>();
+
+  n->isLeaf    = true;
+  n->count     = numRefs;
+  n->triangles = nodeArena.alloc<int>( numRefs );
+  n->bbox      = BBox::empty();
+
+  for (int i=0; i<numRefs; i++) {
+    n->triangles[i] = refs[i].triangle;
+    n->bbox.include( refs[i].box );
+  }
+
+  return n;
+}
+
+
+// Build the subtree of refs[0..numRefs-1].  The refs are reordered.
+
+BVH_node * BVH::buildSpatialSubtree( SBVH_ref *refs, int numRefs )
+
+{
+  if (numRefs == 1)
+    return makeSpatialLeaf( refs, numRefs );
+
+  BBox nodeBox = BBox::empty();
+  BBox centroidBox = BBox::empty();
+
+  for (int i=0; i<numRefs; i++) {
+    nodeBox.include( refs[i].box );
+    centroidBox.include( 0.5 * (refs[i].box.min + refs[i].box.max) );
+  }
+
+  // ---- Best object split ----
+  //
+  // References are binned by their box centroids.  Plane i is
+  // between bins i and i+1.
+
+  float bestObjectCost = MAXFLOAT;
+  int   bestObjectAxis = -1;
+  int   bestObjectPlane = 0;
+  BBox  bestObjectOverlap = BBox::empty();
+
+  for (int axis=0; axis<3; axis++) {
+
+    float lo = centroidBox.min[axis];
+    float extent = centroidBox.max[axis] - lo;
+
+    if (extent <= 0)
+      continue;
+
+    BBox binBox[SBVH_BINS];
+    int  binCount[SBVH_BINS];
+
+    for (int b=0; b<SBVH_BINS; b++) {
+      binBox[b] = BBox::empty();
+      binCount[b] = 0;
+    }
+
+    for (int i=0; i<numRefs; i++) {
+      vec3 c = 0.5 * (refs[i].box.min + refs[i].box.max);
+      int b = MIN( SBVH_BINS-1, (int) ((c[axis] - lo) / extent * SBVH_BINS) );
+      binBox[b].include( refs[i].box );
+      binCount[b]++;
+    }
+
+    // Sweep from the right to get the box and count right of each plane
+
+    BBox rightBox[SBVH_BINS];
+    int  rightCount[SBVH_BINS];
+
+    BBox box = BBox::empty();
+    int count = 0;
+
+    for (int b=SBVH_BINS-1; b>0; b--) {
+      box.include( binBox[b] );
+      count += binCount[b];
+      rightBox[b-1] = box;
+      rightCount[b-1] = count;
+    }
+
+    box = BBox::empty();
+    count = 0;
+
+    for (int plane=0; plane<SBVH_BINS-1; plane++) {
+      box.include( binBox[plane] );
+      count += binCount[plane];
+      if (count == 0 || rightCount[plane] == 0)
+	continue;
+      float cost = box.surfaceArea() * count + rightBox[plane].surfaceArea() * rightCount[plane];
+      if (cost < bestObjectCost) {
+	bestObjectCost = cost;
+	bestObjectAxis = axis;
+	bestObjectPlane = plane;
+	bestObjectOverlap = box.intersect( rightBox[plane] );
+      }
+    }
+  }
+
+  // ---- Best spatial split ----
+  //
+  // Each reference is clipped to every bin that it overlaps.  A
+  // reference is counted as entering its first bin and exiting its
+  // last.  Plane i is between bins i and i+1.
+
+  float bestSpatialCost = MAXFLOAT;
+  int   bestSpatialAxis = -1;
+  float bestSpatialPos = 0;
+
+  bool trySpatial = (sbvhBudget > 0 &&
+		     (bestObjectAxis < 0 || bestObjectOverlap.surfaceArea() > SBVH_MIN_OVERLAP * sbvhRootArea));
+
+  for (int axis=0; axis<3 && trySpatial; axis++) {
+
+    float lo = nodeBox.min[axis];
+    float binWidth = (nodeBox.max[axis] - lo) / SBVH_BINS;
+
+    if (binWidth <= 0)
+      continue;
+
+    BBox binBox[SBVH_BINS];
+    int  entries[SBVH_BINS], exits[SBVH_BINS];
+
+    for (int b=0; b<SBVH_BINS; b++) {
+      binBox[b] = BBox::empty();
+      entries[b] = exits[b] = 0;
+    }
+
+    for (int i=0; i<numRefs; i++) {
+
+      SBVH_ref &r = refs[i];
+
+      int first = MAX( 0, MIN( SBVH_BINS-1, (int) ((r.box.min[axis] - lo) / binWidth) ) );
+      int last  = MAX( 0, MIN( SBVH_BINS-1, (int) ((r.box.max[axis] - lo) / binWidth) ) );
+
+      if (first == last)
+	binBox[first].include( r.box );
+      else
+	for (int b=first; b<=last; b++) {
+	  float binLo = (b == first ? r.box.min[axis] : lo + b * binWidth);
+	  float binHi = (b == last  ? r.box.max[axis] : lo + (b+1) * binWidth);
+	  binBox[b].include( clipTriangle( r.triangle, axis, binLo, binHi ).intersect( r.box ) );
+	}
+
+      entries[first]++;
+      exits[last]++;
+    }
+
+    BBox rightBox[SBVH_BINS];
+    int  rightCount[SBVH_BINS];
+
+    BBox box = BBox::empty();
+    int count = 0;
+
+    for (int b=SBVH_BINS-1; b>0; b--) {
+      box.include( binBox[b] );
+      count += exits[b];
+      rightBox[b-1] = box;
+      rightCount[b-1] = count;
+    }
+
+    box = BBox::empty();
+    count = 0;
+
+    for (int plane=0; plane<SBVH_BINS-1; plane++) {
+
+      box.include( binBox[plane] );
+      count += entries[plane];
+
+      int numLeft = count;
+      int numRight = rightCount[plane];
+
+      if (numLeft == 0 || numRight == 0 || (numLeft == numRefs && numRight == numRefs))
+	continue;
+
+      if (numLeft + numRight - numRefs > sbvhBudget)
+	continue;
+
+      float cost = box.surfaceArea() * numLeft + rightBox[plane].surfaceArea() * numRight;
+      if (cost < bestSpatialCost) {
+	bestSpatialCost = cost;
+	bestSpatialAxis = axis;
+	bestSpatialPos = lo + (plane+1) * binWidth;
+      }
+    }
+  }
+
+  // A small node becomes a leaf if no split is cheaper
+
+  float bestCost = MIN( bestObjectCost, bestSpatialCost );
+
+  if (numRefs <= BVH_MAX_LEAF_SIZE &&
+      numRefs * nodeBox.surfaceArea() <= SBVH_NODE_COST * nodeBox.surfaceArea() + bestCost)
+    return makeSpatialLeaf( refs, numRefs );
+
+  // ---- Partition the references ----
+  //
+  // Left references go at the start of 'refs', and right references
+  // go into 'rightRefs'.  The left references stay in 'refs' while
+  // the left subtree is built, so the right ones are copied away.
+
+  Arena::Mark scratchMark = scratchArena.mark();
+
+  SBVH_ref *leftRefs = refs;
+  SBVH_ref *rightRefs;
+  int numLeft = 0, numRight = 0;
+
+  if (bestSpatialAxis >= 0 && bestSpatialCost < bestObjectCost) {
+
+    int axis = bestSpatialAxis;
+    float pos = bestSpatialPos;
+
+    // Straddling references are clipped into both children
+
+    rightRefs = scratchArena.alloc<SBVH_ref>( numRefs );
+
+    for (int i=0; i<numRefs; i++) {
+
+      SBVH_ref r = refs[i];
+
+      if (r.box.max[axis] <= pos)
+	leftRefs[numLeft++] = r;
+      else if (r.box.min[axis] >= pos)
+	rightRefs[numRight++] = r;
+      else {
+	BBox leftBox  = clipTriangle( r.triangle, axis, r.box.min[axis], pos ).intersect( r.box );
+	BBox rightBox = clipTriangle( r.triangle, axis, pos, r.box.max[axis] ).intersect( r.box );
+
+	if (leftBox.isEmpty() && rightBox.isEmpty()) // only by roundoff
+	  leftRefs[numLeft++] = r;
+	if (!leftBox.isEmpty()) {
+	  leftRefs[numLeft].box = leftBox;
+	  leftRefs[numLeft++].triangle = r.triangle;
+	}
+	if (!rightBox.isEmpty()) {
+	  rightRefs[numRight].box = rightBox;
+	  rightRefs[numRight++].triangle = r.triangle;
+	}
+      }
+    }
+
+    sbvhBudget -= numLeft + numRight - numRefs;
+
+  } else if (bestObjectAxis >= 0) {
+
+    int axis = bestObjectAxis;
+    float lo = centroidBox.min[axis];
+    float extent = centroidBox.max[axis] - lo;
+
+    rightRefs = scratchArena.alloc<SBVH_ref>( numRefs );
+
+    for (int i=0; i<numRefs; i++) {
+      vec3 c = 0.5 * (refs[i].box.min + refs[i].box.max);
+      int b = MIN( SBVH_BINS-1, (int) ((c[axis] - lo) / extent * SBVH_BINS) );
+      if (b <= bestObjectPlane)
+	leftRefs[numLeft++] = refs[i];
+      else
+	rightRefs[numRight++] = refs[i];
+    }
+
+  } else {
+
+    // All centroids coincide and no spatial split helps: split the
+    // references in half
+
+    numLeft = numRefs / 2;
+    numRight = numRefs - numLeft;
+    rightRefs = refs + numLeft;
+  }
+
+  // A spatial split can leave one side with nothing (and then
+  // nothing was duplicated) if the straddling references turned out
+  // not to reach across the plane.  Then split in half.
+
+  if (numLeft == 0 || numRight == 0) {
+    if (numLeft == 0)
+      memcpy( refs, rightRefs, numRefs * sizeof(SBVH_ref) );
+    numLeft = numRefs / 2;
+    numRight = numRefs - numLeft;
+    rightRefs = refs + numLeft;
+  }
+
+  // ---- Build the node ----
+
+  BVH_node *n = nodeArena.alloc<BVH_node>();
+
+  n->isLeaf = false;
+  n->count = 2;
+  n->children = nodeArena.alloc<BVH_node*>( 2 );
+
+  n->children[0] = buildSpatialSubtree( leftRefs, numLeft );
+  n->children[1] = buildSpatialSubtree( rightRefs, numRight );
+
+  scratchArena.release( scratchMark );
+
+  n->bbox = n->children[0]->bbox;
+  n->bbox.include( n->children[1]->bbox );
+
+  return n;
+}
+
+
+// The box around the part of triangle 'triIndex' between planes
+// 'lo' and 'hi' on 'axis'.  This is empty if the triangle doesn't
+// reach between the planes.
+
+BBox BVH::clipTriangle( int triIndex, int axis, float lo, float hi )
+
+{
+  BBox box = BBox::empty();
+
+  vec3 v[3];
+  for (int i=0; i<3; i++)
+    v[i] = (*vertices)[ (*vindices)[3*triIndex+i] ];
+
+  for (int i=0; i<3; i++) {
+
+    vec3 p = v[i];
+    vec3 q = v[(i+1)%3];
+
+    if (p[axis] >= lo && p[axis] <= hi)
+      box.include( p );
+
+    // Where the edge pq crosses a plane
+
+    float planes[2] = { lo, hi };
+
+    for (int j=0; j<2; j++)
+      if ((p[axis] < planes[j] && q[axis] > planes[j]) || (p[axis] > planes[j] && q[axis] < planes[j])) {
+	float t = (planes[j] - p[axis]) / (q[axis] - p[axis]);
+	vec3 x = p + t * (q - p);
+	x[axis] = planes[j];
+	box.include( x );
+      }
+  }
+
+  return box;
+}
+
+
+// Widen the binary tree: while a node has fewer than
+// BVH_MAX_CHILDREN children, replace the internal child of largest
+// area by its children.
+
+void BVH::widenSubtree( BVH_node *n )
+
+{
+  if (n->isLeaf)
+    return;
+
+  BVH_node *children[BVH_MAX_CHILDREN];
+  int count = n->count;
+
+  for (int i=0; i<count; i++)
+    children[i] = n->children[i];
+
+  while (true) {
+
+    int   best = -1;
+    float bestArea = -1;
+
+    for (int i=0; i<count; i++)
+      if (!children[i]->isLeaf && count - 1 + children[i]->count <= BVH_MAX_CHILDREN) {
+	float area = children[i]->bbox.surfaceArea();
+	if (area > bestArea) {
+	  bestArea = area;
+	  best = i;
+	}
+      }
+
+    if (best < 0)
+      break;
+
+    BVH_node *c = children[best];
+    children[best] = c->children[0];
+    for (int j=1; j<c->count; j++)
+      children[count++] = c->children[j];
+  }
+
+  if (count != n->count) {
+    n->children = nodeArena.alloc<BVH_node*>( count );
+    n->count = count;
+    for (int i=0; i<count; i++)
+      n->children[i] = children[i];
+  }
+
+  for (int i=0; i<n->count; i++)
+    widenSubtree( n->children[i] );
+}
@@ -9,17 +9,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <fstream>
 #include "scene.h"
 #include "rtWindow.h"
 #include "arcball.h"
 #include "sphere.h"
 #include "triangle.h"
 #include "wavefrontobj.h"
+#include "instance.h"
 #include "light.h"
 #include "strokefont.h"
 #include "main.h"
 #include "material.h"
 #include "arrow.h"
+#include "refraction.h"
 
 
 #ifndef MAXFLOAT
@@ -55,31 +58,28 @@ void Scene::display()
 
 // Find the first object intersected
 
-bool Scene::findFirstObjectInt( vec3 rayStart, vec3 rayDir, int thisObjIndex, int thisObjPartIndex,
+template <class C>
+bool Scene::findFirstObjectInt( Ray &ray,
                                 vec3 &P, vec3 &N, vec3 &T, float &param, int &objIndex, int &objPartIndex, Material *&mat, int lightIndex )
 
 {
-  if (storingRays)
-    storedRays.add( rayStart );
+  if (C::storingRays && storingRays)
+    storedRays.add( ray.origin );
 
   bool hit = false;
 
-  float maxParam = MAXFLOAT;
-
   for (int i=0; i<objects.size(); i++) {
 
-    WavefrontObj* wfo = dynamic_cast<WavefrontObj*>( objects[i] );
-
      // don't check for int with the originating object for non-wavefront objects (since such objects are convex)
     
-    if (wfo || i != thisObjIndex) {
+    if (objects[i] != ray.originObj || dynamic_cast<WavefrontObj*>( objects[i] ) || dynamic_cast<Instance*>( objects[i] )) {
       
       vec3 point, normal, texcoords;
       float t;
       Material *intMat;
       int intPartIndex;
 
-      if (objects[i]->rayInt( rayStart, rayDir, ((i != thisObjIndex) ? -1 : thisObjPartIndex), maxParam, point, normal, texcoords, t, intMat, intPartIndex )) {
+      if (objects[i]->rayInt( ray, point, normal, texcoords, t, intMat, intPartIndex )) {
 
         P = point;
         N = normal;
@@ -89,13 +89,13 @@ bool Scene::findFirstObjectInt( vec3 rayStart, vec3 rayDir, int thisObjIndex, in
         objPartIndex = intPartIndex;
         mat = intMat;
 
-        maxParam = t; // In future, don't intersect any farther than this
+        ray.tmax = t; // In future, don't intersect any farther than this
         hit = true;
       }
     }
   }
 
-  if (storingRays) {
+  if (C::storingRays && storingRays) {
 
     if (hit) {
       storedRays.add( P );
@@ -108,7 +108,7 @@ bool Scene::findFirstObjectInt( vec3 rayStart, vec3 rayDir, int thisObjIndex, in
 	storedRays.add( lights[lightIndex]->position );
         storedRayColours.add( vec3(.843,.710,.278) ); // GOLD: shadow ray toward a light that is NOT blocked
       } else {
-        storedRays.add( rayStart+sceneScale*2*rayDir );
+        storedRays.add( ray.origin+sceneScale*2*ray.dir );
         storedRayColours.add( vec3(.3,.3,.3) ); // GREY: normal ray that misses
       }
     }
@@ -123,7 +123,8 @@ bool Scene::findFirstObjectInt( vec3 rayStart, vec3 rayDir, int thisObjIndex, in
 //
 // This returns the colour received on the ray.
 
-vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex, int thisObjPartIndex )
+template <class C>
+vec3 Scene::raytrace( Ray &ray, int depth )
 
 {
   // Terminate the ray?
@@ -143,10 +144,10 @@ vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex,
   int      objIndex, objPartIndex;
   Material *mat;
 
-  // Below, 'rayStart' is the ray staring point
-  //        'rayDir' is the direction of the ray
-  //        'thisObjIndex' is the index of the originating object
-  //        'thisObjPartIndex' is the index of the part on the originating object (e.g. the triangle)
+  // Below, 'ray.origin' is the ray staring point
+  //        'ray.dir' is the direction of the ray
+  //        'ray.originObj' is the originating object
+  //        'ray.originPart' is the index of the part on the originating object (e.g. the triangle)
   //
   // If a hit is made then at the intersection point:
   //        'P' is the position
@@ -157,7 +158,12 @@ vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex,
   //        'objPartIndex' is the index of the part of object that is hit
   //        'mat' is the material at the intersection point
   
-  bool hit = findFirstObjectInt( rayStart, rayDir, thisObjIndex, thisObjPartIndex, P, N, texcoords, t, objIndex, objPartIndex, mat, -1 );
+  unsigned long long startWork = threadStats.bvhNodesVisited + threadStats.triangleTests;
+
+  bool hit = findFirstObjectInt<C>( ray, P, N, texcoords, t, objIndex, objPartIndex, mat, -1 );
+
+  if (depth == 1) // a primary ray: record its traversal cost for the heat map
+    primaryWork += threadStats.bvhNodesVisited + threadStats.triangleTests - startWork;
 
   // No intersection: Return background colour
 
@@ -169,22 +175,79 @@ vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex,
       return blackColour;
   }
 
-  // Find reflection direction & incoming light from that direction
+  // Shade with the kernel for the material's features.  Without
+  // 'useTextureTransparency', a texture's alpha is ignored.
+
+  unsigned int features = mat->features & MAT_SHADING_FEATURES;
+  if (!useTextureTransparency)
+    features &= ~MAT_ALPHA_TEXTURE;
+
+  return (this->*Shaders<C>::table[ features ])( ray, depth, P, N, texcoords, t, *objects[objIndex], objPartIndex, mat );
+}
+
+
+// The shading kernels of a TraceConfig, indexed by the
+// MAT_SHADING_FEATURES of the material
+
+template <class C>
+const Scene::Shader Scene::Shaders<C>::table[ MAT_SHADING_FEATURES+1 ] = {
+  &Scene::shade<C,0x00>, &Scene::shade<C,0x01>, &Scene::shade<C,0x02>, &Scene::shade<C,0x03>,
+  &Scene::shade<C,0x04>, &Scene::shade<C,0x05>, &Scene::shade<C,0x06>, &Scene::shade<C,0x07>,
+  &Scene::shade<C,0x08>, &Scene::shade<C,0x09>, &Scene::shade<C,0x0a>, &Scene::shade<C,0x0b>,
+  &Scene::shade<C,0x0c>, &Scene::shade<C,0x0d>, &Scene::shade<C,0x0e>, &Scene::shade<C,0x0f>,
+  &Scene::shade<C,0x10>, &Scene::shade<C,0x11>, &Scene::shade<C,0x12>, &Scene::shade<C,0x13>,
+  &Scene::shade<C,0x14>, &Scene::shade<C,0x15>, &Scene::shade<C,0x16>, &Scene::shade<C,0x17>,
+  &Scene::shade<C,0x18>, &Scene::shade<C,0x19>, &Scene::shade<C,0x1a>, &Scene::shade<C,0x1b>,
+  &Scene::shade<C,0x1c>, &Scene::shade<C,0x1d>, &Scene::shade<C,0x1e>, &Scene::shade<C,0x1f>
+};
+
+
+// Find the light leaving point P of object 'obj' (with normal N and
+// material 'mat') toward the origin of 'ray'.  C is the TraceConfig.
+// F is the material's MAT_SHADING_FEATURES, and the work for the
+// features that are not in F is compiled out:
+//
+//   - Without MAT_TEXTURED, textureColour() isn't called.
+//   - Without MAT_SPECULAR, calcIout() doesn't compute the highlight.
+//   - Without MAT_EMISSIVE, Ie isn't added.
+//   - Without MAT_TRANSPARENT or MAT_ALPHA_TEXTURE, the surface is
+//     opaque, so there's no refraction ray.  Without MAT_ALPHA_TEXTURE,
+//     the opacity is just mat->alpha.
+//
+// The reflection ray (or, for a glossy material, the rays of its
+// lobe) is always traced, as calcIout() lights the surface with it
+// through kd as well as ks.
 
-  Object &obj = *objects[objIndex];
+template <class C, unsigned int F>
+vec3 Scene::shade( Ray &ray, int depth, vec3 &P, vec3 &N, vec3 &texcoords, float t, Object &obj, int objPartIndex, Material *mat )
 
-  vec3 E = (-1 * rayDir).normalize();
+{
+  const bool specular = (F & MAT_SPECULAR) != 0;
+
+  // Find reflection direction & incoming light from that direction
+
+  vec3 E = (-1 * ray.dir).normalize();
   vec3 R = (2 * (E * N)) * N - E;
 
-  float alpha;
-  vec3  colour = obj.textureColour( P, objPartIndex, alpha, texcoords );
+  // Width of the ray's cone at P, stretched across the surface, over
+  // which to filter the texture.  Reflected and refracted rays
+  // continue the cone from its width at P (ignoring the surface's
+  // curvature).
 
-  vec3 kd = vec3( colour.x*mat->kd.x, colour.y*mat->kd.y, colour.z*mat->kd.z );
+  float coneWidth = ray.coneWidth + t * ray.coneSpread;
+
+  float alpha = 1;
+  vec3  kd    = mat->kd;
+
+  if (F & MAT_TEXTURED) {
+    float footprint = coneWidth / MAX( fabs( E * N ), 0.1 );
+    vec3  colour    = obj.textureColour( P, objPartIndex, alpha, texcoords, footprint );
+    kd = vec3( colour.x*mat->kd.x, colour.y*mat->kd.y, colour.z*mat->kd.z );
+  }
 
 #if 0
-  if (debug) { // 'debug' is set when tracing through a pixel that the user right-clicked
+  if (C::debug && debug) { // 'debug' is set when tracing through a pixel that the user right-clicked
     INDENT(2*depth); cout << "texcoords " << texcoords << endl;
-    INDENT(2*depth); cout << "   colour " << colour << endl;
     INDENT(2*depth); cout << "       id " << kd << endl;
     INDENT(2*depth); cout << "        P " << P << endl;
     INDENT(2*depth); cout << "        N " << N << endl;
@@ -192,9 +255,20 @@ vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex,
   }
 #endif
 
-  vec3 Iout = mat->Ie + vec3( mat->ka.x * Ia.x, mat->ka.y * Ia.y, mat->ka.z * Ia.z );
-  vec3 Iin = raytrace( P, R, depth, objIndex, objPartIndex );
-  Iout = Iout + calcIout( N, R, E, E, kd, mat->ks, mat->n, Iin );
+  vec3 Iout = vec3( mat->ka.x * Ia.x, mat->ka.y * Ia.y, mat->ka.z * Ia.z );
+  if (F & MAT_EMISSIVE)
+    Iout = mat->Ie + Iout;
+  vec3 Iin;
+  if (mat->features & MAT_GLOSSY)
+    Iin = glossyReflection<C>( ray, depth, P, N, R, coneWidth, obj, objPartIndex, mat );
+  else {
+    STAT_INC( reflectionRays );
+    Ray reflectionRay( P, R, REFLECTION_RAY, &obj, objPartIndex );
+    reflectionRay.coneWidth  = coneWidth;
+    reflectionRay.coneSpread = ray.coneSpread;
+    Iin = raytrace<C>( reflectionRay, depth );
+  }
+  Iout = Iout + calcIout<specular>( N, R, E, E, kd, mat->ks, mat->n, Iin );
   // Add contributions from point lights
 
   for (int i=0; i<lights.size(); i++) {
@@ -217,35 +291,55 @@ vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex,
       // Note that 'intObjIndex' will return with the index of the
       // object that is hit.  So the hit object is objects[intObjIndex].
 
-      bool found = findFirstObjectInt( P, L, objIndex, objPartIndex, intP, intN, intTexCoords, intT, intObjIndex, intObjPartIndex, intMat, i );
+      // Objects beyond the light don't block it, so the shadow ray
+      // ends at the light.
+
+      Ray shadowRay( P, L, SHADOW_RAY, &obj, objPartIndex );
+      shadowRay.tmax = Ldist;
+
+      STAT_INC( shadowRays );
+      bool found = findFirstObjectInt<C>( shadowRay, intP, intN, intTexCoords, intT, intObjIndex, intObjPartIndex, intMat, i );
 
       if (!found || intT > Ldist) { // no object: Add contribution from this light
         vec3 Lr = (2 * (L * N)) * N - L;
-        Iout = Iout + calcIout( N, L, E, Lr, kd, mat->ks, mat->n, light.colour);
+        Iout = Iout + calcIout<specular>( N, L, E, Lr, kd, mat->ks, mat->n, light.colour);
       }
     }
   }
 
   // Blend the refraction ray coming up through a transparent surface
-  // with the reflection ray calculated as 'Iout' above.  The blend
-  // should be 'opacity' of the reflected ray and '1-opacity' of the
-  // refracted ray.
+  // with the light calculated as 'Iout' above.  'opacity' of the light
+  // is from the surface, as 'Iout'.  The rest passes through the
+  // surface and is split by the Fresnel reflectance: the reflected
+  // part arrives along the reflection ray (already traced, as 'Iin')
+  // and the refracted part along the refraction ray.  With total
+  // internal reflection, there's no refraction ray to trace.
+
+  if (!(F & (MAT_TRANSPARENT | MAT_ALPHA_TEXTURE)))
+    return Iout;
 
-  float opacity = alpha * mat->alpha;
+  float opacity = ((F & MAT_ALPHA_TEXTURE) ? alpha * mat->alpha : mat->alpha);
 
   if (opacity < 1.0) { // not completely opaque
 
-    // YOUR CODE HERE
-      Iout = vec3(Iout.x * opacity, Iout.y * opacity, Iout.z * opacity);
-      vec3 newRefDir;
-      if(findRefractionDirection(rayDir, N, newRefDir)){
-        vec3 Irefract = raytrace(P, newRefDir, depth, objIndex, objPartIndex);
-        Irefract = vec3(Irefract.x * (1 - opacity), Irefract.y * (1 - opacity), Irefract.z * (1 - opacity));
-        // Iout = Iout + calcIout( N, R, E, E, kd, mat->ks, mat->n, Irefract );
-        Iout = Iout + Irefract;
-      }
-      
-    // Use the 'findRefractionDirection' function (below) and raytrace in that direction if appropriate.
+    vec3  refractionDir;
+    float reflectance;
+
+    bool refracted = refract( ray.dir, N, mat->ior, refractionDir, reflectance );
+
+    float wReflect = (1 - opacity) * reflectance;
+    float wRefract = (1 - opacity) - wReflect;
+
+    Iout = vec3( opacity*Iout.x + wReflect*Iin.x, opacity*Iout.y + wReflect*Iin.y, opacity*Iout.z + wReflect*Iin.z );
+
+    if (refracted) {
+      STAT_INC( refractionRays );
+      Ray refractionRay( P, refractionDir, REFRACTION_RAY, &obj, objPartIndex );
+      refractionRay.coneWidth  = coneWidth;
+      refractionRay.coneSpread = ray.coneSpread;
+      vec3 Irefract = raytrace<C>( refractionRay, depth );
+      Iout = vec3( Iout.x + wRefract*Irefract.x, Iout.y + wRefract*Irefract.y, Iout.z + wRefract*Irefract.z );
+    }
   }
 
   return Iout;
@@ -253,57 +347,87 @@ vec3 Scene::raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex,
 
 
 
-// Find the refraction direction of a ray that is *arriving* in
-// direction 'rayDir' at an air/glass interface with outward-pointing
-// normal 'N'.  If the ray is entering the surface, assume an
-// air-to-glass transition.  Otherwise, assume a glass-to-air
-// transition.  Use Snell's Law and the indices of refraction of glass
-// and air to set 'refractionDir'.
+// Find the light arriving at P (with normal N) from the glossy lobe
+// around the mirror direction R.
 //
-// Return true if a value is returned in 'refractionDir'.  Return
-// false if there's total internal reflection (hence, no refraction).
-
+// The lobe is cos^s of the angle to R, with s = 1/r - 1 for the
+// material's roughness r = 1-g, scaled by 'glossinessFactor' (so s is
+// large for a near-mirror and 0, uniform over the hemisphere, for
+// r = 1).  Directions are drawn with the lobe's density, which has
+// cos(angle) = u^r for u uniform in [0,1], so the light is the mean
+// over the samples.  Samples that fall below the surface, on the side
+// that the ray came from, are mirrored back above it.
+//
+// Only the first bounce splits the ray tree: it sends
+// numGlossySamples() rays, stratified in u and in the angle around R.
+// A deeper glossy hit sends a single random ray, so the cost grows
+// linearly, not exponentially, with depth.
+//
+// The n rays are in rows of u and columns of angle, with a shorter
+// last row if n is not a multiple of the row length.  The rows are
+// equally likely, so each row's mean has the same weight.
 
-bool Scene::findRefractionDirection(vec3& rayDir, vec3& N, vec3& refractionDir)
+template <class C>
+vec3 Scene::glossyReflection( Ray &ray, int depth, vec3 &P, vec3 &N, vec3 &R, float coneWidth, Object &obj, int objPartIndex, Material *mat )
 
 {
-    //assuming air to glass
-    float ni = 1.008;//air
-    float nr = 1.510;//glass
-    if (rayDir * N > 0)//if the light is leaving the surface, ie. in same direction as normal
-    {
-        ni = 1.510;
-        nr = 1.008;
-        N = vec3(-N.x, -N.y, -N.z);
-    }
-    vec3 rayDirNeg = vec3(-rayDir.x, -rayDir.y, -rayDir.z);
-    float incAngle = acos(N * rayDirNeg);
-    float refAngle = asin(ni * sin(incAngle) / nr);
+  float r = MIN( 1, (1 - mat->g) * glossinessFactor );
 
-    if (((ni / nr) * sin(incAngle)) <= 1)
-    {
-        float crossRNx = (rayDir.y * N.z) - (rayDir.z * N.y);
-        float crossRNy = (rayDir.z * N.x) - (rayDir.x * N.z);
-        float crossRNz = (rayDir.x * N.y) - (rayDir.y * N.x);
+  lastGlossiness = 1 - r;
 
-        vec3 crossRN = vec3(crossRNx, crossRNy, crossRNz);
+  int n = (depth == 1 ? numGlossySamples() : 1);
 
-        float crossNRNx = (N.y * crossRN.z) - (N.z * crossRN.y);
-        float crossNRNy = (N.z * crossRN.x) - (N.x * crossRN.z);
-        float crossNRNz = (N.x * crossRN.y) - (N.y * crossRN.x);
+  int rows = MAX( 1, (int) sqrt( (float) n ) );
+  int cols = (n + rows - 1) / rows;
 
-        vec3 crossNRN = vec3(crossNRNx, crossNRNy, crossNRNz);
-        vec3 M = crossNRN.normalize();
+  // Frame around R
 
-        refractionDir = vec3(cos(refAngle) * (-1 * N.normalize()) + sin(refAngle) * M.normalize());
+  vec3 U = R.perp1().normalize();
+  vec3 V = R ^ U;
 
-        return true;
-    }
-    else
-    {
-        return false;
+  // Normal on the side of the viewer (which is the back for a ray
+  // inside a transparent object)
+
+  vec3 E = -1 * ray.dir;
+  vec3 Nf = (E * N < 0 ? -1 * N : N);
+
+  vec3 sum(0,0,0);
+
+  for (int i=0; i<rows; i++) {
+
+    int rowCols = (i < rows-1 ? cols : n - (rows-1) * cols);
+
+    vec3 rowSum(0,0,0);
+
+    for (int j=0; j<rowCols; j++) {
+
+      float cosA = pow( (i + rand() / (float) RAND_MAX) / rows, r );
+      float sinA = sqrt( MAX( 0, 1 - cosA*cosA ) );
+      float phi  = 2 * M_PI * (j + rand() / (float) RAND_MAX) / rowCols;
+      float a = sinA * cos( phi );
+      float b = sinA * sin( phi );
+
+      vec3 dir( cosA*R.x + a*U.x + b*V.x, cosA*R.y + a*U.y + b*V.y, cosA*R.z + a*U.z + b*V.z );
+
+      float dN = dir * Nf;
+      if (dN < 0)
+	dir = vec3( dir.x - 2*dN*Nf.x, dir.y - 2*dN*Nf.y, dir.z - 2*dN*Nf.z );
+
+      STAT_INC( reflectionRays );
+      Ray glossyRay( P, dir, REFLECTION_RAY, &obj, objPartIndex );
+      glossyRay.coneWidth  = coneWidth;
+      glossyRay.coneSpread = ray.coneSpread;
+      vec3 I = raytrace<C>( glossyRay, depth );
+
+      rowSum = rowSum + I;
     }
-    // YOUR CODE HERE
+
+    float k = 1.0 / (rows * rowCols);
+
+    sum = vec3( sum.x + k*rowSum.x, sum.y + k*rowSum.y, sum.z + k*rowSum.z );
+  }
+
+  return sum;
 }
 
 
@@ -314,7 +438,11 @@ bool Scene::findRefractionDirection(vec3& rayDir, vec3& N, vec3& refractionDir)
 // Ks, and n.
 //
 //       Iout = Iin * ( Kd (N.L) + Ks (R.V)^n )
+//
+// Without 'specular', the Ks term is left out (as for Ks = 0).  Both
+// versions are instantiated below, for the kernel benchmark.
 
+template <bool specular>
 vec3 Scene::calcIout( vec3 N, vec3 L, vec3 E, vec3 R,
                         vec3 Kd, vec3 Ks, float ns,
                         vec3 In )
@@ -329,6 +457,9 @@ vec3 Scene::calcIout( vec3 N, vec3 L, vec3 E, vec3 R,
 
   vec3 Id = (L*N) * In;
 
+  if (!specular)
+    return vec3( Id.x*Kd.x, Id.y*Kd.y, Id.z*Kd.z );
+
   vec3 Is;
 
   if (R*E < 0)
@@ -339,6 +470,9 @@ vec3 Scene::calcIout( vec3 N, vec3 L, vec3 E, vec3 R,
   return vec3( Is.x*Ks.x+Id.x*Kd.x, Is.y*Ks.y+Id.y*Kd.y, Is.z*Ks.z+Id.z*Kd.z );
 }
 
+template vec3 Scene::calcIout<true>( vec3 N, vec3 L, vec3 E, vec3 R, vec3 Kd, vec3 Ks, float ns, vec3 In );
+template vec3 Scene::calcIout<false>( vec3 N, vec3 L, vec3 E, vec3 R, vec3 Kd, vec3 Ks, float ns, vec3 In );
+
 
 // Determine the colour of one pixel.  This is where the raytracing
 // actually starts.
@@ -346,11 +480,33 @@ vec3 Scene::calcIout( vec3 N, vec3 L, vec3 E, vec3 R,
 //    (x-0.5,y-0.5) is the lower-left pixel corner.
 //
 //    (x+0.5,y+0.5) is the upper-right pixel corner.
+//
+// The pixel is traced with the kernels for the current options.  The
+// instrumented kernels are used only if rays are being stored or this
+// is the debugging pixel.
 
 vec3 Scene::pixelColour( int x, int y )
 
 {
-  if (x == debugPixel.x && y == debugPixel.y) {
+  if (storingRays || (x == debugPixel.x && y == debugPixel.y)) {
+    if (jitter)
+      return pixelColour< TraceConfig<true,true> >( x, y );
+    else
+      return pixelColour< TraceConfig<false,true> >( x, y );
+  } else {
+    if (jitter)
+      return pixelColour< TraceConfig<true,false> >( x, y );
+    else
+      return pixelColour< TraceConfig<false,false> >( x, y );
+  }
+}
+
+
+template <class C>
+vec3 Scene::pixelColour( int x, int y )
+
+{
+  if (C::debug && x == debugPixel.x && y == debugPixel.y) {
     debug = true;
     cout << "---------------- start debugging at pixel " << debugPixel << " ----------------" << endl;
   }
@@ -364,7 +520,8 @@ vec3 Scene::pixelColour( int x, int y )
 
   vec3 dir = (llCorner + x*right + y*up).normalize();
 
-  result = raytrace( eye->position, dir, 0, -1, -1 );
+  Ray ray( eye->position, dir, PRIMARY_RAY );
+  result = raytrace<C>( ray, 0 );
 
 #else
 
@@ -379,13 +536,17 @@ vec3 Scene::pixelColour( int x, int y )
   result = vec3(0,0,0); // replace this
   float subPixSize = 1.0 / numPixelSamples;
 
+  // Each ray's cone covers its subpixel (for texture filtering)
+
+  float coneSpread = subPixSize * up.length();
+
 
   for (int i = 0 ; i < numPixelSamples; i++) 
   {
       for (int n = 0; n < numPixelSamples; n++) 
       {
           float subPixX, subPixY;
-          if (jitter) {
+          if (C::jitter) {
               subPixX = x - 0.5 + (i + (float)rand() / (float)RAND_MAX) * subPixSize;
               subPixY = y - 0.5 + (n + (float)rand() / (float)RAND_MAX) * subPixSize;
           }
@@ -397,7 +558,10 @@ vec3 Scene::pixelColour( int x, int y )
 
           vec3 dir = (llCorner + subPixX * right + subPixY * up).normalize();
 
-          vec3 subColour = raytrace(eye->position, dir, 0, -1, -1);
+          STAT_INC( primaryRays );
+          Ray ray( eye->position, dir, PRIMARY_RAY );
+          ray.coneSpread = coneSpread;
+          vec3 subColour = raytrace<C>(ray, 0);
 
           result =  result + subColour;
       }
@@ -406,10 +570,10 @@ vec3 Scene::pixelColour( int x, int y )
 #endif
 
 
-  if (storingRays)
+  if (C::storingRays && storingRays)
     storingRays = false;
 
-  if (debug) {
+  if (C::debug && debug) {
     cout << "---------------- stop debugging ----------------" << endl;
     debug = false;
   }
@@ -418,6 +582,29 @@ vec3 Scene::pixelColour( int x, int y )
 }
 
 
+// Return the model in file 'filename', reading it (and building its
+// BVH) only if it hasn't already been read for this scene
+
+WavefrontObj *Scene::loadModel( const char *basename, const char *filename )
+
+{
+  char pathname[1000];
+  sprintf( pathname, "%s/%s", basename, filename );
+
+  for (int i=0; i<models.size(); i++)
+    if (strcmp( models[i]->obj->path(), pathname ) == 0)
+      return models[i];
+
+  WavefrontObj *o = new WavefrontObj( pathname );
+  models.add( o );
+
+  stats.bvhBuildTime += o->bvh.buildTime;
+  stats.bvhBytes += o->bvh.memoryBytes();
+
+  return o;
+}
+
+
 // Read the scene from an input stream
 
 void Scene::read( const char *basename, istream &in )
@@ -425,6 +612,8 @@ void Scene::read( const char *basename, istream &in )
 {
   char command[1000];
 
+  double startTime = RTStats::now();
+
   while (in) {
 
     skipComments( in );
@@ -459,17 +648,34 @@ void Scene::read( const char *basename, istream &in )
       string filename;
       in >> filename;
 
-      char pathname[1000];
-      sprintf( pathname, "%s/%s", basename, filename.c_str() );
+      WavefrontObj *o = loadModel( basename, filename.c_str() );
 
-      WavefrontObj *o = new WavefrontObj( pathname );
-      objects.add( o );
+      if (!objects.exists( o )) // the same file twice would be the same object twice
+	objects.add( o );
 
       // Update scene's scale
 
       if (o->obj->radius/2 > sceneScale)
 	sceneScale = o->obj->radius/2;
       
+    } else if (strcmp(command,"instance") == 0) {
+
+      // A transformed copy of a model, which is read only once
+
+      string filename;
+      skipComments( in );
+      in >> filename;
+
+      Instance *o = new Instance( loadModel( basename, filename.c_str() ), filename.c_str() );
+      o->input( in );
+      objects.add( o );
+
+      // Update scene's scale
+
+      BBox box = o->bbox();
+      if ((box.max - box.min).length()/4 > sceneScale)
+	sceneScale = (box.max - box.min).length()/4;
+      
     } else if (strcmp(command,"light") == 0) {
 
       Light *o = new Light();
@@ -481,8 +687,10 @@ void Scene::read( const char *basename, istream &in )
       eye = new Eye();
       in >> *eye;
 
-      win->arcball->setV( eye->position, eye->lookAt, eye->upDir );
-      win->fovy = eye->fovy;
+      if (win != NULL) {
+        win->arcball->setV( eye->position, eye->lookAt, eye->upDir );
+        win->fovy = eye->fovy;
+      }
       
     } else {
       
@@ -495,6 +703,26 @@ void Scene::read( const char *basename, istream &in )
     cerr << "No lights were provided in " << basename << " so the scene would be black." << endl;
     exit(1);
   }
+
+  if (eye == NULL) {
+    cerr << "No eye was provided in " << basename << "." << endl;
+    exit(1);
+  }
+
+  // Wait for the textures, which were read in parallel, and then
+  // find the materials' features (some of which depend on the
+  // textures)
+
+  Texture::finishLoads();
+
+  for (int i=0; i<materials.size(); i++)
+    materials[i]->findFeatures();
+
+  for (int i=0; i<models.size(); i++)
+    for (int j=0; j<models[i]->bvh.materials.size(); j++)
+      models[i]->bvh.materials[j]->findFeatures();
+
+  stats.loadTime = RTStats::now() - startTime;
 }
 
 
@@ -525,16 +753,118 @@ char *Scene::statusMessage()
 
   if (lastGlossiness > 0)
     sprintf( buffer, "%dx%d pixel rays, %d sample rays, glossiness %.6g%s", 
-	     numPixelSamples, numPixelSamples, (int) numRaySamples, lastGlossiness, (jitter ? ", jitter" : "") );
+	     numPixelSamples, numPixelSamples, numGlossySamples(), lastGlossiness, (jitter ? ", jitter" : "") );
   else
     sprintf( buffer, "%dx%d pixel rays, %d sample rays%s", 
-	     numPixelSamples, numPixelSamples, (int) numRaySamples, (jitter ? ", jitter" : "") );
+	     numPixelSamples, numPixelSamples, numGlossySamples(), (jitter ? ", jitter" : "") );
 
   return buffer;
 }
 
 
 
+// Set up the image plane from the current eye.  If there's a window,
+// the eye is first copied from the window's arcball.
+
+void Scene::setupView()
+
+{
+  if (win != NULL) {
+    eye->position = win->arcball->eyePosition();
+    eye->lookAt = win->arcball->lookAt();
+    eye->upDir = win->arcball->upDirection();
+    eye->fovy = win->fovy;
+  }
+
+  vec3 rightDir = ((eye->lookAt - eye->position) ^ eye->upDir).normalize();
+
+  // Compute the image plane coordinate system
+
+  up = (2.0 * tan( eye->fovy / 2.0 )) * eye->upDir.normalize();
+
+  right = (2.0 * tan( eye->fovy / 2.0 ) * windowWidth / (float) windowHeight) * rightDir.normalize();
+
+  llCorner = (eye->lookAt - eye->position).normalize() - 0.5 * up - 0.5 * right;
+
+  up = (1.0 / (float) (windowHeight-1)) * up;
+  right = (1.0 / (float) (windowWidth-1)) * right;
+}
+
+
+// Allocate a new, empty RT image
+
+void Scene::allocRTImage()
+
+{
+  int numPixels = (int) (windowWidth/pixelScale * windowHeight/pixelScale);
+
+  if (rtImage != NULL)
+    delete [] rtImage;
+
+  if (heatImage != NULL)
+    delete [] heatImage;
+
+  rtImage = new vec4[ numPixels ];
+  heatImage = new float[ numPixels ];
+
+  for (int i=0; i<numPixels; i++) {
+    rtImage[i] = vec4(0,0,0,0); // transparent
+    heatImage[i] = 0;
+  }
+
+  heatMax = 0;
+}
+
+
+// Trace one (possibly scaled) pixel into the RT image
+//
+// The pixel's traversal cost (BVH nodes visited plus triangles
+// tested, per primary ray) is also recorded for the heat map.
+
+void Scene::tracePixel( int x, int y )
+
+{
+  double startTime = RTStats::now();
+  unsigned long long startWork = threadStats.bvhNodesVisited + threadStats.triangleTests;
+
+  primaryWork = 0;
+
+  vec3 colour = pixelColour( (x+0.5)*pixelScale, (y+0.5)*pixelScale );
+
+  int i = x + y * (int) (windowWidth/pixelScale);
+
+  rtImage[i] = vec4( colour.x, colour.y, colour.z, 1 ); // opaque
+
+  unsigned long long work;
+  if (heatMap == HEAT_MAP_RAY_TREE)
+    work = threadStats.bvhNodesVisited + threadStats.triangleTests - startWork;
+  else
+    work = primaryWork;
+
+  heatImage[i] = work / (float) (numPixelSamples * numPixelSamples);
+  if (heatImage[i] > heatMax)
+    heatMax = heatImage[i];
+
+  threadStats.traceTime += RTStats::now() - startTime;
+  threadStats.numPixels++;
+}
+
+
+// Collect the counts of a completed frame
+
+void Scene::endFrame()
+
+{
+  stats.clear();
+  stats.add( threadStats );
+  stats.frameTime = RTStats::now() - frameStartTime;
+  stats.peakRSS = RTStats::peakRSSkB();
+  stats.texBytes = Texture::residentBytes;
+
+  threadStats.clear();
+}
+
+
 // Draw the scene.  This sets things up and simply
 // calls pixelColour() for each pixel.
 
@@ -553,57 +883,36 @@ void Scene::renderRT( bool restart )
 
   if (restart) {
 
-    srand( 754376105 );
-
-    // Copy the window eye into the scene eye
-
-    eye->position = win->arcball->eyePosition();
-    eye->lookAt = win->arcball->lookAt();
-    eye->upDir = win->arcball->upDirection();
-    eye->fovy = win->fovy;
-
-    vec3 rightDir = ((eye->lookAt - eye->position) ^ eye->upDir).normalize();
+    srand( randomSeed );
 
-    // Compute the image plane coordinate system
+    // Copy the window eye into the scene eye and compute the image plane
 
-    up = (2.0 * tan( eye->fovy / 2.0 )) * eye->upDir.normalize();
-
-    right = (2.0 * tan( eye->fovy / 2.0 ) * windowWidth / (float) windowHeight) * rightDir.normalize();
-
-    llCorner = (eye->lookAt - eye->position).normalize() - 0.5 * up - 0.5 * right;
-
-    up = (1.0 / (float) (windowHeight-1)) * up;
-    right = (1.0 / (float) (windowWidth-1)) * right;
+    setupView();
 
     nextx = 0;
     nexty = 0;
 
     stop = false;
 
+    threadStats.clear();
+    frameStartTime = RTStats::now();
+
     // Clear the RT image
     
-    if (rtImage != NULL)
-      delete [] rtImage;
-
-    rtImage = NULL;
+    allocRTImage();
   }
 
   // Set up a new RT image
 
-  if (rtImage == NULL) {
-    rtImage = new vec4[ (int) (windowWidth/pixelScale * windowHeight/pixelScale) ];
-    for (int i=0; i<windowWidth/pixelScale * windowHeight/pixelScale; i++)
-      rtImage[i] = vec4(0,0,0,0); // transparent
-  }
+  if (rtImage == NULL)
+    allocRTImage();
 
   if (stop)
     return;
 
   // Draw the next pixel
 
-  vec3 colour = pixelColour( (nextx+0.5)*pixelScale, (nexty+0.5)*pixelScale );
-
-  rtImage[ nextx + nexty * (int) (windowWidth/pixelScale) ] = vec4( colour.x, colour.y, colour.z, 1 ); // opaque
+  tracePixel( nextx, nexty );
 
   // Move (nextx,nexty) to the next pixel
 
@@ -614,6 +923,7 @@ void Scene::renderRT( bool restart )
     nextx++;
 
     if (nextx >= windowWidth/pixelScale) { // finished
+      endFrame();
       draw_RT_and_GL( WCS_to_VCS, VCS_to_CCS );
       nextx = 0;
       stop = true;
@@ -632,6 +942,67 @@ void Scene::renderRT( bool restart )
 }
 
 
+// Raytrace the whole image without a window.  Pixels are traced in
+// the same order as in renderRT() so that the jittered samples are
+// identical.
+
+void Scene::renderAll()
+
+{
+  srand( randomSeed );
+
+  setupView();
+
+  threadStats.clear();
+  frameStartTime = RTStats::now();
+
+  allocRTImage();
+
+  for (int x=0; x<windowWidth/pixelScale; x++)
+    for (int y=0; y<windowHeight/pixelScale; y++)
+      tracePixel( x, y );
+
+  endFrame();
+}
+
+
+// Write the RT image as a P6 PPM file
+
+void Scene::writeRTImage( const char *filename )
+
+{
+  if (rtImage == NULL)
+    return;
+
+  ofstream out( filename, ios::binary );
+
+  if (!out) {
+    cerr << "Could not open " << filename << " for writing." << endl;
+    return;
+  }
+
+  int width  = windowWidth/pixelScale;
+  int height = windowHeight/pixelScale;
+
+  out << "P6\n" << width << " " << height << "\n255\n";
+
+  unsigned char *row = new unsigned char[ 3*width ];
+
+  for (int y=height-1; y>=0; y--) { // PPM is stored top-to-bottom
+    for (int x=0; x<width; x++) {
+      vec4 &c = rtImage[ x + y*width ];
+      for (int i=0; i<3; i++) {
+	float v = (&c.x)[i];
+	row[3*x+i] = (unsigned char) (v <= 0 ? 0 : (v >= 1 ? 255 : (int) (v*255 + 0.5)));
+      }
+    }
+    out.write( (char *) row, 3*width );
+  }
+
+  delete [] row;
+}
+
+
 // Render the scene with OpenGL
 
 
@@ -649,6 +1020,11 @@ void Scene::renderGL( mat4 &WCS_to_VCS, mat4 &VCS_to_CCS )
   if (segs == NULL)
     segs = new Segs();
 
+  if (wavefrontGPU == NULL) {
+    wavefrontGPU = new GPUProgram();
+    wavefrontGPU->init( wavefrontVertexShader, wavefrontFragmentShader, "in Scene::renderGL()" );
+  }
+
   vec3 lightDir = vec3(1,1,1).normalize();
   
   // Set up the framebuffer
@@ -807,6 +1183,8 @@ void Scene::draw_RT_and_GL( mat4 &WCS_to_VCS, mat4 &VCS_to_CCS )
 
   glDisable( GL_DEPTH_TEST );
   strokeFont->drawStrokeString( statusMessage(), -0.95, -0.95, TEXT_SIZE, 0, LEFT, vec3(1,1,1) );
+  if (heatMap != HEAT_MAP_OFF)
+    drawHeatMapLegend();
   glEnable( GL_DEPTH_TEST );
 
   // Done
@@ -816,6 +1194,57 @@ void Scene::draw_RT_and_GL( mat4 &WCS_to_VCS, mat4 &VCS_to_CCS )
 
 
 
+// Heat map colour for a cost in [0,1]: blue - cyan - green - yellow - red
+
+#define NUM_HEAT_COLOURS 5
+
+static vec3 heatColours[NUM_HEAT_COLOURS] = {
+  vec3(0,0,1), vec3(0,1,1), vec3(0,1,0), vec3(1,1,0), vec3(1,0,0)
+};
+
+static vec3 heatColour( float f )
+
+{
+  if (!(f > 0)) // also catches NaN when nothing has been traced yet
+    return heatColours[0];
+  if (f >= 1)
+    return heatColours[NUM_HEAT_COLOURS-1];
+
+  f = f * (NUM_HEAT_COLOURS-1);
+  int   i = (int) f;
+  float s = f - i;
+
+  return (1-s) * heatColours[i] + s * heatColours[i+1];
+}
+
+
+// Draw the colour scale of the heat map and the totals of this frame
+
+void Scene::drawHeatMapLegend()
+
+{
+  char buffer[1000];
+
+  sprintf( buffer, "BVH nodes + triangle tests per %s", (heatMap == HEAT_MAP_PRIMARY ? "primary ray" : "pixel ray tree") );
+  strokeFont->drawStrokeString( buffer, -0.95, 0.90, TEXT_SIZE, 0, LEFT, vec3(1,1,1) );
+
+  for (int i=0; i<NUM_HEAT_COLOURS; i++) {
+    float f = i / (float) (NUM_HEAT_COLOURS-1);
+    sprintf( buffer, "%.0f", f * heatMax );
+    strokeFont->drawStrokeString( buffer, -0.95 + 0.2*i, 0.82, TEXT_SIZE, 0, LEFT, heatColour( f ) );
+  }
+
+  // Totals are of the frame in progress, or of the last frame if done
+
+  RTStats &s = (stop ? stats : threadStats);
+
+  sprintf( buffer, "frame: %llu nodes, %llu box tests, %llu triangle tests, %llu rays",
+	   s.bvhNodesVisited, s.rayBoxTests, s.triangleTests, s.totalRays() );
+  strokeFont->drawStrokeString( buffer, -0.95, 0.74, TEXT_SIZE, 0, LEFT, vec3(1,1,1) );
+}
+
+
+
 void Scene::drawRTImage()
 
 {
@@ -838,7 +1267,24 @@ void Scene::drawRTImage()
   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
 
-  glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, windowWidth/pixelScale, windowHeight/pixelScale, 0, GL_RGBA, GL_FLOAT, rtImage );
+  if (heatMap == HEAT_MAP_OFF)
+
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, windowWidth/pixelScale, windowHeight/pixelScale, 0, GL_RGBA, GL_FLOAT, rtImage );
+
+  else {
+
+    // Show the traversal cost of each traced pixel instead of its colour
+
+    int numPixels = (int) (windowWidth/pixelScale * windowHeight/pixelScale);
+    vec4 *heatRGBA = new vec4[ numPixels ];
+
+    for (int i=0; i<numPixels; i++)
+      heatRGBA[i] = vec4( heatColour( heatImage[i] / heatMax ), rtImage[i].w ); // untraced pixels stay transparent
+
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, windowWidth/pixelScale, windowHeight/pixelScale, 0, GL_RGBA, GL_FLOAT, heatRGBA );
+
+    delete [] heatRGBA;
+  }
 
   // Draw texture on a full-screen quad
 
@@ -7,6 +7,7 @@
 
 
 class RTwindow;
+class WavefrontObj;
 
 
 #include <iostream>
@@ -19,6 +20,7 @@ class RTwindow;
 #include "axes.h"
 #include "drawSegs.h"
 #include "arrow.h"
+#include "rtStats.h"
 
 
 #define PIXEL_SCALE 1           // initial size of raytraced pixel (for multi-res rendering.  Must be power of two.)
@@ -26,6 +28,26 @@ class RTwindow;
 #define TEXT_SIZE 0.05          // size of text in [-1,1]x[-1,1] coordinate system
 
 
+// Heat map modes: what each pixel's traversal cost includes
+
+enum { HEAT_MAP_OFF, HEAT_MAP_PRIMARY, HEAT_MAP_RAY_TREE, NUM_HEAT_MAP_MODES };
+
+
+// Options of the raytracing kernels that are fixed at compile time.
+// Scene::pixelColour() picks the instantiation for the current
+// options, so the kernels have no branches for those that are off.
+//
+// Only an 'instrumented' kernel looks at Scene::storingRays and
+// Scene::debug.  It's used for a pixel that the user clicked on.
+
+template <bool Jitter, bool Instrumented>
+struct TraceConfig {
+  static const bool jitter      = Jitter;	// jitter the pixel samples
+  static const bool storingRays = Instrumented;	// store rays for drawing if Scene::storingRays
+  static const bool debug       = Instrumented;	// print debugging output if Scene::debug
+};
+
+
 class Scene {
 
   RTwindow *    win;		// rendering window
@@ -33,6 +55,7 @@ class Scene {
   Eye *         eye;		// viewpoint
   seq<Light *>  lights;		// all lights
   seq<Object *> objects;	// all objects
+  seq<WavefrontObj *> models;	// all Wavefront models, each read once (and in 'objects' or instanced, or both)
 
   vec3        Ia;		// ambient illumination
 
@@ -47,12 +70,40 @@ class Scene {
 
   GLuint rtImageTexID;
   vec4 *rtImage;		// texture storing the raytraced image
+  float *heatImage;		// traversal cost per ray of each pixel (for the heat map)
+  float heatMax;		// max cost in heatImage
+  unsigned long long primaryWork; // traversal cost of the primary rays of the current pixel
   static const char *rtTextureVertShader, *rtTextureFragShader;
   GPUProgram *gpu;
   GPUProgram *wavefrontGPU;
 
   int pixelScale;             // size (in window pixels) of one raytraced pixel
 
+  double frameStartTime;      // RTStats::now() when the current frame was started
+
+  void setupView();
+  void allocRTImage();
+  void tracePixel( int x, int y );
+  void endFrame();
+
+  WavefrontObj *loadModel( const char *basename, const char *filename );
+
+  // Shading kernels for each combination of MAT_SHADING_FEATURES
+  // and each TraceConfig
+
+  typedef vec3 (Scene::*Shader)( Ray &ray, int depth, vec3 &P, vec3 &N, vec3 &texcoords, float t, Object &obj, int objPartIndex, Material *mat );
+
+  template <class C, unsigned int F>
+  vec3 shade( Ray &ray, int depth, vec3 &P, vec3 &N, vec3 &texcoords, float t, Object &obj, int objPartIndex, Material *mat );
+
+  template <class C>
+  struct Shaders {
+    static const Shader table[ MAT_SHADING_FEATURES+1 ];
+  };
+
+  template <class C>
+  vec3 glossyReflection( Ray &ray, int depth, vec3 &P, vec3 &N, vec3 &R, float coneWidth, Object &obj, int objPartIndex, Material *mat );
+
  public:
 
   vec2 mouse;
@@ -65,24 +116,27 @@ class Scene {
   seq<vec3> storedRays;	// each pair of points is a ray
   seq<vec3> storedRayColours;
 
-  seq<Texture*> textures;	// all textures
   seq<Material*> materials;	// all materials
   int maxDepth;			// ray tracing depth
-  int glossyIterations;		// number of rays to send for glossy reflections
+  int glossyIterations;		// max number of rays to send for a glossy reflection
   bool useTextureTransparency;
   bool showAxes;
   bool showBVH;
   bool showObjects;
   bool jitter;
+  unsigned int randomSeed;	// seed at the start of each frame (and of the BVH build)
   bool russianRoulette;
   bool showZoom;
+  int heatMap;			// HEAT_MAP_OFF, HEAT_MAP_PRIMARY, or HEAT_MAP_RAY_TREE
   int numPixelSamples;
-  float numRaySamples;
+  float numRaySamples;		// rays to send for a glossy reflection at the first bounce
   int bvhDisplayDepth;
   bool debug;
   vec2 debugPixel;
-  float glossinessFactor;
-  float lastGlossiness;
+  float glossinessFactor;	// scales the roughness (1-g) of glossy materials
+  float lastGlossiness;		// of the last glossy reflection traced, or -1 if none
+
+  RTStats stats;		// counts from the last completed frame, and load times
 
   float sceneScale; // max dimension of scene's bounding box (used to scale the debbugging arrows)
 
@@ -91,10 +145,13 @@ class Scene {
 
   Scene() {
 
-    wavefrontGPU = new GPUProgram();
-    wavefrontGPU->init( wavefrontVertexShader, wavefrontFragmentShader, "in Scene() constructor" );
+    // GPU programs are created in renderGL() so that a scene can be
+    // raytraced without an OpenGL context
 
-    segs = new Segs();
+    wavefrontGPU = NULL;
+    segs = NULL;
+    win = NULL;
+    eye = NULL;
 
     Ia = vec3(0.1,0.1,0.1);
     maxDepth = 4;
@@ -104,12 +161,16 @@ class Scene {
     showAxes = false;
     showObjects = true;
     rtImage = NULL;
+    heatImage = NULL;
+    heatMax = 0;
+    heatMap = HEAT_MAP_OFF;
     rtImageTexID = 0;
     gpu = NULL;
     axes = NULL;
     arrow = NULL;
     stop = false;
     jitter = false;
+    randomSeed = 754376105;
     russianRoulette = true;
     numPixelSamples = 1;
     numRaySamples = 8.0;
@@ -129,17 +190,30 @@ class Scene {
     win = w; 
   }
 
+  // Rays sent by a glossy reflection at the first bounce
+
+  int numGlossySamples() {
+    return MAX( 1, MIN( (int) numRaySamples, glossyIterations ) );
+  }
+
   void renderRT( bool restart );
+  void renderAll();
+  void writeRTImage( const char *filename );
   void renderGL( mat4 &WCS_to_VCS, mat4 &VCS_to_CCS );
   void draw_RT_and_GL( mat4 &WCS_to_VCS, mat4 &VCS_to_CCS );
   void showPixelZoom( vec2 mouse );
   void read( const char *basename, istream &in );
   void write( ostream &out );
   vec3 pixelColour( int x, int y );
-  vec3 raytrace( vec3 &rayStart, vec3 &rayDir, int depth, int thisObjIndex, int thisObjPartIndex );
+  template <class C>
+  vec3 pixelColour( int x, int y );
+  template <class C>
+  vec3 raytrace( Ray &ray, int depth );
+  template <bool specular>
   vec3 calcIout( vec3 N, vec3 L, vec3 E, vec3 R,
 		   vec3 Kd, vec3 Ks, float ns, vec3 In );
-  bool findFirstObjectInt( vec3 rayStart, vec3 rayDir, int thisObjIndex, int thisObjPartIndex, 
+  template <class C>
+  bool findFirstObjectInt( Ray &ray,
 			   vec3 &P, vec3 &N, vec3 &T, float &param, int &objIndex, int &objPartIndex, Material *&mat, int lightIndex );
 
   void outputEye() { 
@@ -149,8 +223,8 @@ class Scene {
   void display();
   void drawStoredRays( GPUProgram *gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS );
   void drawRTImage();
+  void drawHeatMapLegend();
   char *statusMessage();
-  bool findRefractionDirection( vec3 &rayDir, vec3 &N, vec3 &refractionDir );
   
   static const char* wavefrontVertexShader;
   static const char* wavefrontFragmentShader;
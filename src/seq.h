@@ -9,17 +9,29 @@
  *   CONSTRUCTORS
  *
  *     seq()               Create an empty sequence
+ *     seq( n )            Create an empty sequence with storage for n elements
  *
  *   PUBLIC FUNCTIONS
  *
- *     add( x )            Add x to the end of the sequence
+ *     add( x )            Add x to the end of the sequence (moved if x is an rvalue)
+ *     emplace( args )     Construct an element from args at the end of the sequence
+ *     reserve( n )        Make sure that there's storage for n elements
  *     remove()            Remove the last element of the sequence
  *     remove( i )         Remove the i^{th} element of the sequence (expensive)
  *     shift( i )          Shift right everything starting at position i
  *     operator [i]        Returns the i^{th} element (starting from 0)
+ *     begin(), end()      Iterators, so that "for (T &x : s)" works
  *     exists( x )         Return true if x exists in sequence, false otherwise
  *     clear()             Deletes the whole sequence
  *     findIndex( x )      Find the index of element x, or -1 if it doesn't exist
+ *
+ * Elements are stored in uninitialized storage and are only
+ * constructed when added, so T need not have a default constructor.
+ * When the storage grows, the elements are moved (not copied) to the
+ * new storage.
+ *
+ * operator[] checks its index unless SEQ_BOUNDS_CHECK is 0.  By
+ * default, it is 0 only if NDEBUG is defined, as in a release build.
  */
 
 
@@ -28,41 +40,84 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <new>
+#include <utility>
 
 using namespace std;
 
 
+#ifndef SEQ_BOUNDS_CHECK
+  #ifdef NDEBUG
+    #define SEQ_BOUNDS_CHECK 0
+  #else
+    #define SEQ_BOUNDS_CHECK 1
+  #endif
+#endif
+
+
 template<class T> class seq {
 
   int storageSize;
   int numElements;
   T  *data;
 
+  static T *allocate( int n ) { // uninitialized storage for n elements
+    return (T *) ::operator new( n * sizeof(T) );
+  }
+
+  void destroyAll() {
+    for (int i=0; i<numElements; i++)
+      data[i].~T();
+    ::operator delete( data );
+  }
+
+  void setStorageSize( int n );
+  void grow() {
+    setStorageSize( storageSize < 2 ? 2 : 2 * storageSize );
+  }
+
+  void outOfRange( int i ) const {
+    cerr << "element: Tried to access an element beyond the range of the sequence: "
+	 << i << "(numElements = " << numElements << ")\n";
+    abort(); // rather than exit(), so that a debugger stops here
+  }
+
 public:
 
   seq() {			// constructor
     storageSize = 2;
     numElements = 0;
-    data = new T[ storageSize ];
+    data = allocate( storageSize );
   }
 
   seq( int n ) {		// constructor
     storageSize = n;
     numElements = 0;
-    data = new T[ storageSize ];
+    data = allocate( storageSize );
   }
 
   ~seq() {			// destructor
-    delete [] data;
+    destroyAll();
   }
 
   seq( const seq<T> & source ) { // copy constructor
 
-    storageSize = source.storageSize;
+    storageSize = source.numElements;
     numElements = source.numElements;
-    data = new T[ storageSize ];
+    data = allocate( storageSize );
     for (int i=0; i<numElements; i++)
-      data[i] = source.data[i];
+      new (&data[i]) T( source.data[i] );
+  }
+
+  seq( seq<T> && source ) {	// move constructor: takes the storage of 'source' and leaves it empty
+
+    storageSize = source.storageSize;
+    numElements = source.numElements;
+    data = source.data;
+
+    source.storageSize = 0;
+    source.numElements = 0;
+    source.data = allocate( 0 );
   }
 
   void remove() {
@@ -72,12 +127,18 @@ public:
     }
 
     numElements = numElements - 1;
+    data[numElements].~T();
   }
 
   void remove( int i );
   void shift( int i );
   void compress();
 
+  void reserve( int n ) {
+    if (n > storageSize)
+      setStorageSize( n );
+  }
+
   T * array() { return data; }
 
   int size() const {
@@ -85,94 +146,129 @@ public:
   }
 
   T & operator [] ( int i ) const {
-    if (i >= numElements || i < 0) {
-      cerr << "element: Tried to access an element beyond the range of the sequence: "
-	   << i << "(numElements = " << numElements << ")\n";
-      { int i = 0;
-      int j = 1 / i;
-      j = j;
-      }
-      exit(-1);
-    }
+#if SEQ_BOUNDS_CHECK
+    if (i >= numElements || i < 0)
+      outOfRange( i );
+#endif
     return data[ i ];
   }
 
+  // Iterators
+
+  T * begin() { return data; }
+  T * end()   { return data + numElements; }
+
+  const T * begin() const { return data; }
+  const T * end()   const { return data + numElements; }
+
   void clear() {
-    delete [] data;
+    destroyAll();
     storageSize = 1;
     numElements = 0;
-    data = new T[ storageSize ];
+    data = allocate( storageSize );
   }
 
   seq<T> & operator = (const seq<T> &source) { // assignment operator
-    storageSize = source.storageSize;
-    numElements = source.numElements;
-    delete [] data;
-    data = new T[ storageSize ];
-    for (int i=0; i<numElements; i++)
-      data[i] = source.data[i];
+    if (this != &source) {
+      destroyAll();
+      storageSize = source.numElements;
+      numElements = source.numElements;
+      data = allocate( storageSize );
+      for (int i=0; i<numElements; i++)
+	new (&data[i]) T( source.data[i] );
+    }
     return *this;
   }
 
-  void add( const T &x );
-  int findIndex( const T &x );
-  bool exists( const T &x );
+  seq<T> & operator = (seq<T> &&source) { // move assignment operator
+    if (this != &source) {
+      destroyAll();
+      storageSize = source.storageSize;
+      numElements = source.numElements;
+      data = source.data;
+      source.storageSize = 0;
+      source.numElements = 0;
+      source.data = allocate( 0 );
+    }
+    return *this;
+  }
+
+  void add( const T &x ) {
+    if (numElements == storageSize) {
+      T copy( x );		// x might be in this sequence, which grow() would move
+      grow();
+      new (&data[ numElements ]) T( std::move( copy ) );
+    } else
+      new (&data[ numElements ]) T( x );
+    numElements++;
+  }
+
+  void add( T &&x ) {
+    if (numElements == storageSize) {
+      T temp( std::move( x ) );
+      grow();
+      new (&data[ numElements ]) T( std::move( temp ) );
+    } else
+      new (&data[ numElements ]) T( std::move( x ) );
+    numElements++;
+  }
+
+  template<class... Args>
+  T & emplace( Args&&... args ) {
+    if (numElements == storageSize) {
+      T temp( std::forward<Args>( args )... ); // args might refer into this sequence, which grow() would move
+      grow();
+      new (&data[ numElements ]) T( std::move( temp ) );
+    } else
+      new (&data[ numElements ]) T( std::forward<Args>( args )... );
+    return data[ numElements++ ];
+  }
+
+  int findIndex( const T &x ) const;
+  bool exists( const T &x ) const;
 };
 
 
-// Add an element to the end of the sequence
+// Move the elements to new storage of size n >= numElements
 
 template<class T>
-void 
-seq<T>::add( const T &x )
+void
+seq<T>::setStorageSize( int n )
 
 {
-  // No storage left?  If so, double the storage
-
-  if (numElements == storageSize) {
-    T *newData;
+  T *newData = allocate( n );
 
-    newData = new T[ storageSize * 2 ];
-    for (int i=0; i<storageSize; i++)
-      newData[i] = data[i];
-    storageSize = storageSize * 2;
-    delete [] data;
-    data = newData;
+  for (int i=0; i<numElements; i++) {
+    new (&newData[i]) T( std::move( data[i] ) );
+    data[i].~T();
   }
 
-  // Store the element in the next available position
+  ::operator delete( data );
 
-  data[ numElements ] = x;
-  numElements++;
+  storageSize = n;
+  data = newData;
 }
 
 
 // Compress the array
 
 template<class T>
-void 
+void
 seq<T>::compress()
 
 {
-  T *newData;
-
   if (numElements == storageSize)
     return;
 
-  newData = new T[ numElements ];
-  for (int i=0; i<numElements; i++)
-    newData[i] = data[i];
-  storageSize = numElements;
-  delete [] data;
-  data = newData;
+  setStorageSize( numElements );
 }
 
 
 // Find and return an element
 
 template<class T>
-bool 
-seq<T>::exists( const T &x )
+bool
+seq<T>::exists( const T &x ) const
 
 {
   for (int i=0; i<numElements; i++)
@@ -186,8 +282,8 @@ seq<T>::exists( const T &x )
 // Find and return the *index* of an element
 
 template<class T>
-int 
-seq<T>::findIndex( const T &x )
+int
+seq<T>::findIndex( const T &x ) const
 
 {
   for (int i=0; i<numElements; i++)
@@ -198,10 +294,11 @@ seq<T>::findIndex( const T &x )
 }
 
 
-// Shift a suffix of the sequence to the right by one
+// Shift a suffix of the sequence to the right by one.  Element i
+// is left in a moved-from state, to be assigned by the caller.
 
 template<class T>
-void 
+void
 seq<T>::shift( int i )
 
 {
@@ -211,19 +308,13 @@ seq<T>::shift( int i )
     exit(-1);
   }
 
-  if (numElements == storageSize) {
-    T *newData;
+  if (numElements == storageSize)
+    grow();
 
-    newData = new T[ storageSize * 2 ];
-    for (int i=0; i<storageSize; i++)
-      newData[i] = data[i];
-    storageSize = storageSize * 2;
-    delete [] data;
-    data = newData;
-  }
+  new (&data[numElements]) T( std::move( data[numElements-1] ) );
 
-  for (int j=numElements; j>i; j--)
-    data[j] = data[j-1];
+  for (int j=numElements-1; j>i; j--)
+    data[j] = std::move( data[j-1] );
 
   numElements++;
 }
@@ -232,23 +323,21 @@ seq<T>::shift( int i )
 // Shift a suffix of the sequence to the left by one
 
 template<class T>
-void 
+void
 seq<T>::remove( int i )
 
 {
   if (i < 0 || i >= numElements) {
     cerr << "remove: Tried to remove element " << i
 	 << " from a sequence of " << numElements << " elements \n";
-    { int i = 0;
-    int j = 1 / i;
-    }
-    exit(-1);
+    abort();
   }
 
   for (int j=i; j<numElements-1; j++)
-    data[j] = data[j+1];
+    data[j] = std::move( data[j+1] );
 
   numElements--;
+  data[numElements].~T();
 }
 
 
@@ -3,6 +3,7 @@
 
 #include "sphere.h"
 #include "main.h"
+#include "rtStats.h"
 
 
 // icosahedron vertices (taken from Jon Leech http://www.cs.unc.edu/~jon)
@@ -188,18 +189,22 @@ void Sphere::setupVAO()
 
 // Ray / sphere intersection
 
-bool Sphere::rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxParam,
+bool Sphere::rayInt( Ray &ray,
 		     vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material * &mat, int &intPartIndex )
 
 {
   float a,b,c,d,t0,t1;
 
+  STAT_INC( sphereTests );
+
   // Does it intersect? ... Solve a quadratic for
   // the parameter at the point of intersection
 
-  a = rayDir * rayDir;
-  b = 2 * (rayDir * (rayStart - centre));
-  c = (rayStart - centre) * (rayStart - centre) - radius * radius;
+  vec3 oc = ray.origin - centre;
+
+  a = ray.dir * ray.dir;
+  b = 2 * (ray.dir * oc);
+  c = oc * oc - radius * radius;
 
   d = b*b - 4*a*c;
 
@@ -212,14 +217,25 @@ bool Sphere::rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxPara
   t0 = (-b + d) / (2*a);
   t1 = (-b - d) / (2*a);
 
-  intParam = (t0 < t1 ? t0 : t1);
+  // Take the nearer root that's not before ray.tmin (which is the far
+  // root if the ray starts inside the sphere)
+
+  float tNear = (t0 < t1 ? t0 : t1);
+  float tFar  = (t0 < t1 ? t1 : t0);
 
-  if (intParam > maxParam)
+  if (tNear >= ray.tmin)
+    intParam = tNear;
+  else if (tFar >= ray.tmin)
+    intParam = tFar;
+  else
+    return false; // behind the starting point
+
+  if (intParam > ray.tmax)
     return false; // too far away
 
   // Compute the point of intersection
 
-  intPoint = rayStart + intParam * rayDir;
+  intPoint = ray.at( intParam );
 
   // Compute the normal at the intersection point
 
@@ -261,6 +277,9 @@ void Sphere::input( istream &stream )
 void Sphere::renderGL( GPUProgram *prog, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS, float s )
 
 {
+  if (VAO == 0)
+    setupVAO();
+
   mat->setMaterialForOpenGL( prog );
 
   mat4 MV  = WCS_to_VCS * translate( centre ) * scale( s, s, s );
@@ -275,7 +294,7 @@ void Sphere::renderGL( GPUProgram *prog, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS, flo
 }
 
 
-vec3 Sphere::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords )
+vec3 Sphere::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint )
 
 {
   // No texture map?
@@ -293,5 +312,8 @@ vec3 Sphere::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCo
   float phi = atan2( dir.y, dir.x ) / (2*PI);
   if (phi < 0) phi++;
 
-  return mat->texture->texel( phi, theta, alpha );
+  // The texture covers the sphere's area, 4 pi r^2, so it has about
+  // 1/(2 r sqrt(pi)) texture units per world unit
+
+  return mat->texture->texel( phi, theta, footprint / (2 * radius * sqrt(PI)), alpha );
 }
@@ -75,18 +75,18 @@ class Sphere: public Object {
 
     //gpu.init( vertShader, fragShader, "in sphere.h" );
 
-    setupVAO();
+    VAO = 0; // set up in renderGL() so that no OpenGL context is needed until then
   };
 
   ~Sphere() {}
 
-  bool rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxParam,
+  bool rayInt( Ray &ray,
 	       vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material * & mat, int &intPartIndex );
 
   void input( istream &stream );
   void output( ostream &stream ) const;
 
-  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords );
+  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint );
 
   void renderGL( GPUProgram *prog, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS, float scale );
 
@@ -5,20 +5,31 @@
 #include "headers.h"
 #ifndef _WIN32
   #include <unistd.h>
+  #include <sys/mman.h>
+#else
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h>
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <cctype>
 #include <cstring>
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
 #include <math.h>
+#include <chrono>
+#include <stdexcept>
 
 #ifdef HAVEPNG
   #include <png.h>
 #endif
 
 #include "texture.h"
+#include "threadPool.h"
+#include "rtStats.h"
 
 using namespace std;
 
@@ -45,93 +56,160 @@ void Texture::registerWithOpenGL( )
   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
-  glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), width, height, 0,
-		(hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, texmap );
+  if (!topDown)
+    glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), width, height, 0,
+		  (hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, texmap );
+  else {
+
+    // OpenGL wants the bottom row first, so send the rows one at a
+    // time rather than flipping a copy of texmap
+
+    glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), width, height, 0,
+		  (hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, NULL );
+
+    for (int y=0; y<height; y++)
+      glTexSubImage2D( GL_TEXTURE_2D, 0, 0, y, width, 1,
+		       (hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, texmapRow( y ) );
+  }
 
   glGenerateMipmap( GL_TEXTURE_2D );
 }
 
 
-/* Read a texture from a P6 PPM file
+/* Read the texture from file 'name'.  This runs on a thread of the
+ * pool, so errors are thrown (as runtime_error) rather than reported
+ * here, and finishLoading() reports them on the main thread.
  */
 
 
-unsigned char *Texture::readP6( char *filename )
+void Texture::read()
 
 {
-  char buffer[1000];
-  int i, xdim, ydim;
-  unsigned char *a, *b, *pa, *pb;
+  char *p = strrchr( name, '.' );
+  if (p == NULL || strcmp( p, ".ppm" ) == 0)
+    texmap = mapP6( name );
+  else
+    texmap = readPNG( name );
+
+  buildLevels();
+}
+
+
+/* Map a texture from a P6 PPM file into memory.  The header is parsed
+ * in place and texmap points at the pixels in the mapped file, which
+ * are not copied.  They are stored top row first, so topDown is set.
+ */
+
+
+GLubyte *Texture::mapP6( char *filename )
+
+{
+  // Map the file
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+  if (file == INVALID_HANDLE_VALUE) {
+    throw runtime_error( string("Open of `") + filename + "' failed." );
+  }
+
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx( file, &fileSize );
+  mappingSize = (size_t) fileSize.QuadPart;
 
-  ifstream f( filename, ios::binary | ios::in );
+  HANDLE fileMapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+  mapping = (fileMapping == NULL ? NULL : MapViewOfFile( fileMapping, FILE_MAP_READ, 0, 0, 0 ));
 
-  if (!f) {
-    cerr << "Open of `" << filename << "' failed.\n";
-    exit(1);
+  if (fileMapping != NULL)
+    CloseHandle( fileMapping );
+  CloseHandle( file );
+#else
+  int fd = open( filename, O_RDONLY );
+  if (fd < 0) {
+    throw runtime_error( string("Open of `") + filename + "' failed." );
   }
 
-  // first line
+  struct stat st;
+  fstat( fd, &st );
+  mappingSize = st.st_size;
 
-  do {
-    i = 0;
-    do 
-      f.read(&buffer[i],1);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
+  mapping = mmap( NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+  if (mapping == MAP_FAILED)
+    mapping = NULL;
+
+  close( fd );
+#endif
 
-  if (strncmp( buffer, "P6", 2 ) != 0) {
-    cerr << filename << " is not a P6 file.\n";
-    exit(1);
+  if (mapping == NULL) {
+    throw runtime_error( string("Can't map `") + filename + "' into memory." );
   }
 
-  // second line
-
-  do {
-    i = 0;
-    do 
-      f.read(&buffer[i],1);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-  buffer[i] = '\0';
-  sscanf( buffer, "%d %d", &xdim, &ydim );
-
-  width = xdim;
-  height = ydim;
-
-  // third line
-
-  do {
-    i = 0;
-    do 
-      f.read(&buffer[i],1);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-  if (strncmp( buffer, "255", 3 ) != 0) {
-    cerr << filename << " is not a 24-bit file.\n";
-    exit(1);
+  // Parse the header: "P6", then the width, height, and maximum
+  // value, separated by whitespace and comments, then one whitespace
+  // character before the pixels
+
+  const char *p   = (const char *) mapping;
+  const char *end = p + mappingSize;
+
+  if (mappingSize < 2 || strncmp( p, "P6", 2 ) != 0) {
+    throw runtime_error( string(filename) + " is not a P6 file." );
   }
 
-  // read the data (stored top-to-bottom, left-to-right)
+  p += 2;
 
-  a = new unsigned char[ xdim * ydim * 3 ];
-  f.read( (char *) a, xdim*ydim*3 );
+  int fields[3];
 
-  // flip the image vertically (stored bottom-to-top, left-to-right)
+  for (int k=0; k<3; k++) {
 
-  b = new unsigned char[ xdim * ydim * 3 ];
+    while (p < end && (isspace( *p ) || *p == '#'))
+      if (*p == '#')
+	while (p < end && *p != '\n')
+	  p++;
+      else
+	p++;
+
+    if (p == end || !isdigit( *p )) {
+      throw runtime_error( string(filename) + " has a bad P6 header." );
+    }
 
-  for (i=0; i<ydim; i++) {
-    pa = a + (i)*xdim*3;
-    pb = b + (ydim-1-i)*xdim*3;
-    for (int j=0; j<xdim*3; j++)
-      *(pb++) = *(pa++);
+    fields[k] = 0;
+    while (p < end && isdigit( *p ))
+      fields[k] = 10 * fields[k] + (*p++ - '0');
   }
 
-  delete [] a;
+  p++;
+
+  if (fields[2] != 255) {
+    throw runtime_error( string(filename) + " is not a 24-bit file." );
+  }
+
+  width  = fields[0];
+  height = fields[1];
+
+  if (p > end || (size_t) (end - p) < 3 * (size_t) width * height) {
+    throw runtime_error( string(filename) + " is shorter than its " + to_string( width ) + " x " + to_string( height ) + " pixels." );
+  }
 
   hasAlpha = false;
+  topDown  = true;
 
-  return b;
+  return (GLubyte *) p;
+}
+
+
+void Texture::freeTexmap()
+
+{
+  if (mapping != NULL) {
+#ifdef _WIN32
+    UnmapViewOfFile( mapping );
+#else
+    munmap( mapping, mappingSize );
+#endif
+    mapping = NULL;
+  } else
+    delete [] texmap;
+
+  texmap = NULL;
 }
 
 #ifdef HAVEPNG
@@ -159,8 +237,7 @@ unsigned char *Texture::readPNG( char *filename )
 
   FILE *fp = fopen(filename, "rb");
   if (!fp) {
-    cerr << "Can't open PNG texture file '" << filename << "'." << endl;
-    exit(-1);
+    throw runtime_error( string("Can't open PNG texture file '") + filename + "'." );
   }
 
   // Check header
@@ -168,8 +245,8 @@ unsigned char *Texture::readPNG( char *filename )
   int dummyStatus = fread( header, 1, PNG_BYTES_TO_CHECK, fp );
   bool is_png = !png_sig_cmp( (png_byte*) &header[0], 0, PNG_BYTES_TO_CHECK);
   if (!is_png) {
-    cerr << "Texture file '" << filename << "' is not in PNG format." << endl;
-    exit(-1);
+    fclose(fp);
+    throw runtime_error( string("Texture file '") + filename + "' is not in PNG format." );
   }
 
   /* Create and initialize the png_struct with the desired error handler
@@ -182,9 +259,8 @@ unsigned char *Texture::readPNG( char *filename )
   png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
 
   if (png_ptr == NULL) {
-    cerr << "Can't initialize PNG file for reading: " << filename << endl;
     fclose(fp);
-    exit(-1);
+    throw runtime_error( string("Can't initialize PNG file for reading: ") + filename );
   }
 
   /* Allocate/initialize the memory for image information.  REQUIRED. */
@@ -194,8 +270,7 @@ unsigned char *Texture::readPNG( char *filename )
     {
       fclose(fp);
       png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-      cerr << "Can't allocate memory to read PNG file: " << filename << endl;
-      exit(-1);
+      throw runtime_error( string("Can't allocate memory to read PNG file: ") + filename );
     }
 
   /* Set error handling if you are using the setjmp/longjmp method (this is
@@ -208,8 +283,7 @@ unsigned char *Texture::readPNG( char *filename )
     png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
     fclose(fp);
     /* If we get here, we had a problem reading the file */
-    cerr << "Exception occurred while reading PNG file: " << filename << endl;
-    exit(-1);
+    throw runtime_error( string("Exception occurred while reading PNG file: ") + filename );
   }
 
   /* Set up the input control if you are using standard C streams */
@@ -230,9 +304,11 @@ unsigned char *Texture::readPNG( char *filename )
   int numChannels = png_get_channels(png_ptr, info_ptr);
 
   if (png_get_bit_depth(png_ptr, info_ptr) != 8) {
-    cerr << "Can't handle PNG files with bit depth other than 8.  '" << filename
-	 << "' has " << png_get_bit_depth(png_ptr, info_ptr) << " bits per pixel." << endl;
-    exit(-1);
+    string msg = string("Can't handle PNG files with bit depth other than 8.  '") + filename
+      + "' has " + to_string( png_get_bit_depth(png_ptr, info_ptr) ) + " bits per pixel.";
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+    fclose(fp);
+    throw runtime_error( msg );
   }
 
 
@@ -259,9 +335,10 @@ unsigned char *Texture::readPNG( char *filename )
 	*(pb)++ = row[c];
 	break;
       case 2:
-	cerr << "Can't handle a two-channel PNG file: " << filename << endl;
-	exit(-1);
-	break;
+	delete [] b;
+	png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+	fclose(fp);
+	throw runtime_error( string("Can't handle a two-channel PNG file: ") + filename );
       case 3:
       case 4:
 	*(pb)++ = row[c];
@@ -278,8 +355,160 @@ unsigned char *Texture::readPNG( char *filename )
 
   return b;
 }
+
+#else
+
+unsigned char *Texture::readPNG( char *filename )
+
+{
+  throw runtime_error( string("Trying to read PNG file \"") + filename + "\", but the program wasn't compiled with -DHAVEPNG." );
+}
+
 #endif
 
+
+// ---- shared textures ----
+
+
+unordered_map<string,Texture*> Texture::loaded;
+
+
+// The canonical path of a file, so that different names for the same
+// file (like "data/../data/brick.ppm") give the same texture.  If the
+// file doesn't exist, its name is returned and the load reports the
+// error.
+
+static string canonicalPath( const char *filename )
+
+{
+#ifdef _WIN32
+  char *full = _fullpath( NULL, filename, 0 );
+#else
+  char *full = realpath( filename, NULL );
+#endif
+
+  if (full == NULL)
+    return string( filename );
+
+  string path( full );
+  free( full );
+  return path;
+}
+
+
+// Return the texture from a file, starting to load it if it's not
+// already loaded.  Call release() when done with it.
+//
+// The texture is read on another thread, and can't be used until
+// finishLoading() or finishLoads() is called.
+
+Texture *Texture::load( const char *filename )
+
+{
+  string path = canonicalPath( filename );
+
+  unordered_map<string,Texture*>::iterator i = loaded.find( path );
+
+  if (i != loaded.end()) {
+    i->second->addReference();
+    return i->second;
+  }
+
+  Texture *t = new Texture();
+  t->name = strdup( filename );
+  t->path = path;
+  t->reading = ThreadPool::shared().submit( [t] { t->read(); } );
+
+  loaded[ path ] = t;
+
+  return t;
+}
+
+
+// Wait for all textures to be read.  If there's an OpenGL context,
+// also register each texture with OpenGL (on this thread) as it
+// becomes ready.
+//
+// The textures are taken in the order in which their reads finish,
+// so that one that's been read is registered while slower ones are
+// still being read.  This waits only when none is ready.
+
+void Texture::finishLoads()
+
+{
+  bool haveContext = (glfwGetCurrentContext() != NULL);
+
+  seq<Texture*> pending;
+
+  for (auto &entry : loaded)
+    if (entry.second->reading.valid())
+      pending.add( entry.second );
+
+  while (pending.size() > 0) {
+
+    int i;
+    for (i=0; i<pending.size(); i++)
+      if (pending[i]->reading.wait_for( chrono::seconds(0) ) == future_status::ready)
+	break;
+
+    if (i == pending.size()) {	// none is ready, so wait a little for one
+      pending[0]->reading.wait_for( chrono::milliseconds(1) );
+      continue;
+    }
+
+    Texture *t = pending[i];
+
+    pending[i] = pending[ pending.size()-1 ];
+    pending.remove();
+
+    t->finishLoading();
+    if (haveContext)
+      t->texID();
+  }
+}
+
+
+void Texture::release()
+
+{
+  finishLoading();
+
+  if (--refCount > 0)
+    return;
+
+  if (!path.empty())
+    loaded.erase( path );
+
+  if (textureID != 0)
+    glDeleteTextures( 1, &textureID );
+
+  delete this;
+}
+
+
+// 8-bit channel values as floats in [0,1], so that lookups need no
+// divisions
+
+static float unitFloat[256];
+
+static bool fillUnitFloat()
+
+{
+  for (int i=0; i<256; i++)
+    unitFloat[i] = i / 255.0f;
+  return true;
+}
+
+static bool unitFloatFilled = fillUnitFloat();
+
+
+static inline vec4 unitTexel( GLubyte *p )
+
+{
+  return vec4( unitFloat[ p[0] ], unitFloat[ p[1] ], unitFloat[ p[2] ], unitFloat[ p[3] ] );
+}
+
+
 // Find the texel at [i][j] for i,j in [0,1]
 
 vec3 Texture::texel( float i, float j, float &alpha )
@@ -296,20 +525,348 @@ vec3 Texture::texel( float i, float j, float &alpha )
   if (y<0) y = 0;
   if (y>height-1) y = height-1;
 
-  unsigned char *p;
-  vec3 colour;
+  GLubyte *p = texelBytes( 0, x, y );
 
-  p = texmap + (hasAlpha ? 4 : 3) * (y*width + x);
+  alpha = unitFloat[ p[3] ];
 
-  colour.x = (*p++)/255.0f;
-  colour.y = (*p++)/255.0f;
-  colour.z = (*p++)/255.0f;
+  return vec3( unitFloat[ p[0] ], unitFloat[ p[1] ], unitFloat[ p[2] ] );
+}
+
+
+// ---- pages ----
+
+
+size_t Texture::memoryBudget  = 0;
+size_t Texture::residentBytes = 0;
+
+seq<Texture::PageRef> Texture::residentPages;
+int                   Texture::clockHand = 0;
+seq<TexPage*>         Texture::freePages;
+Arena                 Texture::pageArena( 1 << 20 );
 
-  if (hasAlpha)
-    alpha = (*p++)/255.0f;
-  else
-    alpha = 1;
 
-  return colour;
+// The texel at (x,y) of a level, as RGBA in [0,1]
+
+vec4 Texture::texelAt( int level, int x, int y )
+
+{
+  return unitTexel( texelBytes( level, x, y ) );
+}
+
+
+// Make page 'index' of a level.  Level 0 is copied from texmap.  Each
+// mipmap level is a 2x2 box filter of the level before it (whose
+// pages are made as needed), down to a single texel.  An odd row or
+// column is averaged into its neighbour.
+//
+// A mipmap page is filled a quarter at a time, as each quarter is
+// filtered from a single page of the level before.  That page then
+// stays resident while the quarter reads it, however small the memory
+// budget, rather than the pages of the level before evicting one
+// another.
+
+TexPage *Texture::makePage( int level, int index )
+
+{
+  TexLevel &l = levels[ level ];
+
+  int x0 = (index % l.pagesPerRow) * TEX_PAGE_SIZE;
+  int y0 = (index / l.pagesPerRow) * TEX_PAGE_SIZE;
+  int x1 = MIN( x0 + TEX_PAGE_SIZE, l.width );
+  int y1 = MIN( y0 + TEX_PAGE_SIZE, l.height );
+
+  STAT_INC( texPagesMade );
+
+  TexPage *page = allocPage();
+
+  int nc = (hasAlpha ? 4 : 3);
+
+  if (level == 0)
+
+    for (int y=y0; y<y1; y++) {
+
+      GLubyte *src   = texmapRow( y ) + nc * x0;
+      TexTile *tiles = page->tiles + ((y-y0) / TEX_TILE_SIZE) * TEX_PAGE_TILES;
+      int      row   = (y % TEX_TILE_SIZE) * TEX_TILE_SIZE;
+
+      for (int x=x0; x<x1; x++, src += nc) {
+	GLubyte *dst = tiles[ (x-x0) / TEX_TILE_SIZE ].texels[ row + x % TEX_TILE_SIZE ];
+	dst[0] = src[0];
+	dst[1] = src[1];
+	dst[2] = src[2];
+	dst[3] = (hasAlpha ? src[3] : 255);
+      }
+    }
+
+  else {
+
+    TexLevel &below = levels[ level-1 ];
+
+    const int half = TEX_PAGE_SIZE/2;
+
+    for (int qy=y0; qy<y1; qy+=half)
+      for (int qx=x0; qx<x1; qx+=half)
+	for (int y=qy; y<MIN(qy+half,y1); y++)
+	  for (int x=qx; x<MIN(qx+half,x1); x++) {
+
+	    int sx0 = (below.width  > 1 ? 2*x : 0);
+	    int sy0 = (below.height > 1 ? 2*y : 0);
+	    int sx1 = (x == l.width-1  ? below.width  : sx0+2);   // the last column takes any odd column
+	    int sy1 = (y == l.height-1 ? below.height : sy0+2);
+
+	    int n = (sy1-sy0) * (sx1-sx0);
+	    int sum[4] = { n/2, n/2, n/2, n/2 };
+
+	    for (int sy=sy0; sy<sy1; sy++)
+	      for (int sx=sx0; sx<sx1; sx++) {
+		GLubyte *src = texelIn( residentPage( level-1, sx, sy, false ), sx, sy );
+		for (int c=0; c<4; c++)
+		  sum[c] += src[c];
+	      }
+
+	    GLubyte *dst = page->tiles[ ((y-y0) / TEX_TILE_SIZE) * TEX_PAGE_TILES + ((x-x0) / TEX_TILE_SIZE) ].texels[ (y % TEX_TILE_SIZE) * TEX_TILE_SIZE + (x % TEX_TILE_SIZE) ];
+
+	    for (int c=0; c<4; c++)
+	      dst[c] = sum[c] / n;
+	  }
+  }
+
+  // Make it resident
+
+  l.pages[ index ] = page;
+
+  PageRef ref;
+  ref.texture = this;
+  ref.level   = level;
+  ref.index   = index;
+  residentPages.add( ref );
+
+  return page;
+}
+
+
+// Get memory for a page, evicting others if that would exceed the
+// memory budget
+
+TexPage *Texture::allocPage()
+
+{
+  if (memoryBudget > 0)
+    while (residentBytes + sizeof(TexPage) > memoryBudget && residentPages.size() > 0)
+      evictPage();
+
+  residentBytes += sizeof(TexPage);
+
+  if (freePages.size() > 0) {
+    TexPage *page = freePages[ freePages.size()-1 ];
+    freePages.remove();
+    return page;
+  }
+
+  return pageArena.alloc<TexPage>();
+}
+
+
+// Evict a page that hasn't been sampled recently, by the CLOCK
+// approximation of least-recently-used: the clock hand sweeps the
+// resident pages, evicting the first whose credit is used up and
+// taking one from each of the others that it passes.  Sampling a page
+// restores its credit.
+//
+// A page of mipmap level k gets 4^k credits (up to 255), as it is
+// made from 4^k pages of the texmap, and so costs that much more to
+// make again.  Otherwise the texmap pages that are read to make a
+// coarse page would evict the other coarse pages, which would then
+// have to be made again from texmap pages.
+
+void Texture::evictPage()
+
+{
+  while (true) {
+
+    if (clockHand >= residentPages.size())
+      clockHand = 0;
+
+    PageRef  &ref = residentPages[ clockHand ];
+    TexLevel &l   = ref.texture->levels[ ref.level ];
+
+    if (l.credit[ ref.index ] > 0) {
+      l.credit[ ref.index ]--;
+      clockHand++;
+      continue;
+    }
+
+    freePages.add( l.pages[ ref.index ] );
+    l.pages[ ref.index ] = NULL;
+
+    residentPages[ clockHand ] = residentPages[ residentPages.size()-1 ];
+    residentPages.remove();
+
+    residentBytes -= sizeof(TexPage);
+    STAT_INC( texPageEvictions );
+    return;
+  }
 }
 
+
+// Set up the levels that the ray tracer samples: the texmap and, if
+// useMipMaps, its mipmaps.  No pages are made until they're sampled,
+// so this doesn't touch the pages shared with other textures, and can
+// run on a loading thread.
+
+void Texture::buildLevels()
+
+{
+  int w = width;
+  int h = height;
+
+  while (true) {
+
+    TexLevel l;
+
+    l.width       = w;
+    l.height      = h;
+    l.pagesPerRow = (w + TEX_PAGE_SIZE-1) / TEX_PAGE_SIZE;
+    l.fullCredit  = (levels.size() < 4 ? 1 << (2*levels.size()) : 255);
+
+    int numPages = l.pagesPerRow * ((h + TEX_PAGE_SIZE-1) / TEX_PAGE_SIZE);
+
+    l.pages   = new TexPage*[ numPages ];
+    l.credit  = new GLubyte[ numPages ];
+
+    for (int i=0; i<numPages; i++) {
+      l.pages[i] = NULL;
+      l.credit[i] = 0;
+    }
+
+    levels.add( l );
+
+    if (!useMipMaps || (w == 1 && h == 1))
+      break;
+
+    w = MAX( w/2, 1 );
+    h = MAX( h/2, 1 );
+  }
+}
+
+
+// Free the levels and their resident pages
+
+void Texture::freeLevels()
+
+{
+  for (int i=0; i<residentPages.size(); )
+    if (residentPages[i].texture == this) {
+      PageRef &ref = residentPages[i];
+      freePages.add( levels[ ref.level ].pages[ ref.index ] );
+      residentBytes -= sizeof(TexPage);
+      residentPages[i] = residentPages[ residentPages.size()-1 ];
+      residentPages.remove();
+    } else
+      i++;
+
+  for (TexLevel &l : levels) {
+    delete [] l.pages;
+    delete [] l.credit;
+  }
+
+  levels.clear();
+}
+
+
+// Bilinear interpolation in a level at [i][j] for i,j in [0,1), with
+// texel centres at half-integer positions and wrapping at the edges
+// (as with GL_REPEAT).  Returns RGBA.
+
+vec4 Texture::bilinear( int level, float i, float j )
+
+{
+  TexLevel &l = levels[ level ];
+
+  float x = i * l.width  - 0.5;
+  float y = j * l.height - 0.5;
+
+  int x0 = (int) floor( x );
+  int y0 = (int) floor( y );
+
+  float fx = x - x0;
+  float fy = y - y0;
+
+  if (x0 < 0) x0 += l.width;	// x0 and y0 are at least -1
+  if (y0 < 0) y0 += l.height;
+
+  int x1 = (x0+1 == l.width  ? 0 : x0+1);
+  int y1 = (y0+1 == l.height ? 0 : y0+1);
+
+  vec4 c00, c10, c01, c11;
+
+  if (x0 / TEX_PAGE_SIZE == x1 / TEX_PAGE_SIZE && y0 / TEX_PAGE_SIZE == y1 / TEX_PAGE_SIZE) {
+
+    // All in one page, as is usual, so find it once
+
+    TexPage *page = residentPage( level, x0, y0 );
+
+    c00 = unitTexel( texelIn( page, x0, y0 ) );
+    c10 = unitTexel( texelIn( page, x1, y0 ) );
+    c01 = unitTexel( texelIn( page, x0, y1 ) );
+    c11 = unitTexel( texelIn( page, x1, y1 ) );
+
+  } else {
+
+    c00 = texelAt( level, x0, y0 );
+    c10 = texelAt( level, x1, y0 );
+    c01 = texelAt( level, x0, y1 );
+    c11 = texelAt( level, x1, y1 );
+  }
+
+  float w00 = (1-fx) * (1-fy);
+  float w10 = fx * (1-fy);
+  float w01 = (1-fx) * fy;
+  float w11 = fx * fy;
+
+  vec4 c;
+  for (int k=0; k<4; k++)
+    c[k] = w00 * c00[k] + w10 * c10[k] + w01 * c01[k] + w11 * c11[k];
+
+  return c;
+}
+
+
+// Find the texture colour at [i][j], averaged over a region about
+// 'footprint' wide in texture coordinates (which span [0,1] across
+// the texture).  This is trilinear filtering between the two mipmap
+// levels whose texels are closest to the footprint in size.
+//
+// If the footprint is smaller than a texel, or there are no mipmaps,
+// this is the unfiltered lookup above, as in the OpenGL
+// GL_NEAREST magnification filter.
+
+vec3 Texture::texel( float i, float j, float footprint, float &alpha )
+
+{
+  if (levels.size() < 2 || footprint <= 0)
+    return texel( i, j, alpha );
+
+  float lambda = log2f( footprint * MAX( width, height ) );
+
+  if (lambda <= 0)
+    return texel( i, j, alpha );
+
+  i = i - floor(i);
+  j = j - floor(j);
+
+  int maxLevel = levels.size()-1;
+  vec4 c;
+
+  if (lambda >= maxLevel)
+    c = bilinear( maxLevel, i, j );
+  else {
+    int   level = (int) lambda;
+    float f     = lambda - level;
+    c = (1-f) * bilinear( level, i, j ) + f * bilinear( level+1, i, j );
+  }
+
+  alpha = c.w;
+
+  return vec3( c.x, c.y, c.z );
+}
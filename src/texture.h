@@ -1,4 +1,27 @@
 /* texture.h
+ *
+ * A texture map, read from a PPM (or, with HAVEPNG, a PNG) file.
+ *
+ * Textures read from files are shared: Texture::load() returns the
+ * texture already loaded from the same file (by its canonical path),
+ * if there is one, and otherwise loads it.  Each load() or
+ * addReference() is matched by a release(), and the texture is
+ * deleted at the last release().
+ *
+ * load() returns at once and reads the file on a thread of
+ * ThreadPool::shared(), so that many textures are decoded in
+ * parallel while the scene is read.  Texture::finishLoads() waits for
+ * them all, and must be called before the textures are sampled.
+ * texID() waits for its own texture.
+ *
+ * The ray tracer samples a tiled copy of the texture (and its
+ * mipmaps), which is made one page at a time, the first time that a
+ * page is sampled.  Pages from all textures share a memory budget,
+ * Texture::memoryBudget.  When it is exceeded, pages that have not
+ * been sampled recently are evicted, to be made again if needed.  So
+ * a scene can use more texture data than fits in memory, provided
+ * that each frame samples a part that fits.  Sampling is not
+ * thread-safe.
  */
 
 
@@ -7,21 +30,131 @@
 
 #include "headers.h"
 #include <cstring>
+#include <string>
+#include <unordered_map>
+#include <future>
+#include <stdexcept>
 #include "seq.h"
 #include "linalg.h"
+#include "arena.h"
+#include "rtStats.h"
+
+
+// For lookups in the ray tracer, the texture is copied into 4x4
+// tiles of RGBA texels, each tile being one 64-byte cache line.  A
+// bilinear lookup then usually reads one tile, and at most four,
+// whereas in row-major order the two rows are far apart.
+//
+// The tiles are grouped into pages of 64x64 texels (16 kB), which are
+// the units that are made on demand and evicted.
+
+#define TEX_TILE_SIZE 4
+#define TEX_PAGE_SIZE 64
+#define TEX_PAGE_TILES (TEX_PAGE_SIZE / TEX_TILE_SIZE)
+
+struct alignas(64) TexTile {
+  GLubyte texels[TEX_TILE_SIZE*TEX_TILE_SIZE][4];
+};
+
+struct TexPage {
+  TexTile tiles[TEX_PAGE_TILES*TEX_PAGE_TILES];
+};
+
+struct TexLevel {
+  int width, height;
+  int pagesPerRow;
+  TexPage **pages;		// NULL for a page that isn't resident
+  GLubyte  *credit;		// passes of the eviction clock that the page survives unsampled
+  GLubyte   fullCredit;		// ... after it's sampled
+};
+
 
 class Texture {
 
-  GLubyte *texmap;		/* texture map */
+  GLubyte *texmap;		/* texture map (row-major, bottom row first unless topDown) */
   int width, height;		/* texmap dimensions */
   bool hasAlpha;		/* true if alpha channel exists */
+  bool topDown;			/* texmap has the top row first, as in a PPM file */
+
+  void  *mapping;		/* the memory-mapped file that texmap is in, or NULL */
+  size_t mappingSize;
+
+  seq<TexLevel> levels;		/* tiled texmap, then (if useMipMaps) each level half the size of the one before */
+
+  int    refCount;		/* references from load() and addReference() */
+  string path;			/* canonical path, as the key in 'loaded' */
+  future<void> reading;		/* valid while the file is being read on another thread */
+
+  static unordered_map<string,Texture*> loaded; /* textures read from files, by canonical path */
+
+  // Resident pages of all textures, in the order of the eviction clock
+
+  struct PageRef {
+    Texture *texture;
+    int level;
+    int index;
+  };
+
+  static seq<PageRef>  residentPages;
+  static int           clockHand;
+  static seq<TexPage*> freePages;
+  static Arena         pageArena;
 
   void registerWithOpenGL();
-  GLubyte *readP6( char *filename );
-  //GLubyte *readPNG( char *filename );
+  void buildLevels();
+  void freeLevels();
+  vec4 texelAt( int level, int x, int y );
+  TexPage *makePage( int level, int index );
+  static TexPage *allocPage();
+  static void evictPage();
+  vec4 bilinear( int level, float i, float j );
+  void read();
+  GLubyte *mapP6( char *filename );
+  void freeTexmap();
+
+  GLubyte *texmapRow( int y ) {	/* row y, counting up from the bottom */
+    return texmap + (hasAlpha ? 4 : 3) * width * (topDown ? height-1-y : y);
+  }
+
+  /* The page of a level that has texel (x,y), making it if it isn't
+   * resident.  The page is good only until the next page is made,
+   * which might evict it.  A lookup that finds the page resident is
+   * counted as a hit if 'counted' (that is, unless it's from making a
+   * mipmap page).
+   */
+
+  TexPage *residentPage( int level, int x, int y, bool counted = true ) {
+
+    TexLevel &l = levels[ level ];
+
+    int index = (y / TEX_PAGE_SIZE) * l.pagesPerRow + (x / TEX_PAGE_SIZE);
+
+    if (l.pages[ index ] == NULL)
+      makePage( level, index );
+    else if (counted)
+      STAT_INC( texPageHits );
+
+    l.credit[ index ] = l.fullCredit;
+
+    return l.pages[ index ];
+  }
+
+  /* The RGBA bytes of texel (x,y) of a level, which is in 'page' */
+
+  static GLubyte *texelIn( TexPage *page, int x, int y ) {
+    x %= TEX_PAGE_SIZE;
+    y %= TEX_PAGE_SIZE;
+    return page->tiles[ (y / TEX_TILE_SIZE) * TEX_PAGE_TILES + (x / TEX_TILE_SIZE) ].texels[ (y % TEX_TILE_SIZE) * TEX_TILE_SIZE + (x % TEX_TILE_SIZE) ];
+  }
+
+  GLubyte *texelBytes( int level, int x, int y ) {
+    return texelIn( residentPage( level, x, y ), x, y );
+  }
 
   friend class Material;
+  friend class wfMaterial;
   friend class WavefrontObj;
+  friend class KernelBench;
 
  public:
 
@@ -29,29 +162,72 @@ class Texture {
 
   static bool useMipMaps;
 
+  static size_t memoryBudget;	/* bytes of resident pages, over all textures (0 for no limit) */
+  static size_t residentBytes;
+
   char *name;			/* filename */
 
-  Texture() {}
+  Texture() {
+    texmap = NULL;
+    topDown = false;
+    mapping = NULL;
+    name = NULL;
+    refCount = 1;
+    textureID = 0;
+  }
 
   Texture( char *filename ) {
-    char *p = strrchr( filename, '.' );
-    if (p == NULL || strcmp( p, ".ppm" ) == 0)
-      texmap = readP6( filename );
-#ifdef HAVEPNG
-    else
-      texmap = readPNG( filename );
-#endif
+    topDown = false;
+    mapping = NULL;
     name = strdup( filename );
-    registerWithOpenGL();
+    refCount = 1;
+    textureID = 0; // registered on first use, so that no OpenGL context is needed until then
+    try {
+      read();
+    } catch (runtime_error &e) {
+      cerr << e.what() << endl;
+      exit(1);
+    }
   }
 
+  ~Texture() {
+    freeLevels();
+    freeTexmap();
+    free( name );
+  }
+
+  static Texture *load( const char *filename );
+  static void finishLoads();
+
+  // Wait for the read, and report any error from it here, as the
+  // reading thread can't exit
+
+  void finishLoading() {
+    if (reading.valid())
+      try {
+	reading.get();		// (rethrows anything thrown while reading)
+      } catch (runtime_error &e) {
+	cerr << e.what() << endl;
+	exit(1);
+      }
+  }
+
+  void addReference() {
+    refCount++;
+  }
+
+  void release();
+
   GLuint texID() {
+    finishLoading();
+    if (textureID == 0)
+      registerWithOpenGL();
     return textureID;
   }
 
   void makeActive() {
     glEnable( GL_TEXTURE_2D );
-    glBindTexture( GL_TEXTURE_2D, textureID );
+    glBindTexture( GL_TEXTURE_2D, texID() );
     if (hasAlpha) {
       glEnable(GL_BLEND);
       glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -60,12 +236,9 @@ class Texture {
   }
   
   vec3 texel( float i, float j, float &alpha );
+  vec3 texel( float i, float j, float footprint, float &alpha ); // filtered over 'footprint' texture units
 
-  Texture *findTexture( char *name );
-
-#ifdef HAVEPNG
   unsigned char *readPNG( char *filename );
-#endif
 };
 
 
@@ -0,0 +1,111 @@
+/* threadPool.h
+ *
+ * A fixed set of worker threads that run tasks from a queue.
+ *
+ *   CONSTRUCTORS
+ *
+ *     ThreadPool( n )     Start n workers (or one per hardware thread if n is 0)
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     submit( f )         Queue the callable f and return a std::future of its result
+ *     size()              Number of workers
+ *     shared()            A pool with one worker per hardware thread, created on first use
+ *
+ * A task should not wait on the future of another task in the same
+ * pool, as all the workers might then be waiting.
+ *
+ * The destructor finishes the queued tasks before joining the workers,
+ * so a task must not call exit(): throw instead, and the exception is
+ * rethrown by the future's get().
+ */
+
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <queue>
+#include "seq.h"
+
+
+class ThreadPool {
+
+  seq<thread> workers;
+  queue< function<void()> > tasks;
+
+  mutex              queueLock;
+  condition_variable queueChanged;
+  bool               stopping;
+
+  void work() {
+    while (true) {
+      function<void()> task;
+      {
+	unique_lock<mutex> lock( queueLock );
+	queueChanged.wait( lock, [this] { return stopping || !tasks.empty(); } );
+	if (tasks.empty())
+	  return;		// stopping, and nothing left to do
+	task = std::move( tasks.front() );
+	tasks.pop();
+      }
+      task();
+    }
+  }
+
+  ThreadPool( const ThreadPool & );	// not copyable
+  ThreadPool & operator = ( const ThreadPool & );
+
+ public:
+
+  ThreadPool( int numThreads = 0 ) {
+    if (numThreads <= 0)
+      numThreads = thread::hardware_concurrency();
+    if (numThreads <= 0)
+      numThreads = 1;
+    stopping = false;
+    for (int i=0; i<numThreads; i++)
+      workers.emplace( &ThreadPool::work, this );
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> lock( queueLock );
+      stopping = true;
+    }
+    queueChanged.notify_all();
+    for (thread &w : workers)
+      w.join();
+  }
+
+  template<class F>
+  future<typename result_of<F()>::type> submit( F f ) {
+    typedef typename result_of<F()>::type R;
+    // packaged_task is move-only, but function<> needs a copyable callable
+    shared_ptr< packaged_task<R()> > task = make_shared< packaged_task<R()> >( std::move( f ) );
+    future<R> result = task->get_future();
+    {
+      lock_guard<mutex> lock( queueLock );
+      tasks.push( [task] { (*task)(); } );
+    }
+    queueChanged.notify_one();
+    return result;
+  }
+
+  int size() {
+    return workers.size();
+  }
+
+  static ThreadPool & shared() {
+    static ThreadPool pool;
+    return pool;
+  }
+};
+
+
+#endif
@@ -5,32 +5,35 @@
 #include "triangle.h"
 #include "main.h"
 #include "texture.h"
+#include "rtStats.h"
 
 
 // Compute plane/ray intersection, and then the local coordinates to
 // see whether the intersection point is inside.
 
-bool Triangle::rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxParam,
+bool Triangle::rayInt( Ray &ray,
 		       vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material * &mat, int &intPartIndex )
 
 {
   float t;
 
+  STAT_INC( triangleTests );
+
   // Compute ray/plane intersection
 
-  float dn = rayDir * faceNormal;
+  float dn = ray.dir * faceNormal;
 
   if (fabs(dn) < 0.0001) 	// *** CHANGED TO ALLOW INTERSECTION FROM BEHIND TRIANGLE ***
     return false;		// ray is parallel to plane
 
-  t = (dist - rayStart*faceNormal) / dn;
-  if (t < 0)
-    return false; // plane is behind starting point
+  t = (dist - ray.origin*faceNormal) / dn;
+  if (t < ray.tmin)
+    return false; // plane is behind starting point (or too close)
 
-  if (t > maxParam)
+  if (t > ray.tmax)
     return false; // too far away
 
-  vec3 point = rayStart + t * rayDir;
+  vec3 point = ray.at( t );
 
   // Compute barycentric coords
   //
@@ -61,6 +64,8 @@ bool Triangle::rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxPa
     return false;
 
   // Gather information to return
+
+  STAT_INC( triangleHits );
   
   intParam = t;
   intPoint = point;
@@ -94,7 +99,7 @@ bool Triangle::rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxPa
 // Determine the texture colour at a point
 
 
-vec3 Triangle::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords )
+vec3 Triangle::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint )
 
 {
   // No texture map?
@@ -104,7 +109,18 @@ vec3 Triangle::textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &tex
     return vec3(1,1,1);
   }
 
-  return mat->texture->texel( texCoords.x, texCoords.y, alpha );
+  // Texture units per world unit, from the areas of the triangle in
+  // texture space and in world space
+
+  if (footprint > 0) {
+    vec3 t1 = verts[1].texCoords - verts[0].texCoords;
+    vec3 t2 = verts[2].texCoords - verts[0].texCoords;
+    float worldArea = ((verts[1].position - verts[0].position) ^ (verts[2].position - verts[0].position)).length();
+    float texArea   = fabs( t1.x * t2.y - t1.y * t2.x );
+    footprint = (worldArea > 0 ? footprint * sqrt( texArea / worldArea ) : 0);
+  }
+
+  return mat->texture->texel( texCoords.x, texCoords.y, footprint, alpha );
 }
 
 
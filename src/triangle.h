@@ -25,13 +25,13 @@ class Triangle : public Object {
     VAO = 0;
   }
 
-  bool rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxParam,
+  bool rayInt( Ray &ray,
 	       vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material *&mat, int &intPartIndex );
 
   void input( istream &stream );
   void output( ostream &stream ) const;
   void renderGL( GPUProgram *prog, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS );
-  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords );
+  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint );
 };
 
 #endif
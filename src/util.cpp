@@ -0,0 +1,75 @@
+// util.cpp
+//
+// Scene-file parsing and timing helpers shared by all executables
+
+
+#include "headers.h"
+
+#include <ctype.h>
+#include <ctime>
+#include "main.h"
+
+
+// Skip past a comment
+
+int lineNum = 1;
+
+void skipComments( istream &in )
+
+{
+  char c;
+
+  // get next non-space
+
+  do {
+    in.get(c);
+    if (c == '\n')
+      lineNum++;
+  } while (in && isspace(c));
+  in.putback(c);
+
+  // Skip past any comments
+
+  while (c == '#') {
+    do
+      in.get(c);
+    while (in && c != '\n');
+    lineNum++;
+    do {
+      in.get(c);
+      if (c == '\n')
+	lineNum++;
+    } while (in && isspace(c));
+    in.putback(c);
+  }
+}
+
+
+
+float getTime()
+
+{
+  static time_t initialSeconds = 0;  // subtract this from times to avoid loss of float precision
+  
+#ifdef _WIN32
+
+  struct timeb thisTime;
+  ftime( &thisTime );
+
+  if (initialSeconds == 0)
+    initialSeconds = thisTime.time;
+
+  return (thisTime.time-initialSeconds) + thisTime.millitm / 1000.0;
+
+#else
+
+  struct timeval thisTime;
+  gettimeofday( &thisTime, NULL );
+
+  if (initialSeconds == 0)
+    initialSeconds = thisTime.tv_sec;
+
+  return (thisTime.tv_sec-initialSeconds) + thisTime.tv_usec / 1000000.0;
+
+#endif
+}
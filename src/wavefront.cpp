@@ -10,10 +10,6 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#ifdef HAVE_PNG
-  #include <png.h>
-#endif
-
 #include "wavefront.h"
 
 
@@ -36,6 +32,8 @@ void wfModel::read( const char *filename )
   char  buf[1000];
   float x, y, z;
   wfGroup    *currentGroup;
+  int         currentGroupIndex;
+  seq<int>    faceGroup;        /* group index of each face, in the order read */
   wfMaterial *currentMaterial;
   int   nextGroupNum = 0;
 
@@ -52,6 +50,9 @@ void wfModel::read( const char *filename )
   normals.clear();
   texcoords.clear();
   facetnorms.clear();
+  vindices.clear();
+  nindices.clear();
+  tindices.clear();
   materials.clear();
   groups.clear();
 
@@ -59,6 +60,7 @@ void wfModel::read( const char *filename )
 
   groups.add( new wfGroup( "default" ) );
   currentGroup = groups[0];
+  currentGroupIndex = 0;
 
   materials.add( new wfMaterial( "default" ) );
   currentMaterial = materials[0];
@@ -93,7 +95,7 @@ void wfModel::read( const char *filename )
     } else {
 
       int v = 0, n = 0, t = 0;
-      wfTriangle *tri, *prevTri;
+      GLuint fv[3], ft[3], fn[3]; /* indices of the current face */
 
       switch(buf[0]) {
 
@@ -141,6 +143,7 @@ void wfModel::read( const char *filename )
           char buffer[100];
           sprintf( buffer, "g%d", nextGroupNum++ );
           currentGroup = findGroup( buffer );
+          currentGroupIndex = groups.findIndex( currentGroup );
         }
       
         fgets(buf, sizeof(buf), file);
@@ -156,6 +159,7 @@ void wfModel::read( const char *filename )
           currentGroup = findGroup( "default" );
         else
           currentGroup = findGroup( buf );
+        currentGroupIndex = groups.findIndex( currentGroup );
         currentGroup->material = currentMaterial;
         break;
 
@@ -165,7 +169,9 @@ void wfModel::read( const char *filename )
 
         /* can be one of %d, %d//%d, %d/%d, or %d/%d/%d */
 
-        tri = new wfTriangle();
+        fv[0] = fv[1] = fv[2] = 0;
+        ft[0] = ft[1] = ft[2] = 0;
+        fn[0] = fn[1] = fn[2] = 0;
 
         if (strstr(buf, "//")) {        /* v//n */
 
@@ -173,11 +179,12 @@ void wfModel::read( const char *filename )
 
           /* First three vertices define a triangle */
 
-          sscanf(buf, "%d//%d", &v, &n);        v--; checkVindex(v); n--; tri->vindices[0] = v; tri->nindices[0] = n;
-          fscanf(file, "%d//%d", &v, &n);       v--; checkVindex(v); n--; tri->vindices[1] = v; tri->nindices[1] = n;
-          fscanf(file, "%d//%d", &v, &n);       v--; checkVindex(v); n--; tri->vindices[2] = v; tri->nindices[2] = n;
+          sscanf(buf, "%d//%d", &v, &n);        v--; checkVindex(v); n--; fv[0] = v; fn[0] = n;
+          fscanf(file, "%d//%d", &v, &n);       v--; checkVindex(v); n--; fv[1] = v; fn[1] = n;
+          fscanf(file, "%d//%d", &v, &n);       v--; checkVindex(v); n--; fv[2] = v; fn[2] = n;
 
-          currentGroup->triangles.add( tri );
+          addFace( fv, ft, fn );
+          faceGroup.add( currentGroupIndex );
 
           /* More vertices (a convex polygon) are converted to a fan of triangles: */
 
@@ -185,17 +192,11 @@ void wfModel::read( const char *filename )
 
             v--; checkVindex(v); n--;
 
-            prevTri = tri;
-            tri = new wfTriangle();
-
-            tri->vindices[0] = prevTri->vindices[0];
-            tri->nindices[0] = prevTri->nindices[0];
-            tri->vindices[1] = prevTri->vindices[2];
-            tri->nindices[1] = prevTri->nindices[2];
-            tri->vindices[2] = v;
-            tri->nindices[2] = n;
+            fv[1] = fv[2];  fn[1] = fn[2];
+            fv[2] = v;      fn[2] = n;
 
-            currentGroup->triangles.add( tri );
+            addFace( fv, ft, fn );
+            faceGroup.add( currentGroupIndex );
           }
         
         } else if (sscanf(buf, "%d/%d/%d", &v, &t, &n) == 3) {  /* v/t/n */
@@ -204,38 +205,30 @@ void wfModel::read( const char *filename )
 
           v--; checkVindex(v); n--; t--;
 
-          tri->vindices[0] = v;
-          tri->tindices[0] = t;
-          tri->nindices[0] = n;
+          fv[0] = v;
+          ft[0] = t;
+          fn[0] = n;
           fscanf(file, "%d/%d/%d", &v, &t, &n); v--; checkVindex(v); n--; t--;
-          tri->vindices[1] = v;
-          tri->tindices[1] = t;
-          tri->nindices[1] = n;
+          fv[1] = v;
+          ft[1] = t;
+          fn[1] = n;
           fscanf(file, "%d/%d/%d", &v, &t, &n); v--; checkVindex(v); n--; t--;
-          tri->vindices[2] = v;
-          tri->tindices[2] = t;
-          tri->nindices[2] = n;
+          fv[2] = v;
+          ft[2] = t;
+          fn[2] = n;
 
-          currentGroup->triangles.add( tri );
+          addFace( fv, ft, fn );
+          faceGroup.add( currentGroupIndex );
         
           while(fscanf(file, "%d/%d/%d", &v, &t, &n) > 0) {
 
             v--; checkVindex(v); n--; t--;
 
-            prevTri = tri;
-            tri = new wfTriangle();
-
-            tri->vindices[0] = prevTri->vindices[0];
-            tri->tindices[0] = prevTri->tindices[0];
-            tri->nindices[0] = prevTri->nindices[0];
-            tri->vindices[1] = prevTri->vindices[2];
-            tri->tindices[1] = prevTri->tindices[2];
-            tri->nindices[1] = prevTri->nindices[2];
-            tri->vindices[2] = v;
-            tri->tindices[2] = t;
-            tri->nindices[2] = n;
+            fv[1] = fv[2];  ft[1] = ft[2];  fn[1] = fn[2];
+            fv[2] = v;      ft[2] = t;      fn[2] = n;
 
-            currentGroup->triangles.add( tri );
+            addFace( fv, ft, fn );
+            faceGroup.add( currentGroupIndex );
           }
         
         } else if (sscanf(buf, "%d/%d", &v, &t) == 2) { /* v/t */
@@ -244,32 +237,27 @@ void wfModel::read( const char *filename )
 
           v--; checkVindex(v); t--;
 
-          tri->vindices[0] = v;
-          tri->tindices[0] = t;
+          fv[0] = v;
+          ft[0] = t;
           fscanf(file, "%d/%d", &v, &t);        v--; checkVindex(v); t--;
-          tri->vindices[1] = v;
-          tri->tindices[1] = t;
+          fv[1] = v;
+          ft[1] = t;
           fscanf(file, "%d/%d", &v, &t);        v--; checkVindex(v); t--;
-          tri->vindices[2] = v;
-          tri->tindices[2] = t;
+          fv[2] = v;
+          ft[2] = t;
 
-          currentGroup->triangles.add( tri );
+          addFace( fv, ft, fn );
+          faceGroup.add( currentGroupIndex );
 
           while(fscanf(file, "%d/%d", &v, &t) > 0) {
 
             v--; checkVindex(v); t--;
 
-            prevTri = tri;
-            tri = new wfTriangle();
+            fv[1] = fv[2];  ft[1] = ft[2];
+            fv[2] = v;      ft[2] = t;
 
-            tri->vindices[0] = prevTri->vindices[0];
-            tri->tindices[0] = prevTri->tindices[0];
-            tri->vindices[1] = prevTri->vindices[2];
-            tri->tindices[1] = prevTri->tindices[2];
-            tri->vindices[2] = v;
-            tri->tindices[2] = t;
-
-            currentGroup->triangles.add( tri );
+            addFace( fv, ft, fn );
+            faceGroup.add( currentGroupIndex );
           }
         
         } else {        /* v */
@@ -277,26 +265,24 @@ void wfModel::read( const char *filename )
           numV++;
 
           sscanf(buf, "%d", &v); v--; checkVindex(v);
-          tri->vindices[0] = v;
+          fv[0] = v;
           fscanf(file, "%d", &v); v--; checkVindex(v);
-          tri->vindices[1] = v;
+          fv[1] = v;
           fscanf(file, "%d", &v); v--; checkVindex(v);
-          tri->vindices[2] = v;
+          fv[2] = v;
 
-          currentGroup->triangles.add( tri );
+          addFace( fv, ft, fn );
+          faceGroup.add( currentGroupIndex );
         
           while(fscanf(file, "%d", &v) > 0) {
 
             v--; checkVindex(v);
 
-            prevTri = tri;
-            tri = new wfTriangle();
-
-            tri->vindices[0] = prevTri->vindices[0];
-            tri->vindices[1] = prevTri->vindices[2];
-            tri->vindices[2] = v;
+            fv[1] = fv[2];
+            fv[2] = v;
 
-            currentGroup->triangles.add( tri );
+            addFace( fv, ft, fn );
+            faceGroup.add( currentGroupIndex );
           }
         }
         break;
@@ -308,6 +294,10 @@ void wfModel::read( const char *filename )
     }
   }
 
+  // Store the faces of each group contiguously
+
+  sortFacesByGroup( faceGroup );
+
   // Determine a consistent format for each vertex
 
   hasVertexNormals   = (numVTN > 0 || numVN > 0);
@@ -323,25 +313,62 @@ void wfModel::read( const char *filename )
   for (int i=0; i<normals.size(); i++)
     normals[i] = (objToWorldTransform * vec4( normals[i], 0.0 )).toVec3();
 
+  computeFacetNormsAndExtents();
+}
+
+
+// Replace the vertices, which are in object coordinates like those
+// read from the file, and optionally the vertex normals.  The faces
+// stay the same.  This updates the face normals and extents, but not
+// the OpenGL buffers or any BVH of the model.
+
+void wfModel::setVertices( seq<vec3> &newVertices, seq<vec3> *newNormals )
+
+{
+  if (newVertices.size() != vertices.size() || (newNormals != NULL && newNormals->size() != normals.size())) {
+    cerr << "setVertices: model " << (pathname != NULL ? pathname : "") << " has "
+	 << vertices.size() << " vertices and " << normals.size() << " normals, not "
+	 << newVertices.size() << " and " << (newNormals != NULL ? newNormals->size() : normals.size()) << endl;
+    exit(1);
+  }
+
+  for (int i=0; i<vertices.size(); i++)
+    vertices[i] = (objToWorldTransform * vec4( newVertices[i], 1.0 )).toVec3();
+
+  if (newNormals != NULL)
+    for (int i=0; i<normals.size(); i++)
+      normals[i] = (objToWorldTransform * vec4( (*newNormals)[i], 0.0 )).toVec3();
+
+  computeFacetNormsAndExtents();
+}
+
+
+// Compute the face normals and the extents from the (transformed)
+// vertices
+
+void wfModel::computeFacetNormsAndExtents()
+
+{
   // Compute all face normals
 
-  for (int g=0; g<groups.size(); g++)
-    for (int i=0; i<groups[g]->triangles.size(); i++) {
+  facetnorms.reserve( numFaces() );
 
-      wfTriangle &tri = *groups[g]->triangles[i];
+  for (int f=0; f<numFaces(); f++) {
 
-      vec3 d01 = vertices[ tri.vindices[1] ] - vertices[ tri.vindices[0] ];
-      vec3 d02 = vertices[ tri.vindices[2] ] - vertices[ tri.vindices[0] ];
-      vec3 n;
+    vec3 d01 = vertices[ vindices[3*f+1] ] - vertices[ vindices[3*f] ];
+    vec3 d02 = vertices[ vindices[3*f+2] ] - vertices[ vindices[3*f] ];
+    vec3 n;
 
-      if (verticesAreCW)
-        n = (d02 ^ d01).normalize();
-      else
-        n = (d01 ^ d02).normalize();
+    if (verticesAreCW)
+      n = (d02 ^ d01).normalize();
+    else
+      n = (d01 ^ d02).normalize();
 
-      tri.findex = facetnorms.size();
+    if (f < facetnorms.size())	// (when the vertices were moved)
+      facetnorms[f] = n;
+    else
       facetnorms.add( n );
-    }
+  }
 
   // Find bounding box
 
@@ -372,6 +399,108 @@ void wfModel::read( const char *filename )
 }
 
 
+// Add a face (with indices of its vertices, texcoords, and normals)
+// to the end of the face arrays
+
+void wfModel::addFace( GLuint *v, GLuint *t, GLuint *n )
+
+{
+  for (int k=0; k<3; k++) {
+    vindices.add( v[k] );
+    tindices.add( t[k] );
+    nindices.add( n[k] );
+  }
+}
+
+
+// Reorder the faces, which were read in file order, so that the faces
+// of each group are contiguous and in group order.  Within a group,
+// the faces stay in file order.  faceGroup[f] is the group of face f.
+
+void wfModel::sortFacesByGroup( seq<int> &faceGroup )
+
+{
+  int nFaces = faceGroup.size();
+
+  bool inOrder = true;
+  for (int f=1; f<nFaces; f++)
+    if (faceGroup[f] < faceGroup[f-1]) {
+      inOrder = false;
+      break;
+    }
+
+  // Find each group's range of faces
+
+  for (int g=0; g<groups.size(); g++)
+    groups[g]->numFaces = 0;
+
+  for (int f=0; f<nFaces; f++)
+    groups[ faceGroup[f] ]->numFaces++;
+
+  unsigned int first = 0;
+  for (int g=0; g<groups.size(); g++) {
+    groups[g]->firstFace = first;
+    first += groups[g]->numFaces;
+  }
+
+  if (inOrder) // as in most files
+    return;
+
+  // Move the faces
+
+  seq<GLuint> oldV( std::move( vindices ) );
+  seq<GLuint> oldT( std::move( tindices ) );
+  seq<GLuint> oldN( std::move( nindices ) );
+
+  vindices.reserve( 3*nFaces );
+  tindices.reserve( 3*nFaces );
+  nindices.reserve( 3*nFaces );
+
+  GLuint *next = new GLuint[ groups.size() ];
+  for (int g=0; g<groups.size(); g++)
+    next[g] = groups[g]->firstFace;
+
+  for (int i=0; i<3*nFaces; i++) { // make room
+    vindices.add( 0 );
+    tindices.add( 0 );
+    nindices.add( 0 );
+  }
+
+  for (int f=0; f<nFaces; f++) {
+    GLuint to = next[ faceGroup[f] ]++;
+    for (int k=0; k<3; k++) {
+      vindices[3*to+k] = oldV[3*f+k];
+      tindices[3*to+k] = oldT[3*f+k];
+      nindices[3*to+k] = oldN[3*f+k];
+    }
+  }
+
+  delete [] next;
+}
+
+
+// Find the group containing face f.  Groups are in face order, so this
+// is the last group starting at or before f (empty groups that start
+// at f come before the group that contains it).
+
+int wfModel::groupOfFace( int f )
+
+{
+  int lo = 0;
+  int hi = groups.size()-1;
+
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (groups[mid]->firstFace <= (unsigned int) f)
+      lo = mid;
+    else
+      hi = mid-1;
+  }
+
+  return lo;
+}
+
+
 void wfModel::readMaterialLibrary( const char *name )
 
 {
@@ -452,8 +581,11 @@ void wfModel::readMaterialLibrary( const char *name )
       }
       break;
 
-    case 'N':                           /* Ns */ 
-      fscanf(file, "%f", &currentMaterial->shininess);
+    case 'N':                           /* Ns or Ni */ 
+      if (buf[1] == 'i')
+        fscanf(file, "%f", &currentMaterial->ior);
+      else
+        fscanf(file, "%f", &currentMaterial->shininess);
       /* wavefront shininess is from [0, 1000], so scale for OpenGL */
       //currentMaterial->shininess /= 1000.0;
       //currentMaterial->shininess *= 128.0;
@@ -541,22 +673,24 @@ void wfModel::readMaterialLibrary( const char *name )
 }
 
 
-/* read a ppm texture map into the material
+/* get a ppm or png texture map for the material (from the shared
+ * textures, if another material has loaded it)
  */
 
 
 void wfMaterial::loadTexmap( char *filename )
 
 {
+  if (texture != NULL) {
+    texture->release();
+    texture = NULL;
+  }
+
   char *p = strrchr( filename, '.' );
-  if (p == NULL || strcmp( p, ".ppm" ) == 0)
-    texmap = readP6( filename );
-  else if (strcmp( p, ".png" ) == 0)
-    texmap = readPNG( filename );
-  else {
+  if (p == NULL || strcmp( p, ".ppm" ) == 0 || strcmp( p, ".png" ) == 0)
+    texture = Texture::load( filename );
+  else
     cerr << "Cannot read " << filename << ".  Only ppm and png files are handled." << endl;
-    texmap = NULL;
-  }
 }
 
 
@@ -632,7 +766,7 @@ void wfModel::setupVAO( TextureMode textureMode )
 
     wfGroup *thisGroup = groups[i];
 
-    int numTriangles = thisGroup->triangles.size();
+    int numTriangles = thisGroup->numFaces;
 
     if (numTriangles > 0) {
       
@@ -644,9 +778,9 @@ void wfModel::setupVAO( TextureMode textureMode )
 
       VertexSignature *vertSig = new VertexSignature[ numTriangles * 3 ];
 
-      for (int j=0; j<thisGroup->triangles.size(); j++) {
+      for (int j=0; j<numTriangles; j++) {
       
-        wfTriangle *tri = thisGroup->triangles[j];
+        int f = thisGroup->firstFace + j; // this face
 
         for (int k=0; k<3; k++) {
 
@@ -654,9 +788,9 @@ void wfModel::setupVAO( TextureMode textureMode )
 
           VertexSignature vs;
 
-          vs.sig[0] = tri->vindices[k];
-          vs.sig[1] = tri->nindices[k];
-          vs.sig[2] = tri->tindices[k];
+          vs.sig[0] = vindices[3*f+k];
+          vs.sig[1] = nindices[3*f+k];
+          vs.sig[2] = tindices[3*f+k];
 
           unsigned int l;
           for (l=0; l<nVerts; l++)
@@ -665,18 +799,18 @@ void wfModel::setupVAO( TextureMode textureMode )
 
           if (l == nVerts) {    // none found ... create a new vertex
 
-            * (vec3*) &vertexBuffer[nVerts*vertexSize] = vertices[ tri->vindices[k] ];
+            * (vec3*) &vertexBuffer[nVerts*vertexSize] = vertices[ vindices[3*f+k] ];
 
 	    if (hasVertexNormals)
-              * (vec3*) &vertexBuffer[nVerts*vertexSize+3] = normals[ tri->nindices[k] ];
+              * (vec3*) &vertexBuffer[nVerts*vertexSize+3] = normals[ nindices[3*f+k] ];
 	    else
-              * (vec3*) &vertexBuffer[nVerts*vertexSize+3] = facetnorms[ tri->findex ];
+              * (vec3*) &vertexBuffer[nVerts*vertexSize+3] = facetnorms[ f ];
 
             if (hasVertexTexCoords) {
               if (hasVertexNormals || true) // alway has vertex normals now
-                * (vec2*) &vertexBuffer[nVerts*vertexSize+6] = * (vec2*) &texcoords[ tri->tindices[k] ];
+                * (vec2*) &vertexBuffer[nVerts*vertexSize+6] = * (vec2*) &texcoords[ tindices[3*f+k] ];
               else
-                * (vec2*) &vertexBuffer[nVerts*vertexSize+3] = * (vec2*) &texcoords[ tri->tindices[k] ];
+                * (vec2*) &vertexBuffer[nVerts*vertexSize+3] = * (vec2*) &texcoords[ tindices[3*f+k] ];
             }
           
             vertSig[ nVerts ] = vs;
@@ -762,12 +896,17 @@ void wfModel::setupVAO( TextureMode textureMode )
   }
 
   initTextures( textureMode );
+
+  VAOsInitialized = true;
 }
 
 
 void wfModel::draw( GPUProgram * gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS )
 
 {
+  if (!VAOsInitialized)
+    setupVAO( textureMode );
+
   gpuProg->setMat4( "MV",  WCS_to_VCS );
 
   mat4 MVP = VCS_to_CCS * WCS_to_VCS;
@@ -788,7 +927,7 @@ void wfModel::draw( GPUProgram * gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS )
       //   2 = texcoord if normal present
 
       glBindVertexArray( groups[i]->VAO );
-      glDrawElements( GL_TRIANGLES, 3 * groups[i]->triangles.size(), GL_UNSIGNED_INT, 0 );
+      glDrawElements( GL_TRIANGLES, 3 * groups[i]->numFaces, GL_UNSIGNED_INT, 0 );
       glBindVertexArray( 0 );
 
       groups[i]->material->unsetMaterial( true, true, gpuProg );
@@ -813,15 +952,15 @@ void wfMaterial::setMaterial( bool useTextures, bool useMaterial, GPUProgram * g
     gpuProg->setFloat( "shininess", 400 );
   }
 
-  if (useTextures && texmap != NULL) {
+  if (useTextures && texture != NULL) {
 
     // Always use texture unit 0 for the object texture
       
     glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_2D, textureID );
+    glBindTexture( GL_TEXTURE_2D, texture->texID() );
     gpuProg->setInt( "objTexture", 0 );
 
-    if (hasAlpha) {
+    if (texture->hasAlpha) {
       glEnable(GL_BLEND);
       glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     } else
@@ -829,7 +968,7 @@ void wfMaterial::setMaterial( bool useTextures, bool useMaterial, GPUProgram * g
 
   }
 
-  gpuProg->setInt( "texturing", (useTextures && texmap != NULL ? 1 : 0) );
+  gpuProg->setInt( "texturing", (useTextures && texture != NULL ? 1 : 0) );
 }
 
 
@@ -839,7 +978,7 @@ void wfMaterial::unsetMaterial( bool useTextures, bool useMaterial, GPUProgram *
 {
   return;
 
-  if (useTextures && texmap != NULL) {
+  if (useTextures && texture != NULL) {
 
     // Free texture unit 0
 
@@ -860,17 +999,11 @@ void wfMaterial::unsetMaterial( bool useTextures, bool useMaterial, GPUProgram *
 void wfMaterial::storeTexture( TextureMode textureMode )
 
 {
-  // Register it with OpenGL
+  // The texture registers itself with OpenGL (with mipmaps).  Set
+  // its filtering for this model.
 
   glActiveTexture( GL_TEXTURE0 );
-  glBindTexture( GL_TEXTURE_2D, textureID );
-
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-
-  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
-
-  // ordinary texture
+  glBindTexture( GL_TEXTURE_2D, texture->texID() );
 
   if (textureMode == NEAREST) {
  
@@ -900,275 +1033,17 @@ void wfMaterial::storeTexture( TextureMode textureMode )
 
   //glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
   //glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-
-  glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), width, height, 0,
-		(hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, texmap );
-
-  glGenerateMipmap( GL_TEXTURE_2D );
 }
 
 
-/* Initialize the textures by assigning each an OpenGL ID and storing
- * each with OpenGL.
+/* Initialize the textures by storing each with OpenGL.
  */
 
 
 void wfModel::initTextures( TextureMode textureMode )
 
 {
-  // Count the textures
-
-  for (int i=0; i<groups.size(); i++)
-    if (groups[i]->material->texmap != NULL && groups[i]->material->textureID == 0) {
-      glGenTextures(1, &(groups[i]->material->textureID) );
-    }
-
-  // Generate OpenGL texture IDs
-
   for (int i=0; i<groups.size(); i++)
-    if (groups[i]->material->texmap != NULL)
+    if (groups[i]->material->texture != NULL)
       groups[i]->material->storeTexture( textureMode );
 }
-
-
-
-/* Read a texture from a P6 PPM file
- */
-
-
-unsigned char *wfMaterial::readP6( char *filename )
-
-{
-  char buffer[1000];
-  int i, xdim, ydim;
-  unsigned char *a, *b, *pa, *pb;
-
-  FILE *f = fopen( filename, "r" );
-
-  if (!f) {
-    cerr << "Open of `" << filename << "' failed.\n";
-    exit(1);
-  }
-
-  // first line
-
-  do {
-    i = 0;
-    do 
-      fread(&buffer[i],1,1,f);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-
-  if (strncmp( buffer, "P6", 2 ) != 0) {
-    cerr << filename << " is not a P6 file.\n";
-    exit(1);
-  }
-
-  // second line
-
-  do {
-    i = 0;
-    do 
-      fread(&buffer[i],1,1,f);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-  buffer[i] = '\0';
-  sscanf( buffer, "%d %d", &xdim, &ydim );
-
-  width = xdim;
-  height = ydim;
-
-  // third line
-
-  do {
-    i = 0;
-    do 
-      fread(&buffer[i],1,1,f);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-  if (strncmp( buffer, "255", 3 ) != 0) {
-    cerr << filename << " is not a 24-bit file.\n";
-    exit(1);
-  }
-
-  // read the data (stored top-to-bottom, left-to-right)
-
-  a = new unsigned char[ xdim * ydim * 3 ];
-  fread( a, xdim*ydim*3, 1, f );
-
-  // flip the image vertically (stored bottom-to-top, left-to-right)
-
-  b = new unsigned char[ xdim * ydim * 3 ];
-
-  for (int i=0; i<ydim; i++) {
-    pa = a + (i)*xdim*3;
-    pb = b + (ydim-1-i)*xdim*3;
-    for (int j=0; j<xdim*3; j++)
-      *(pb++) = *(pa++);
-  }
-
-  delete [] a;
-
-  hasAlpha = false;
-
-  fclose(f);
-  return b;
-}
-
-
-
-// Read a PNG file.  Most of this code is taken from example.c, which
-// is provided with the libpng distribution.
-
-
-#ifndef png_jmpbuf
-#  define png_jmpbuf(png_ptr) ((png_ptr)->jmpbuf)
-#endif
-
-
-#define PNG_BYTES_TO_CHECK 8
-
-unsigned char *wfMaterial::readPNG( char *filename )
-
-{
-  unsigned char *b;
-
-#ifndef HAVE_PNG
-  cerr << "Trying to read PNG file \"" << filename << "\", but the program wasn't compiled with -DHAVE_PNG." << endl;
-  exit(-1);
-  return b;
-#else
-
-  png_structp png_ptr;
-  png_infop info_ptr;
-  unsigned int sig_read = 0;
-  int bit_depth, color_type, interlace_type;
-  char header[PNG_BYTES_TO_CHECK];
-  
-  // Open file
-
-  FILE *fp = fopen(filename, "rb");
-  if (!fp) {
-    cerr << "Can't open PNG texture file '" << filename << "'." << endl;
-    exit(-1);
-  }
-
-  // Check header
-
-  fread( header, 1, PNG_BYTES_TO_CHECK, fp );
-  bool is_png = !png_sig_cmp( (png_byte*) &header[0], 0, PNG_BYTES_TO_CHECK);
-  if (!is_png) {
-    cerr << "Texture file '" << filename << "' is not in PNG format." << endl;
-    exit(-1);
-  }
-
-  /* Create and initialize the png_struct with the desired error handler
-   * functions.  If you want to use the default stderr and longjump method,
-   * you can supply NULL for the last three parameters.  We also supply the
-   * the compiler header file version, so that we know if the application
-   * was compiled with a compatible version of the library.  REQUIRED
-   */
-
-  png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
-
-  if (png_ptr == NULL) {
-    cerr << "Can't initialize PNG file for reading: " << filename << endl;
-    fclose(fp);
-    exit(-1);
-  }
-
-  /* Allocate/initialize the memory for image information.  REQUIRED. */
-
-  info_ptr = png_create_info_struct(png_ptr);
-  if (info_ptr == NULL)
-    {
-      fclose(fp);
-      png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-      cerr << "Can't allocate memory to read PNG file: " << filename << endl;
-      exit(-1);
-    }
-
-  /* Set error handling if you are using the setjmp/longjmp method (this is
-   * the normal method of doing things with libpng).  REQUIRED unless you
-   * set up your own error handlers in the png_create_read_struct() earlier.
-   */
-
-  if (setjmp(png_jmpbuf(png_ptr))) {
-    /* Free all of the memory associated with the png_ptr and info_ptr */
-    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-    fclose(fp);
-    /* If we get here, we had a problem reading the file */
-    cerr << "Exception occurred while reading PNG file: " << filename << endl;
-    exit(-1);
-  }
-
-  /* Set up the input control if you are using standard C streams */
-
-  png_init_io(png_ptr, fp);
-
-  /* If we have already read some of the signature */
-
-  png_set_sig_bytes(png_ptr, PNG_BYTES_TO_CHECK);
-
-  // Warning: the following does NOT convert grey to RGB:
-
-  png_read_png( png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND, NULL );
-
-  
-  // Store in texmap
-  
-  int numChannels = png_get_channels(png_ptr, info_ptr);
-
-  if (png_get_bit_depth(png_ptr, info_ptr) != 8) {
-    cerr << "Can't handle PNG files with bit depth other than 8.  '" << filename
-         << "' has " << png_get_bit_depth(png_ptr, info_ptr) << " bits per pixel." << endl;
-    exit(-1);
-  }
-
-
-  width = png_get_image_width(png_ptr,info_ptr);
-  height = png_get_image_height(png_ptr,info_ptr);
-
-  int imageSize;
-
-  if (numChannels == 4)
-    imageSize = 4 * width * height;
-  else
-    imageSize = 3 * width * height;
-
-  unsigned char *pb;
-
-  b = pb = new unsigned char[ imageSize ];
-
-  for (int r=(int)info_ptr->height - 1; r >= 0; r--) {
-    png_bytep row = info_ptr->row_pointers[r];
-    int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-    for (int c=0; c < rowbytes; c++)
-      switch (numChannels) {
-      case 1:
-        *(pb)++ = row[c];
-        *(pb)++ = row[c];
-        *(pb)++ = row[c];
-        break;
-      case 2:
-        cerr << "Can't handle a two-channel PNG file: " << filename << endl;
-        exit(-1);
-        break;
-      case 3:
-      case 4:
-        *(pb)++ = row[c];
-        break;
-      }
-  }
-
-  hasAlpha = (numChannels == 4);
-
-  // Clean up PNG stuff
-
-  png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-  fclose(fp);
-
-  return b;
-#endif
-}
-
@@ -15,6 +15,7 @@
 #include "shadeMode.h"
 #include "gpuProgram.h"
 #include "linalg.h"
+#include "texture.h"
 
 
 /* A material with lighting properties and perhaps a texture map
@@ -25,9 +26,6 @@ enum { NEAREST, LINEAR, MIPMAP_NEAREST, MIPMAP_LINEAR };
 typedef int TextureMode;
 class wfMaterial {
 
-  unsigned char *readP6( char *filename ); /* read a P6 PPM file */
-  unsigned char *readPNG( char *filename ); /* read a P6 PPM file */
-
   static unsigned char defaultTexmap[];
 
  public:
@@ -38,13 +36,13 @@ class wfMaterial {
   GLfloat emissive[4];		/* emmissive component */
   GLfloat shininess;		/* specular exponent */
   GLfloat alpha;		/* material property ... not anything to do with the texmap */
+  GLfloat ior;			/* index of refraction */
 
-  GLubyte *texmap;		/* texture map */
-  unsigned int width, height;   /* texmap dimensions */
-  GLuint  textureID;		/* the OpenGL ID for this texture */
-  bool    hasAlpha;		/* texmap has alpha component */
+  Texture *texture;		/* texture map (shared with other materials), or NULL */
 
-  wfMaterial() {}
+  wfMaterial() {
+    texture = NULL;
+  }
 
   wfMaterial( const char *n ) {
     name = new char[ strlen(n)+1 ];
@@ -55,45 +53,35 @@ class wfMaterial {
     specular[0] = 0.3; specular[1] = 0.3; specular[2] = 0.3; specular[3] = 1.0;
     emissive[0] = 0.0; emissive[1] = 0.0; emissive[2] = 0.0; emissive[3] = 1.0;
     alpha = 1.0;
+    ior = 1.5;
     shininess = 200;
-    texmap = NULL;
-    textureID = 0;
-    width = height = 0;
+    texture = NULL;
   }
 
   ~wfMaterial() {
     delete [] name;
+    if (texture != NULL)
+      texture->release();
   }
 
-  void loadTexmap( char *filename ); /* read a ppm texture map */
+  void loadTexmap( char *filename ); /* get a ppm or png texture map */
   void storeTexture( TextureMode tm ); /* record texture with OpenGL */
   void setMaterial( bool useTex, bool useMat, GPUProgram * gpuProg ); /* set the current OpenGL context */
   void unsetMaterial( bool useTextures, bool useMaterial, GPUProgram * gpuProg );
 };
 
 
-/* A triangle with vertices, vertex normals, texture coordinates, and
- * a face normal
- */
-
-
-class wfTriangle {
- public:
-  GLuint vindices[3];		/* array of triangle vertex indices */
-  GLuint nindices[3];		/* array of triangle normal indices */
-  GLuint tindices[3];		/* array of triangle texcoord indices*/
-  GLuint findex;		/* index of triangle facet normal */
-};
-
-
-/* A group of triangles sharing the same material
+/* A group of triangles sharing the same material.  The triangles are
+ * stored in the model (see wfModel below) as faces firstFace
+ * .. firstFace+numFaces-1.
  */
 
 
 class wfGroup {
  public:
   char             *name;	/* name of this group */
-  seq<wfTriangle*> triangles;	/* triangles of this group */
+  unsigned int     firstFace;	/* index of first face of this group in the model */
+  unsigned int     numFaces;	/* number of faces of this group */
   wfMaterial       *material;	/* material for group */
   GLuint           VAO;
   bool             VAOinitialized;
@@ -103,6 +91,8 @@ class wfGroup {
   wfGroup( const char *gname ) {
     name = new char[ strlen(gname)+1 ];
     strcpy( name, gname );
+    firstFace = 0;
+    numFaces = 0;
     VAOinitialized = false;
   }
 
@@ -112,14 +102,16 @@ class wfGroup {
 
   wfGroup( const wfGroup & source ) { // copy constructor
     name = strdup(source.name);
-    triangles = source.triangles;
+    firstFace = source.firstFace;
+    numFaces = source.numFaces;
     material = source.material;
   }
 
   wfGroup const &operator=( wfGroup const &src ) { // assignment operator
     if (this != &src) {
       name = strdup(src.name);
-      triangles = src.triangles;
+      firstFace = src.firstFace;
+      numFaces = src.numFaces;
       material = src.material;
     }
     return *this;
@@ -139,21 +131,37 @@ class wfModel {
   seq<vec3>  vertices;		/* vertices */
   seq<vec3>  normals;		/* face normals */
   seq<vec3>  texcoords;		/* texture coordinates */
-  seq<vec3>  facetnorms;	/* face normals */
+  seq<vec3>  facetnorms;	/* face normals: facetnorms[f] is the normal of face f */
+
+  // The triangular faces, stored contiguously with 3 indices per face
+  // in each array.  Face f has vertices vertices[ vindices[3*f+k] ]
+  // for k = 0,1,2, and likewise for normals and texcoords.  Faces are
+  // sorted by group.
+
+  seq<GLuint> vindices;		/* indices into vertices */
+  seq<GLuint> nindices;		/* indices into normals (if hasVertexNormals) */
+  seq<GLuint> tindices;		/* indices into texcoords (if hasVertexTexCoords) */
 
   seq<wfMaterial*> materials;	/* materials */
-  seq<wfGroup*>    groups;	/* groups (which themselves store the triangles) */
+  seq<wfGroup*>    groups;	/* groups (which refer to ranges of faces) */
 
   bool texturesInitialized;
+  bool VAOsInitialized;
+  TextureMode textureMode;	/* used when the VAOs are set up on the first draw() */
 
   wfMaterial* findMaterial( const char *name );            /* find a named material */
   wfGroup*    findGroup( const char *name );               /* find a named group */
   void        readMaterialLibrary( const char *filename ); /* read all materials */
+  void        addFace( GLuint *v, GLuint *t, GLuint *n );    /* add a face during read() */
+  void        sortFacesByGroup( seq<int> &faceGroup );       /* make each group's faces contiguous */
+  void        computeFacetNormsAndExtents();                 /* from the vertices */
 
   int lineNum;
   unsigned int nFaces;
 
   friend class WavefrontObj;
+  friend class BVH;
+  friend class KernelBench;
 
  public:
 
@@ -173,22 +181,39 @@ class wfModel {
 
   wfModel() {
     texturesInitialized = false;
+    VAOsInitialized = false;
+    textureMode = MIPMAP_LINEAR;
     pathname = mtllibname = NULL;
     objToWorldTransform = identity4();
   }
 
-  wfModel( const char *filename, TextureMode textureMode ) {
+  // The VAOs are set up on the first draw() so that a model can be
+  // read without an OpenGL context.
+
+  wfModel( const char *filename, TextureMode tm ) {
     texturesInitialized = false;
+    VAOsInitialized = false;
+    textureMode = tm;
     pathname = mtllibname = NULL;
     objToWorldTransform = identity4();
     read( filename );
-    setupVAO( textureMode );
   }
 
   ~wfModel() {
   }
 
   void read( const char *filename );         /* instantiate this model from a file */
+  void setVertices( seq<vec3> &newVertices, seq<vec3> *newNormals = NULL ); /* move the vertices (e.g. for animation) */
+
+  const char *path() {
+    return pathname;
+  }
+
+  int numFaces() {
+    return vindices.size() / 3;
+  }
+
+  int groupOfFace( int f );                   /* index of the group containing face f */
   void draw( GPUProgram * gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS );
   void setupVAO( TextureMode textureMode );
   void initTextures( TextureMode tm );        /* assign texture IDs and store all textures */
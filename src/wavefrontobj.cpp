@@ -8,7 +8,8 @@
 #include "bvh.h"
 
 
-// Convert Wavefront object to a list of materials and triangles for the BVH.
+// Set up the BVH to use the triangles of the Wavefront object, and
+// convert the Wavefront materials.
 
 void WavefrontObj::copyWavefrontToBVH( BVH &bvh )
 
@@ -19,6 +20,12 @@ void WavefrontObj::copyWavefrontToBVH( BVH &bvh )
   bvh.normals   = &obj->normals;
   bvh.facetnorms= &obj->facetnorms;
 
+  // The triangles are those of the object, used in place
+
+  bvh.vindices  = &obj->vindices;
+  bvh.tindices  = &obj->tindices;
+  bvh.nindices  = &obj->nindices;
+
   // Each group in the wavefront object
   
   for (int groupID=0; groupID<obj->groups.size(); groupID++) {
@@ -35,14 +42,11 @@ void WavefrontObj::copyWavefrontToBVH( BVH &bvh )
     toMat->n  = fromMat->shininess;
     toMat->Ie = fromMat->emissive;
     toMat->alpha = fromMat->alpha;
+    toMat->ior = fromMat->ior;
 
-    if (fromMat->texmap != NULL) {
-      Texture *tex = new Texture(); // not used for OpenGL ... just for raytracing lookups
-      tex->texmap    = fromMat->texmap;
-      tex->width     = fromMat->width;
-      tex->height    = fromMat->height;
-      tex->hasAlpha  = fromMat->hasAlpha;
-      toMat->texture = tex;
+    if (fromMat->texture != NULL) {
+      toMat->texture = fromMat->texture; // shared
+      toMat->texture->addReference();
     }
 
     // Not provided in wfMaterial:
@@ -52,19 +56,8 @@ void WavefrontObj::copyWavefrontToBVH( BVH &bvh )
     toMat->g           = 1;
     toMat->alpha       = 1;
 
-    // Add to Materials
+    // Add to Materials (so that bvh.materials[i] is the material of group i)
 
     bvh.materials.add( toMat );
-
-    // Add the triangles of this group
-
-    for (int j=0; j<obj->groups[groupID]->triangles.size(); j++) {
-      wfTriangle *tri = obj->groups[groupID]->triangles[j];
-      bvh.triangles.add( BVH_triangle( tri->vindices[0], tri->vindices[1], tri->vindices[2], // indices into vertices[] 
-				       tri->tindices[0], tri->tindices[1], tri->tindices[2], // indices into texcoords[]
-				       tri->nindices[0], tri->nindices[1], tri->nindices[2], // indices into normals[]
-				       bvh.materials.size()-1,                               // index into mats[]
-				       tri->findex ) );                                      // index into facetnorms[]
-    }    
   }
 }
@@ -29,16 +29,25 @@ class WavefrontObj : public Object {
     bvh.buildTree(); // Build the BVH
   }
 
+  // Move the vertices (in object coordinates) for a new frame of an
+  // animation, and refit the BVH to them
+
+  void setVertices( seq<vec3> &newVertices, seq<vec3> *newNormals = NULL ) {
+    obj->setVertices( newVertices, newNormals );
+    bvh.refit();
+  }
+
   void renderGL( GPUProgram * gpuProg, mat4 &WCS_to_VCS, mat4 &VCS_to_CCS ) {
     obj->draw( gpuProg, WCS_to_VCS, VCS_to_CCS );
   }
   
-  bool rayInt( vec3 rayStart, vec3 rayDir, int objPartIndex, float maxParam, vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material * &mat, int &intPartIndex ) {
-    return bvh.rayInt( rayStart, rayDir, objPartIndex, maxParam, intPoint, intNorm, intTexCoords, intParam, mat, intPartIndex );
+  bool rayInt( Ray &ray, vec3 &intPoint, vec3 &intNorm, vec3 &intTexCoords, float &intParam, Material * &mat, int &intPartIndex ) {
+    int sourceTriangleIndex = (ray.originObj == this ? ray.originPart : -1);
+    return bvh.rayInt( ray, sourceTriangleIndex, intPoint, intNorm, intTexCoords, intParam, mat, intPartIndex );
   }
 
-  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords ) {
-    return bvh.textureColour( p, objPartIndex, alpha, texCoords );
+  vec3 textureColour( vec3 &p, int objPartIndex, float &alpha, vec3 &texCoords, float footprint ) {
+    return bvh.textureColour( p, objPartIndex, alpha, texCoords, footprint );
   }
 
   void renderGL() {